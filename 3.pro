@@ -1,6 +1,6 @@
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 CONFIG += c++17
 
@@ -8,12 +8,66 @@ CONFIG += c++17
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Uncomment to compile out the performance instrumentation (see profiler.h).
+#DEFINES += DIAGRAM_NO_PROFILING
+
 SOURCES += \
+    alignmentguides.cpp \
+    autosavejournal.cpp \
+    batchmode.cpp \
+    changetracker.cpp \
+    chunkeddocument.cpp \
+    connectiongraph.cpp \
+    diagram.cpp \
+    documentio.cpp \
+    documenttask.cpp \
+    figure.cpp \
+    figurestore.cpp \
+    forcelayout.cpp \
+    graphsnapshot.cpp \
+    hittest.cpp \
+    layouttask.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    pageddocument.cpp \
+    profiler.cpp \
+    scenerenderer.cpp \
+    segmentindex.cpp \
+    spatialindex.cpp \
+    symbollibrary.cpp \
+    tilerenderer.cpp \
+    undohistory.cpp \
+    vectorexport.cpp \
+    viewport.cpp
 
 HEADERS += \
-    mainwindow.h
+    alignmentguides.h \
+    autosavejournal.h \
+    batchmode.h \
+    changetracker.h \
+    chunkeddocument.h \
+    connectiongraph.h \
+    diagram.h \
+    diagramlistener.h \
+    documentio.h \
+    documenttask.h \
+    figure.h \
+    figurestore.h \
+    forcelayout.h \
+    graphsnapshot.h \
+    hittest.h \
+    layouttask.h \
+    mainwindow.h \
+    pageddocument.h \
+    profiler.h \
+    scenerenderer.h \
+    segmentindex.h \
+    spatialindex.h \
+    symbollibrary.h \
+    tilerenderer.h \
+    undohistory.h \
+    vectorexport.h \
+    viewport.h
 
 FORMS += \
     mainwindow.ui
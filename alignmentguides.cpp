@@ -0,0 +1,133 @@
+#include "alignmentguides.h"
+
+#include <QtMath>
+
+#include <algorithm>
+
+#include "profiler.h"
+
+AlignmentGuides::AlignmentGuides() : gridSize(0) {}
+
+void AlignmentGuides::build(const Diagram &diagram, const QVector<int> &ids) {
+    PROFILE_SCOPE("AlignmentGuides::build");
+    clear();
+    xs.reserve(ids.size() * 3);
+    ys.reserve(ids.size() * 3);
+    for (int id : ids) {
+        const QRect r = diagram.figure(id)->rect.normalized();
+        const QPoint center = r.center();
+        xs.append({ r.left(), r.top(), r.bottom() });
+        xs.append({ center.x(), r.top(), r.bottom() });
+        xs.append({ r.right(), r.top(), r.bottom() });
+        ys.append({ r.top(), r.left(), r.right() });
+        ys.append({ center.y(), r.left(), r.right() });
+        ys.append({ r.bottom(), r.left(), r.right() });
+    }
+    std::sort(xs.begin(), xs.end());
+    std::sort(ys.begin(), ys.end());
+}
+
+void AlignmentGuides::clear() {
+    xs.clear();
+    ys.clear();
+}
+
+int AlignmentGuides::nearest(const QVector<Anchor> &anchors, const int *values, int count, int tolerance,
+                             bool *found) {
+    int best = 0;
+    *found = false;
+    auto consider = [&](const Anchor &anchor, int value) {
+        const int offset = anchor.value - value;
+        if (qAbs(offset) <= tolerance && (!*found || qAbs(offset) < qAbs(best))) {
+            best = offset;
+            *found = true;
+        }
+    };
+    for (int i = 0; i < count; ++i) {
+        // Ближайшая линия - первая не меньше значения или предыдущая
+        auto it = std::lower_bound(anchors.constBegin(), anchors.constEnd(), Anchor{ values[i], 0, 0 });
+        if (it != anchors.constEnd()) {
+            consider(*it, values[i]);
+        }
+        if (it != anchors.constBegin()) {
+            consider(*(it - 1), values[i]);
+        }
+    }
+    return best;
+}
+
+int AlignmentGuides::gridOffset(int value) const {
+    if (gridSize == 0) {
+        return 0;
+    }
+    return qRound(qreal(value) / gridSize) * gridSize - value;
+}
+
+void AlignmentGuides::collectGuides(const QVector<Anchor> &anchors, const int *values, int count, int from, int to,
+                                    bool vertical, QVector<QLine> *guides) {
+    for (int i = 0; i < count; ++i) {
+        // Центр вырожденной фигуры совпадает с краем: линия рисуется один раз
+        if (std::find(values, values + i, values[i]) != values + i) {
+            continue;
+        }
+        const auto range = std::equal_range(anchors.constBegin(), anchors.constEnd(), Anchor{ values[i], 0, 0 });
+        if (range.first == range.second) {
+            continue;
+        }
+        // Направляющая тянется от перетаскиваемой фигуры через все фигуры на этой линии
+        int start = from;
+        int end = to;
+        for (auto it = range.first; it != range.second; ++it) {
+            start = qMin(start, it->from);
+            end = qMax(end, it->to);
+        }
+        guides->append(vertical ? QLine(values[i], start, values[i], end) : QLine(start, values[i], end, values[i]));
+    }
+}
+
+QPoint AlignmentGuides::snapValues(const int *xValues, const int *yValues, int count, const QRect &extent,
+                                   int tolerance, QVector<QLine> *guides) const {
+    bool foundX = false;
+    bool foundY = false;
+    int dx = nearest(xs, xValues, count, tolerance, &foundX);
+    int dy = nearest(ys, yValues, count, tolerance, &foundY);
+    // Линии соседних фигур важнее сетки
+    if (!foundX) {
+        dx = gridOffset(xValues[0]);
+    }
+    if (!foundY) {
+        dy = gridOffset(yValues[0]);
+    }
+    if (guides) {
+        guides->clear();
+        const QRect moved = extent.translated(dx, dy);
+        int shifted[3];
+        if (foundX) {
+            for (int i = 0; i < count; ++i) {
+                shifted[i] = xValues[i] + dx;
+            }
+            collectGuides(xs, shifted, count, moved.top(), moved.bottom(), true, guides);
+        }
+        if (foundY) {
+            for (int i = 0; i < count; ++i) {
+                shifted[i] = yValues[i] + dy;
+            }
+            collectGuides(ys, shifted, count, moved.left(), moved.right(), false, guides);
+        }
+    }
+    return QPoint(dx, dy);
+}
+
+QPoint AlignmentGuides::snap(const QRect &rect, int tolerance, QVector<QLine> *guides) const {
+    const QRect r = rect.normalized();
+    const QPoint center = r.center();
+    const int xValues[3] = { r.left(), center.x(), r.right() };
+    const int yValues[3] = { r.top(), center.y(), r.bottom() };
+    return snapValues(xValues, yValues, 3, r, tolerance, guides);
+}
+
+QPoint AlignmentGuides::snap(const QPoint &point, int tolerance, QVector<QLine> *guides) const {
+    const int xValue = point.x();
+    const int yValue = point.y();
+    return snapValues(&xValue, &yValue, 1, QRect(point, point), tolerance, guides);
+}
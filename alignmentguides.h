@@ -0,0 +1,62 @@
+// alignmentguides.h
+
+#ifndef ALIGNMENTGUIDES_H
+#define ALIGNMENTGUIDES_H
+
+#include <QLine>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+#include "diagram.h"
+
+// Привязка к сетке и к краям и центрам соседних фигур при рисовании и перетаскивании.
+// Левые края, центры и правые края опорных фигур лежат в массиве, отсортированном
+// по x, верхние края, центры и нижние - в массиве по y. Ближайшая линия ищется
+// двоичным поиском, фигуры на найденной линии - диапазоном равных значений,
+// поэтому каждое движение мыши стоит O(log n) независимо от числа фигур.
+class AlignmentGuides {
+public:
+    AlignmentGuides();
+
+    // Шаг сетки в единицах сцены; 0 - без сетки
+    void setGridSize(int size) { gridSize = qMax(0, size); }
+    int grid() const { return gridSize; }
+
+    // Опорные фигуры ids; перетаскиваемые фигуры в них не входят
+    void build(const Diagram &diagram, const QVector<int> &ids);
+    void clear();
+    bool isEmpty() const { return xs.isEmpty(); }
+
+    // Смещение, после которого край или центр rect ложится на линию опорной фигуры
+    // не дальше tolerance, а если такой нет - левый верхний угол ложится на сетку.
+    // В guides попадают отрезки линий, на которые легла привязка (для отрисовки).
+    QPoint snap(const QRect &rect, int tolerance, QVector<QLine> *guides = nullptr) const;
+    // То же для одной точки (угол рисуемой фигуры)
+    QPoint snap(const QPoint &point, int tolerance, QVector<QLine> *guides = nullptr) const;
+
+private:
+    // Линия опорной фигуры: координата по своей оси и протяженность фигуры по другой
+    struct Anchor {
+        int value;
+        int from;
+        int to;
+
+        bool operator<(const Anchor &other) const { return value < other.value; }
+    };
+
+    QVector<Anchor> xs;   // Вертикальные линии, по возрастанию x
+    QVector<Anchor> ys;   // Горизонтальные линии, по возрастанию y
+    int gridSize;
+
+    // Поправка по одной оси для значений values (края и центр); found - нашлась ли линия
+    static int nearest(const QVector<Anchor> &anchors, const int *values, int count, int tolerance, bool *found);
+    int gridOffset(int value) const;
+    // Отрезки линий, на которых лежат values после привязки, с протяженностью [from, to]
+    static void collectGuides(const QVector<Anchor> &anchors, const int *values, int count, int from, int to,
+                              bool vertical, QVector<QLine> *guides);
+    QPoint snapValues(const int *xValues, const int *yValues, int count, const QRect &extent, int tolerance,
+                      QVector<QLine> *guides) const;
+};
+
+#endif // ALIGNMENTGUIDES_H
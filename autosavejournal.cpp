@@ -0,0 +1,486 @@
+#include "autosavejournal.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "documentio.h"
+#include "profiler.h"
+
+namespace {
+const quint32 kJournalMagic = 0x444a524e;   // "DJRN"
+const quint16 kJournalVersion = 1;
+const int kJournalHeaderSize = 8;
+const int kRecordHeaderSize = 8;            // Длина и контрольная сумма записи
+// Пачка правок копится не дольше этого, затем пишется одним fsync
+const int kSyncIntervalMs = 500;
+// Большая пачка пишется сразу, не дожидаясь интервала
+const qint64 kMaxBatchBytes = 4 * 1024 * 1024;
+// Журнал длиннее этого сворачивается в новый снимок
+const qint64 kCompactBytes = 32 * 1024 * 1024;
+
+enum Operation : quint8 {
+    AddOperation = 1,
+    MoveOperation,
+    ShiftOperation,
+    RemoveOperation,
+    InsertOperation,
+    ConnectOperation,
+    DisconnectOperation,
+    DefineSymbolOperation
+};
+
+// Номера символов экземпляров пишутся после остальных данных записи
+// списком, параллельным фигурам (operator<< для Figure их не пишет)
+QVector<qint32> symbolsOf(const QVector<Figure> &figures) {
+    QVector<qint32> symbols;
+    symbols.reserve(figures.size());
+    for (const Figure &figure : figures) {
+        symbols.append(figure.symbol);
+    }
+    return symbols;
+}
+
+void readSymbols(QDataStream &in, QVector<Figure> &figures) {
+    QVector<qint32> symbols;
+    in >> symbols;
+    if (symbols.size() == figures.size()) {
+        for (int i = 0; i < figures.size(); ++i) {
+            figures[i].symbol = symbols[i];
+        }
+    }
+}
+
+QString snapshotPath(const QString &directory, quint64 generation) {
+    return QDir(directory).filePath(QString("snapshot-%1.dgm").arg(generation));
+}
+
+QString journalPath(const QString &directory, quint64 generation) {
+    return QDir(directory).filePath(QString("journal-%1.log").arg(generation));
+}
+
+// Номер самого нового полного снимка в каталоге или 0.
+// Снимок появляется под своим именем только после записи (переименованием),
+// поэтому недописанные снимки сюда не попадают.
+quint64 latestGeneration(const QString &directory) {
+    quint64 latest = 0;
+    const QStringList names = QDir(directory).entryList(QStringList() << "snapshot-*.dgm", QDir::Files);
+    for (const QString &name : names) {
+        bool ok = false;
+        const quint64 generation = name.mid(9, name.size() - 13).toULongLong(&ok);
+        if (ok) {
+            latest = qMax(latest, generation);
+        }
+    }
+    return latest;
+}
+
+// Удаление снимков и журналов с номером меньше keep (все, если keep == 0)
+void removeGenerations(const QString &directory, quint64 keep) {
+    QDir dir(directory);
+    const QStringList names = dir.entryList(QStringList() << "snapshot-*.dgm" << "snapshot-*.tmp" << "journal-*.log",
+                                            QDir::Files);
+    for (const QString &name : names) {
+        const int dash = name.indexOf('-');
+        const int dot = name.indexOf('.');
+        bool ok = false;
+        const quint64 generation = name.mid(dash + 1, dot - dash - 1).toULongLong(&ok);
+        if (keep == 0 || !ok || generation < keep) {
+            dir.remove(name);
+        }
+    }
+}
+
+quint32 checksum(const char *data, int size) {
+    // FNV-1a: оборванную или испорченную запись отличает надежно и быстро
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < size; ++i) {
+        hash = (hash ^ quint8(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Сброс файла на диск, а не только в кэш ОС
+bool syncFile(QFile &file) {
+    if (!file.flush()) {
+        return false;
+    }
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+// После переименования нужно сбросить и каталог, иначе новое имя может не пережить сбой
+void syncDirectory(const QString &directory) {
+#ifndef Q_OS_WIN
+    const int fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY);
+    if (fd != -1) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+void replayRecord(const QByteArray &payload, Diagram &diagram) {
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint8 operation = 0;
+    in >> operation;
+    switch (operation) {
+    case AddOperation: {
+        QVector<Figure> figures(1);
+        in >> figures[0];
+        readSymbols(in, figures);
+        diagram.insertFigures(figures, QVector<Connection>());
+        break;
+    }
+    case MoveOperation: {
+        QVector<int> ids;
+        QPoint delta;
+        in >> ids >> delta;
+        diagram.moveFigures(ids, delta);
+        break;
+    }
+    case ShiftOperation: {
+        QVector<int> ids;
+        QVector<QPoint> deltas;
+        in >> ids >> deltas;
+        if (ids.size() == deltas.size()) {
+            diagram.moveFigures(ids, deltas);
+        }
+        break;
+    }
+    case RemoveOperation: {
+        QVector<int> ids;
+        in >> ids;
+        diagram.removeFigures(ids);
+        break;
+    }
+    case InsertOperation: {
+        QVector<Figure> figures;
+        QVector<Connection> connections;
+        in >> figures >> connections;
+        readSymbols(in, figures);
+        diagram.insertFigures(figures, connections);
+        break;
+    }
+    case DefineSymbolOperation: {
+        QVector<Figure> figures;
+        QVector<Connection> connections;
+        in >> figures >> connections;
+        readSymbols(in, figures);
+        diagram.defineSymbol(figures, connections);
+        break;
+    }
+    case ConnectOperation:
+    case DisconnectOperation: {
+        qint32 from = 0;
+        qint32 to = 0;
+        in >> from >> to;
+        if (operation == ConnectOperation) {
+            diagram.connectFigures(from, to);
+        } else {
+            diagram.disconnectFigures(from, to);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+}
+
+AutosaveJournal::AutosaveJournal(const QString &directory)
+    : dir(directory), document(nullptr), journalBytes(0), queuedBytes(0), stopping(false),
+      writer(nullptr), generation(0) {}
+
+AutosaveJournal::~AutosaveJournal() {
+    stop();
+}
+
+QString AutosaveJournal::defaultDirectory() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("autosave");
+}
+
+bool AutosaveJournal::hasRecovery(const QString &directory) {
+    return latestGeneration(directory) != 0;
+}
+
+bool AutosaveJournal::recover(const QString &directory, Diagram &diagram, QString *errorMessage) {
+    PROFILE_SCOPE("AutosaveJournal::recover");
+    const quint64 latest = latestGeneration(directory);
+    if (latest == 0) {
+        if (errorMessage) {
+            *errorMessage = "Ошибка: автосохранение не найдено";
+        }
+        return false;
+    }
+    Diagram recovered;
+    if (!loadBinary(snapshotPath(directory, latest), recovered, errorMessage)) {
+        return false;
+    }
+
+    // Журнала может не быть, если сбой случился сразу после записи снимка
+    QFile file(journalPath(directory, latest));
+    if (file.open(QIODevice::ReadOnly)) {
+        const QByteArray bytes = file.readAll();
+        const char *data = bytes.constData();
+        if (bytes.size() >= kJournalHeaderSize && qFromBigEndian<quint32>(data) == kJournalMagic
+                && qFromBigEndian<quint16>(data + 4) <= kJournalVersion) {
+            int pos = kJournalHeaderSize;
+            while (bytes.size() - pos >= kRecordHeaderSize) {
+                const quint32 size = qFromBigEndian<quint32>(data + pos);
+                const quint32 sum = qFromBigEndian<quint32>(data + pos + 4);
+                if (size > quint32(bytes.size() - pos - kRecordHeaderSize)
+                        || checksum(data + pos + kRecordHeaderSize, int(size)) != sum) {
+                    break;
+                }
+                replayRecord(QByteArray::fromRawData(data + pos + kRecordHeaderSize, int(size)), recovered);
+                pos += kRecordHeaderSize + int(size);
+            }
+        }
+    }
+    diagram = recovered;
+    return true;
+}
+
+void AutosaveJournal::start(Diagram &diagram) {
+    if (document) {
+        return;
+    }
+    QDir().mkpath(dir);
+    // Новые файлы получают номер больше любого оставшегося в каталоге;
+    // старые удаляются после записи первого снимка
+    generation = latestGeneration(dir);
+    stopping = false;
+    document = &diagram;
+    document->setListener(this);
+    requestSnapshot(diagram);
+    writer = QThread::create([this]() { writerLoop(); });
+    writer->start();
+}
+
+void AutosaveJournal::stop(bool discardFiles) {
+    if (document) {
+        document->setListener(nullptr);
+        document = nullptr;
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            wake.wakeOne();
+        }
+        writer->wait();
+        delete writer;
+        writer = nullptr;
+    }
+    if (discardFiles) {
+        removeGenerations(dir, 0);
+    }
+}
+
+void AutosaveJournal::append(const QByteArray &payload) {
+    QByteArray record(kRecordHeaderSize, '\0');
+    record.reserve(kRecordHeaderSize + payload.size());
+    qToBigEndian<quint32>(quint32(payload.size()), record.data());
+    qToBigEndian<quint32>(checksum(payload.constData(), payload.size()), record.data() + 4);
+    record += payload;
+    journalBytes += record.size();
+    {
+        QMutexLocker locker(&mutex);
+        const bool wasEmpty = queue.isEmpty();
+        if (wasEmpty) {
+            queue.append(Entry());
+        }
+        queue.last().records += record;
+        queuedBytes += record.size();
+        // Поток записи будится только на первую запись пачки и на переполнение
+        if (wasEmpty || queuedBytes >= kMaxBatchBytes) {
+            wake.wakeOne();
+        }
+    }
+    if (journalBytes >= kCompactBytes && document) {
+        requestSnapshot(*document);
+    }
+}
+
+void AutosaveJournal::requestSnapshot(const Diagram &diagram) {
+    // Копия дешевая: контейнеры разделяются с документом, пока он не изменится
+    journalBytes = 0;
+    Entry entry;
+    entry.snapshot = QSharedPointer<const Diagram>(new Diagram(diagram));
+    QMutexLocker locker(&mutex);
+    queue.append(entry);
+    wake.wakeOne();
+}
+
+void AutosaveJournal::writerLoop() {
+    QElapsedTimer sinceSync;
+    sinceSync.start();
+    for (;;) {
+        QVector<Entry> batch;
+        {
+            QMutexLocker locker(&mutex);
+            while (queue.isEmpty() && !stopping) {
+                wake.wait(&mutex);
+            }
+            // Правки копятся до конца интервала, чтобы на пачку приходился один fsync;
+            // новый снимок и остановка не ждут
+            while (!stopping && queuedBytes < kMaxBatchBytes && !queue.last().snapshot) {
+                // Остаток интервала читается один раз: иначе он может стать отрицательным
+                const qint64 left = kSyncIntervalMs - sinceSync.elapsed();
+                if (left <= 0) {
+                    break;
+                }
+                wake.wait(&mutex, (unsigned long)left);
+            }
+            batch.swap(queue);
+            queuedBytes = 0;
+        }
+        if (batch.isEmpty()) {
+            break;
+        }
+
+        PROFILE_SCOPE("AutosaveJournal::write");
+        for (const Entry &entry : batch) {
+            if (entry.snapshot) {
+                writeSnapshot(*entry.snapshot);
+            }
+            // Если снимок записать не удалось, журнал закрыт: записи после снимка
+            // нельзя дописать к старому журналу, и они теряются до следующего снимка
+            if (!entry.records.isEmpty() && journal.isOpen()) {
+                journal.write(entry.records);
+            }
+        }
+        if (journal.isOpen() && !syncFile(journal)) {
+            qDebug() << "Ошибка: не удалось записать журнал автосохранения";
+        }
+        sinceSync.restart();
+    }
+    journal.close();
+}
+
+bool AutosaveJournal::writeSnapshot(const Diagram &diagram) {
+    PROFILE_SCOPE("AutosaveJournal::writeSnapshot");
+    journal.close();
+    const quint64 next = generation + 1;
+
+    // Снимок пишется во временный файл и появляется под своим именем
+    // только целиком; затем начинается пустой журнал к нему
+    const QString path = snapshotPath(dir, next);
+    const QString temporary = path + ".tmp";
+    QString error;
+    bool ok = saveBinary(temporary, diagram, &error);
+    if (ok) {
+        QFile file(temporary);
+        ok = file.open(QIODevice::ReadWrite) && syncFile(file);
+    }
+    ok = ok && QFile::rename(temporary, path);
+    if (!ok) {
+        QFile::remove(temporary);
+        qDebug() << "Ошибка: не удалось записать снимок автосохранения" << error;
+        return false;
+    }
+
+    journal.setFileName(journalPath(dir, next));
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Ошибка: не удалось открыть журнал автосохранения";
+        return false;
+    }
+    char header[kJournalHeaderSize];
+    qToBigEndian<quint32>(kJournalMagic, header);
+    qToBigEndian<quint16>(kJournalVersion, header + 4);
+    qToBigEndian<quint16>(0, header + 6);
+    journal.write(header, kJournalHeaderSize);
+    syncFile(journal);
+    syncDirectory(dir);
+
+    // Новая пара файлов на диске; прежние больше не нужны для восстановления
+    generation = next;
+    removeGenerations(dir, generation);
+    return true;
+}
+
+void AutosaveJournal::figureAdded(const Figure &figure) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(AddOperation) << figure << symbolsOf(QVector<Figure>{ figure });
+    append(payload);
+}
+
+void AutosaveJournal::figuresMoved(const QVector<int> &ids, const QPoint &delta) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(MoveOperation) << ids << delta;
+    append(payload);
+}
+
+void AutosaveJournal::figuresShifted(const QVector<int> &ids, const QVector<QPoint> &deltas) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(ShiftOperation) << ids << deltas;
+    append(payload);
+}
+
+void AutosaveJournal::figuresRemoved(const QVector<int> &ids) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(RemoveOperation) << ids;
+    append(payload);
+}
+
+void AutosaveJournal::figuresInserted(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(InsertOperation) << figures << connections << symbolsOf(figures);
+    append(payload);
+}
+
+void AutosaveJournal::figuresConnected(int from, int to) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(ConnectOperation) << qint32(from) << qint32(to);
+    append(payload);
+}
+
+void AutosaveJournal::figuresDisconnected(int from, int to) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(DisconnectOperation) << qint32(from) << qint32(to);
+    append(payload);
+}
+
+void AutosaveJournal::symbolDefined(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint8(DefineSymbolOperation) << figures << connections << symbolsOf(figures);
+    append(payload);
+}
+
+void AutosaveJournal::documentReplaced(const Diagram &diagram) {
+    // Замену целиком нечем описать короче самого документа: журнал
+    // начинается заново с его снимка
+    requestSnapshot(diagram);
+}
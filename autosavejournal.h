@@ -0,0 +1,87 @@
+// autosavejournal.h
+
+#ifndef AUTOSAVEJOURNAL_H
+#define AUTOSAVEJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "diagram.h"
+#include "diagramlistener.h"
+
+// Журнал автосохранения для восстановления после сбоя.
+// Каталог хранит снимок документа в двоичном формате и журнал правок,
+// сделанных после снимка. Каждая правка кодируется в главном потоке в
+// короткую запись с длиной и контрольной суммой и ставится в очередь;
+// на диск очередь пишет отдельный поток, пачками, с одним fsync на пачку.
+// Когда журнал разрастается или документ заменяется целиком, тот же поток
+// пишет новый снимок и начинает новый журнал, а старые файлы удаляет.
+// Редактирование никогда не ждет диска.
+class AutosaveJournal : public DiagramListener {
+public:
+    explicit AutosaveJournal(const QString &directory = defaultDirectory());
+    ~AutosaveJournal() override;
+
+    // Каталог автосохранения в данных приложения
+    static QString defaultDirectory();
+    // Остались ли в каталоге файлы, например после аварийного завершения
+    static bool hasRecovery(const QString &directory);
+    // Снимок плюс уцелевшие записи журнала. Оборванная при сбое запись
+    // и все, что за ней, отбрасываются.
+    static bool recover(const QString &directory, Diagram &diagram, QString *errorMessage = nullptr);
+
+    // Начало журнала: снимок документа и подписка на его правки.
+    // Прежние файлы каталога заменяются.
+    void start(Diagram &diagram);
+    // Отписка от документа и дозапись очереди; discardFiles удаляет
+    // снимок и журнал (например, при штатном выходе)
+    void stop(bool discardFiles = false);
+    bool isActive() const { return document != nullptr; }
+    QString directory() const { return dir; }
+
+    void figureAdded(const Figure &figure) override;
+    void figuresMoved(const QVector<int> &ids, const QPoint &delta) override;
+    void figuresShifted(const QVector<int> &ids, const QVector<QPoint> &deltas) override;
+    void figuresRemoved(const QVector<int> &ids) override;
+    void figuresInserted(const QVector<Figure> &figures, const QVector<Connection> &connections) override;
+    void figuresConnected(int from, int to) override;
+    void figuresDisconnected(int from, int to) override;
+    void symbolDefined(const QVector<Figure> &figures, const QVector<Connection> &connections) override;
+    void documentReplaced(const Diagram &diagram) override;
+
+private:
+    // Элемент очереди: новый снимок (если есть) и записи, сделанные после него
+    struct Entry {
+        QSharedPointer<const Diagram> snapshot;
+        QByteArray records;
+    };
+
+    QString dir;
+    Diagram *document;      // Документ, за которым ведется журнал, иначе nullptr
+    qint64 journalBytes;    // Объем записей после последнего снимка (главный поток)
+
+    // Общие для главного потока и потока записи, под mutex
+    QMutex mutex;
+    QWaitCondition wake;
+    QVector<Entry> queue;
+    qint64 queuedBytes;
+    bool stopping;
+
+    // Только поток записи
+    QThread *writer;
+    QFile journal;
+    quint64 generation;     // Номер текущей пары "снимок + журнал"
+
+    void append(const QByteArray &payload);
+    void requestSnapshot(const Diagram &diagram);
+    void writerLoop();
+    bool writeSnapshot(const Diagram &diagram);
+};
+
+#endif // AUTOSAVEJOURNAL_H
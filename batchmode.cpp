@@ -0,0 +1,286 @@
+#include "batchmode.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <cstdio>
+#include <cstring>
+
+#include "documentio.h"
+#include "profiler.h"
+#include "tilerenderer.h"
+#include "vectorexport.h"
+#include "viewport.h"
+
+namespace {
+
+const char *const kCommands[] = { "validate", "convert", "render", "export" };
+// Поля вокруг документа на картинке, в единицах сцены
+const int kRenderMargin = 10;
+// Размер пустого документа на картинке
+const int kEmptyRenderSize = 64;
+const int kDefaultRenderSize = 2048;
+
+// Коды завершения процесса
+const int kExitOk = 0;
+const int kExitFailed = 1;   // Хотя бы один файл не обработан или не прошел проверку
+const int kExitUsage = 2;    // Ошибка в командной строке
+
+enum class Command { Validate, Convert, Render, Export };
+
+struct BatchOptions {
+    Command command;
+    QString outputDir;       // Пусто - рядом с исходным файлом
+    bool targetGiven;
+    DocumentFormat target;   // Формат результата convert
+    VectorFormat vectorTarget;  // Формат результата export
+    int maxSize;             // Наибольшая сторона картинки render в пикселях
+};
+
+// Один файл командной строки и результат его обработки
+struct BatchJob {
+    QString file;
+    bool ok;
+    QStringList messages;
+};
+
+QString suffixFor(DocumentFormat format) {
+    switch (format) {
+    case DocumentFormat::Binary:
+        return "dgm";
+    case DocumentFormat::Paged:
+        return "dgp";
+    case DocumentFormat::Chunked:
+        return "dgc";
+    default:
+        return "txt";
+    }
+}
+
+QString outputPath(const QString &input, const QString &suffix, const BatchOptions &options) {
+    const QFileInfo info(input);
+    const QDir dir(options.outputDir.isEmpty() ? info.absolutePath() : options.outputDir);
+    return dir.filePath(info.completeBaseName() + "." + suffix);
+}
+
+QString describe(const Diagram &diagram) {
+    return QString("фигур: %1, связей: %2").arg(diagram.figureCount()).arg(diagram.connectionCount());
+}
+
+void validate(BatchJob &job, const Diagram &diagram, const LoadReport &report) {
+    if (report.malformedLines) {
+        job.messages << QString("строк, которые не удалось разобрать: %1 (первая - строка %2)")
+                            .arg(report.malformedLines).arg(report.firstMalformedLine);
+    }
+    if (report.danglingConnections) {
+        job.messages << QString("связей, чей конец не совпадает с центром фигуры: %1 (первая - строка %2)")
+                            .arg(report.danglingConnections).arg(report.firstDanglingLine);
+    }
+    if (report.rejectedConnections) {
+        job.messages << QString("повторных связей и связей фигуры с собой: %1").arg(report.rejectedConnections);
+    }
+    if (report.missingLines) {
+        job.messages << QString("строк меньше, чем объявлено в заголовке, на %1").arg(report.missingLines);
+    }
+    job.ok = report.isClean();
+    job.messages.prepend(QString(job.ok ? "без замечаний, %1" : "есть замечания, %1").arg(describe(diagram)));
+}
+
+void convert(BatchJob &job, const Diagram &diagram, const BatchOptions &options) {
+    const DocumentFormat source = formatForFile(job.file);
+    const DocumentFormat target = options.targetGiven
+        ? options.target
+        : (source == DocumentFormat::Binary ? DocumentFormat::Text : DocumentFormat::Binary);
+    const QString output = outputPath(job.file, suffixFor(target), options);
+    if (QFileInfo(output).absoluteFilePath() == QFileInfo(job.file).absoluteFilePath()) {
+        job.messages << "Ошибка: результат совпадает с исходным файлом";
+        return;
+    }
+    QString error;
+    job.ok = saveDocument(output, diagram, &error);
+    job.messages << (job.ok ? QString("-> %1, %2").arg(output, describe(diagram)) : error);
+}
+
+void render(BatchJob &job, const Diagram &diagram, const BatchOptions &options) {
+    QRect bounds = diagram.bounds();
+    bounds = bounds.isEmpty() ? QRect(0, 0, kEmptyRenderSize, kEmptyRenderSize)
+                              : bounds.adjusted(-kRenderMargin, -kRenderMargin, kRenderMargin, kRenderMargin);
+    // Крупные документы уменьшаются до maxSize по большей стороне; мелкие не увеличиваются
+    const qreal scale = qMin<qreal>(1.0, qreal(options.maxSize) / qMax(bounds.width(), bounds.height()));
+    const QSize size(qMax(1, qCeil(bounds.width() * scale)), qMax(1, qCeil(bounds.height() * scale)));
+
+    // Тот же путь, что и в MainWindow::paintEvent: тайлы в координатах сцены,
+    // косметическое перо и уровень детализации по масштабу
+    Viewport viewport;
+    viewport.fit(bounds, size);
+    const QImage image = TileRenderer::renderImage(diagram, viewport, size, Qt::white);
+    if (image.isNull()) {
+        job.messages << "Ошибка: не хватает памяти для картинки";
+        return;
+    }
+
+    const QString output = outputPath(job.file, "png", options);
+    job.ok = image.save(output, "PNG");
+    job.messages << (job.ok ? QString("-> %1, %2x%3").arg(output).arg(size.width()).arg(size.height())
+                            : QString("Ошибка: не удалось записать %1").arg(output));
+}
+
+void exportFile(BatchJob &job, const Diagram &diagram, const BatchOptions &options) {
+    const QString output = outputPath(job.file, options.vectorTarget == VectorFormat::Pdf ? "pdf" : "svg", options);
+    QString error;
+    job.ok = exportVector(output, diagram, &error);
+    job.messages << (job.ok ? QString("-> %1, %2").arg(output, describe(diagram)) : error);
+}
+
+void process(BatchJob &job, const BatchOptions &options) {
+    PROFILE_SCOPE("runBatch::file");
+    job.ok = false;
+    Diagram diagram;
+    LoadReport report;
+    QString error;
+    if (!loadDocument(job.file, diagram, &error, ProgressCallback(), &report)) {
+        job.messages << error;
+        return;
+    }
+    switch (options.command) {
+    case Command::Validate:
+        validate(job, diagram, report);
+        break;
+    case Command::Convert:
+        convert(job, diagram, options);
+        break;
+    case Command::Render:
+        render(job, diagram, options);
+        break;
+    case Command::Export:
+        exportFile(job, diagram, options);
+        break;
+    }
+}
+
+} // namespace
+
+bool isBatchCommand(int argc, char *argv[]) {
+    if (argc < 2) {
+        return false;
+    }
+    for (const char *command : kCommands) {
+        if (strcmp(argv[1], command) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int runBatch(int argc, char *argv[]) {
+    // Окно не нужно, но QPainter и QImage требуют QGuiApplication;
+    // платформа offscreen позволяет работать без экрана
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Пакетная обработка документов без окна");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "validate, convert, render или export");
+    parser.addPositionalArgument("files", "Файлы документов (*.txt, *.dgm, *.dgp, *.dgc)", "FILE...");
+    const QCommandLineOption outputDirOption(QStringList() << "o" << "output-dir",
+                                             "Каталог для результатов (по умолчанию рядом с исходными)", "dir");
+    const QCommandLineOption toOption("to", "Формат результата convert: txt, dgm, dgp или dgc "
+                                            "(по умолчанию противоположный исходному); "
+                                            "export: svg или pdf (по умолчанию svg)", "format");
+    const QCommandLineOption sizeOption("size", "Наибольшая сторона картинки render в пикселях", "pixels",
+                                        QString::number(kDefaultRenderSize));
+    const QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                        "Число потоков (по умолчанию по числу ядер)", "count");
+    parser.addOption(outputDirOption);
+    parser.addOption(toOption);
+    parser.addOption(sizeOption);
+    parser.addOption(jobsOption);
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    const QString command = arguments.value(0);
+    const QStringList files = arguments.mid(1);
+    if (files.isEmpty()) {
+        err << "Ошибка: не заданы файлы\n" << parser.helpText();
+        return kExitUsage;
+    }
+
+    BatchOptions options = { Command::Validate, parser.value(outputDirOption), parser.isSet(toOption),
+                             DocumentFormat::Text, VectorFormat::Svg, kDefaultRenderSize };
+    if (command == "convert") {
+        options.command = Command::Convert;
+    } else if (command == "render") {
+        options.command = Command::Render;
+    } else if (command == "export") {
+        options.command = Command::Export;
+    }
+    if (options.targetGiven && options.command == Command::Export) {
+        const QString to = parser.value(toOption).toLower();
+        if (to != "svg" && to != "pdf") {
+            err << "Ошибка: неизвестный формат " << to << "\n";
+            return kExitUsage;
+        }
+        options.vectorTarget = vectorFormatForFile("." + to);
+    } else if (options.targetGiven) {
+        const QString to = parser.value(toOption).toLower();
+        if (to != "txt" && to != "dgm" && to != "dgp" && to != "dgc") {
+            err << "Ошибка: неизвестный формат " << to << "\n";
+            return kExitUsage;
+        }
+        options.target = formatForFile("." + to);
+    }
+    bool ok = false;
+    options.maxSize = parser.value(sizeOption).toInt(&ok);
+    if (!ok || options.maxSize <= 0) {
+        err << "Ошибка: неверный размер картинки\n";
+        return kExitUsage;
+    }
+    if (parser.isSet(jobsOption)) {
+        const int jobs = parser.value(jobsOption).toInt(&ok);
+        if (!ok || jobs <= 0) {
+            err << "Ошибка: неверное число потоков\n";
+            return kExitUsage;
+        }
+        QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+    if (!options.outputDir.isEmpty() && !QDir().mkpath(options.outputDir)) {
+        err << "Ошибка: не удалось создать каталог " << options.outputDir << "\n";
+        return kExitUsage;
+    }
+
+    // Каждый файл - отдельная задача пула; разбор текстового файла внутри
+    // задачи тоже параллельный, поэтому ядра заняты и при одном большом файле
+    QVector<BatchJob> jobs;
+    jobs.reserve(files.size());
+    for (const QString &file : files) {
+        jobs.append({ file, false, QStringList() });
+    }
+    QtConcurrent::blockingMap(jobs, [&options](BatchJob &job) { process(job, options); });
+
+    // Отчеты всех файлов идут в stdout, чтобы их можно было разбирать в конвейере
+    int failed = 0;
+    for (const BatchJob &job : jobs) {
+        for (const QString &message : job.messages) {
+            out << job.file << ": " << message << "\n";
+        }
+        failed += job.ok ? 0 : 1;
+    }
+    out.flush();
+    if (failed) {
+        err << "Не обработано файлов: " << failed << " из " << jobs.size() << "\n";
+    }
+    return failed ? kExitFailed : kExitOk;
+}
@@ -0,0 +1,20 @@
+// batchmode.h
+
+#ifndef BATCHMODE_H
+#define BATCHMODE_H
+
+// Пакетная обработка документов из командной строки, без окна:
+//   validate FILE...                       проверка содержимого
+//   convert [--to txt|dgm|dgp] FILE...     преобразование между форматами
+//   render [--size N] FILE...              отрисовка в PNG
+//   export [--to svg|pdf] FILE...          векторный экспорт, по умолчанию в SVG
+// Общие параметры: --output-dir DIR, --jobs N.
+// Файлы обрабатываются параллельно на всех ядрах; отчеты выводятся
+// в порядке файлов в командной строке.
+
+// Относится ли командная строка к пакетному режиму
+bool isBatchCommand(int argc, char *argv[]);
+// Выполнение пакетной команды; возвращает код завершения процесса
+int runBatch(int argc, char *argv[]);
+
+#endif // BATCHMODE_H
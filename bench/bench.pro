@@ -0,0 +1,58 @@
+# Замеры производительности редактора (QTest, QBENCHMARK).
+# Собирается отдельно от приложения: qmake bench/bench.pro && make
+# Отчет в машиночитаемом виде: ./diagram_bench -o results.xml,xml (или csv, tap, junitxml)
+
+QT       += core gui testlib concurrent
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = diagram_bench
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../changetracker.cpp \
+    ../chunkeddocument.cpp \
+    ../connectiongraph.cpp \
+    ../diagram.cpp \
+    ../documentio.cpp \
+    ../documenttask.cpp \
+    ../figure.cpp \
+    ../figurestore.cpp \
+    ../hittest.cpp \
+    ../pageddocument.cpp \
+    ../profiler.cpp \
+    ../scenerenderer.cpp \
+    ../segmentindex.cpp \
+    ../spatialindex.cpp \
+    ../symbollibrary.cpp \
+    ../tilerenderer.cpp \
+    ../vectorexport.cpp \
+    ../viewport.cpp \
+    diagrambench.cpp \
+    documentgenerator.cpp
+
+HEADERS += \
+    ../changetracker.h \
+    ../chunkeddocument.h \
+    ../connectiongraph.h \
+    ../diagram.h \
+    ../diagramlistener.h \
+    ../documentio.h \
+    ../documenttask.h \
+    ../figure.h \
+    ../figurestore.h \
+    ../hittest.h \
+    ../pageddocument.h \
+    ../profiler.h \
+    ../scenerenderer.h \
+    ../segmentindex.h \
+    ../spatialindex.h \
+    ../symbollibrary.h \
+    ../tilerenderer.h \
+    ../vectorexport.h \
+    ../viewport.h \
+    documentgenerator.h
@@ -0,0 +1,362 @@
+// Замеры горячих путей редактора на синтетических документах от 1k до 1M фигур.
+//
+// Запуск без окна и с машиночитаемым отчетом, например:
+//   QT_QPA_PLATFORM=offscreen ./diagram_bench -o results.xml,xml
+//   QT_QPA_PLATFORM=offscreen ./diagram_bench -o results.csv,csv
+// Переменная DIAGRAM_BENCH_MAX_FIGURES ограничивает размер документов
+// (по умолчанию 1000000), чтобы быстрые прогоны не строили самые большие.
+
+#include <QtTest>
+#include <QImage>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QMap>
+#include <QtMath>
+
+#include "chunkeddocument.h"
+#include "diagram.h"
+#include "documentgenerator.h"
+#include "documentio.h"
+#include "documenttask.h"
+#include "scenerenderer.h"
+#include "tilerenderer.h"
+#include "vectorexport.h"
+#include "viewport.h"
+
+namespace {
+// Размер "окна", в которое рисуется сцена
+const QSize kViewSize(1600, 1200);
+// Сколько точек проверяется за одну итерацию поиска фигуры
+const int kHitTestPoints = 10000;
+// Сколько фигур удаляется за один замер
+const int kDeletedFigures = 1000;
+}
+
+class DiagramBench : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void paintVisible_data() { addSizes(); }
+    void paintVisible();
+    void paintWholeDocument_data() { addSizes(); }
+    void paintWholeDocument();
+    void paintWholeDocumentTiled_data() { addSizes(); }
+    void paintWholeDocumentTiled();
+    void hitTest_data() { addSizes(); }
+    void hitTest();
+    void pickConnection_data() { addSizes(); }
+    void pickConnection();
+    void rebuildGraph_data() { addSizes(); }
+    void rebuildGraph();
+    void moveConnectedFigure_data() { addSizes(); }
+    void moveConnectedFigure();
+    void deleteFigures_data() { addSizes(); }
+    void deleteFigures();
+    void deleteRegion_data() { addSizes(); }
+    void deleteRegion();
+    void saveText_data() { addSizes(); }
+    void saveText();
+    void loadText_data() { addSizes(); }
+    void loadText();
+    void saveBinary_data() { addSizes(); }
+    void saveBinary();
+    void loadBinary_data() { addSizes(); }
+    void loadBinary();
+    void saveChunkedAfterMove_data() { addSizes(); }
+    void saveChunkedAfterMove();
+    void exportSvg_data() { addSizes(); }
+    void exportSvg();
+    void exportPdf_data() { addSizes(); }
+    void exportPdf();
+
+private:
+    void addSizes();
+    // Документ каждого размера строится один раз на весь прогон
+    const Diagram &document(int figureCount);
+    void paint(const Diagram &diagram, const Viewport &viewport);
+    // Id фигуры с наибольшим числом связей (худший случай перетаскивания)
+    static int busiestFigure(const Diagram &diagram);
+
+    int maxFigures;
+    QMap<int, Diagram> documents;
+    QTemporaryDir tempDir;
+};
+
+void DiagramBench::initTestCase() {
+    bool ok = false;
+    maxFigures = qEnvironmentVariableIntValue("DIAGRAM_BENCH_MAX_FIGURES", &ok);
+    if (!ok || maxFigures <= 0) {
+        maxFigures = 1000000;
+    }
+    QVERIFY(tempDir.isValid());
+}
+
+void DiagramBench::addSizes() {
+    QTest::addColumn<int>("figures");
+    const int sizes[] = { 1000, 10000, 100000, 1000000 };
+    const char *const names[] = { "1k", "10k", "100k", "1M" };
+    for (int i = 0; i < 4; ++i) {
+        if (sizes[i] <= maxFigures) {
+            QTest::newRow(names[i]) << sizes[i];
+        }
+    }
+}
+
+const Diagram &DiagramBench::document(int figureCount) {
+    auto it = documents.find(figureCount);
+    if (it == documents.end()) {
+        // Связей столько же, сколько фигур
+        it = documents.insert(figureCount, generateDiagram(figureCount, figureCount));
+    }
+    return it.value();
+}
+
+void DiagramBench::paint(const Diagram &diagram, const Viewport &viewport) {
+    // То же, что делает MainWindow::paintEvent при полной перерисовке окна
+    QImage image(kViewSize, QImage::Format_ARGB32_Premultiplied);
+    QBENCHMARK {
+        image.fill(Qt::white);
+        QPainter painter(&image);
+        painter.setTransform(viewport.transform());
+        QPen pen = painter.pen();
+        pen.setCosmetic(true);
+        painter.setPen(pen);
+
+        SceneRenderer renderer(diagram);
+        renderer.setScale(viewport.scale());
+        renderer.render(painter, viewport.mapToScene(QRect(QPoint(0, 0), kViewSize)));
+    }
+}
+
+int DiagramBench::busiestFigure(const Diagram &diagram) {
+    int best = diagram.figures().first().id;
+    for (const Figure &figure : diagram.figures()) {
+        if (diagram.graph().degree(figure.id) > diagram.graph().degree(best)) {
+            best = figure.id;
+        }
+    }
+    return best;
+}
+
+void DiagramBench::paintVisible() {
+    // Обычный масштаб: на экране лишь малая часть большого документа
+    QFETCH(int, figures);
+    paint(document(figures), Viewport());
+}
+
+void DiagramBench::paintWholeDocument() {
+    // Документ целиком вписан в окно: работает упрощенная отрисовка
+    QFETCH(int, figures);
+    const QRect bounds = generatedBounds(figures);
+    Viewport viewport;
+    viewport.zoomAt(QPoint(0, 0), qMin(qreal(kViewSize.width()) / bounds.width(),
+                                       qreal(kViewSize.height()) / bounds.height()));
+    paint(document(figures), viewport);
+}
+
+void DiagramBench::paintWholeDocumentTiled() {
+    // Тот же вид, но тайлами в пуле потоков и без кэша (как после смены масштаба)
+    QFETCH(int, figures);
+    const QRect bounds = generatedBounds(figures);
+    Viewport viewport;
+    viewport.zoomAt(QPoint(0, 0), qMin(qreal(kViewSize.width()) / bounds.width(),
+                                       qreal(kViewSize.height()) / bounds.height()));
+    const Diagram &diagram = document(figures);
+    QBENCHMARK {
+        TileRenderer::renderImage(diagram, viewport, kViewSize, Qt::white);
+    }
+}
+
+void DiagramBench::hitTest() {
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QRect bounds = generatedBounds(figures);
+
+    QVector<QPoint> points;
+    QRandomGenerator random(7);
+    for (int i = 0; i < kHitTestPoints; ++i) {
+        points.append(QPoint(random.bounded(bounds.width()), random.bounded(bounds.height())));
+    }
+
+    int found = 0;
+    QBENCHMARK {
+        for (const QPoint &point : points) {
+            found += diagram.figureAt(point) != -1;
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+void DiagramBench::pickConnection() {
+    // Поиск связи под курсором с допуском в несколько единиц сцены
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QRect bounds = generatedBounds(figures);
+
+    QVector<QPoint> points;
+    QRandomGenerator random(11);
+    for (int i = 0; i < kHitTestPoints; ++i) {
+        points.append(QPoint(random.bounded(bounds.width()), random.bounded(bounds.height())));
+    }
+
+    int found = 0;
+    QBENCHMARK {
+        for (const QPoint &point : points) {
+            found += diagram.connectionAt(point, 4).from != -1;
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+void DiagramBench::rebuildGraph() {
+    // Полное построение сетки и графа связей, как при загрузке документа
+    QFETCH(int, figures);
+    const Diagram &source = document(figures);
+    const QVector<Figure> figureList = source.figures();
+    const QVector<Connection> connections = source.graph().connections();
+
+    QBENCHMARK {
+        Diagram diagram;
+        diagram.assign(figureList, connections);
+    }
+}
+
+void DiagramBench::moveConnectedFigure() {
+    // Один шаг перетаскивания: область старого и нового места и сдвиг фигуры
+    QFETCH(int, figures);
+    Diagram diagram = document(figures);
+    const int id = busiestFigure(diagram);
+    SceneRenderer renderer(diagram);
+
+    QRect damage;
+    int step = 0;
+    QBENCHMARK {
+        const QPoint delta = (++step & 1) ? QPoint(3, 2) : QPoint(-3, -2);
+        damage = renderer.figureDamage(id);
+        diagram.moveFigure(id, delta);
+        damage |= renderer.figureDamage(id);
+    }
+    QVERIFY(!damage.isEmpty());
+}
+
+void DiagramBench::deleteFigures() {
+    QFETCH(int, figures);
+    const Diagram &source = document(figures);
+
+    QVector<int> victims;
+    QRandomGenerator random(11);
+    for (int i = 0; i < qMin(kDeletedFigures, figures / 2); ++i) {
+        victims.append(source.figures().at(random.bounded(figures)).id);
+    }
+
+    // Замер идет на собственной копии документа; первое удаление отделяет
+    // ее от общих данных, чтобы копирование не попало в результат
+    Diagram diagram = source;
+    diagram.removeFigure(victims.takeLast());
+    QBENCHMARK_ONCE {
+        for (int id : victims) {
+            diagram.removeFigure(id);
+        }
+    }
+}
+
+void DiagramBench::deleteRegion() {
+    // Удаление рамкой: до 10k фигур из угла документа одним вызовом
+    QFETCH(int, figures);
+    const Diagram &source = document(figures);
+    const int side = qMin(100, qCeil(qSqrt(qreal(figures)))) * kGeneratedCellSize;
+    const QVector<int> victims = source.figuresIn(QRect(0, 0, side, side));
+
+    Diagram diagram = source;
+    diagram.removeFigure(source.figures().last().id);
+    QBENCHMARK_ONCE {
+        diagram.removeFigures(victims);
+    }
+}
+
+void DiagramBench::saveText() {
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QString fileName = tempDir.filePath(QString("save-%1.txt").arg(figures));
+    QBENCHMARK {
+        QVERIFY(::saveText(fileName, diagram));
+    }
+}
+
+void DiagramBench::loadText() {
+    QFETCH(int, figures);
+    const QString fileName = tempDir.filePath(QString("load-%1.txt").arg(figures));
+    QVERIFY(::saveText(fileName, document(figures)));
+
+    Diagram diagram;
+    QBENCHMARK {
+        QVERIFY(::loadText(fileName, diagram));
+    }
+    QCOMPARE(diagram.figureCount(), figures);
+}
+
+void DiagramBench::saveBinary() {
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QString fileName = tempDir.filePath(QString("save-%1.dgm").arg(figures));
+    QBENCHMARK {
+        QVERIFY(::saveBinary(fileName, diagram));
+    }
+}
+
+void DiagramBench::loadBinary() {
+    QFETCH(int, figures);
+    const QString fileName = tempDir.filePath(QString("load-%1.dgm").arg(figures));
+    QVERIFY(::saveBinary(fileName, document(figures)));
+
+    Diagram diagram;
+    QBENCHMARK {
+        QVERIFY(::loadBinary(fileName, diagram));
+    }
+    QCOMPARE(diagram.figureCount(), figures);
+}
+
+void DiagramBench::saveChunkedAfterMove() {
+    // Повторное сохранение после сдвига одной фигуры тем же путем, что и в редакторе:
+    // фоновая задача по снимку документа переписывает один кусок и оглавление
+    QFETCH(int, figures);
+    Diagram diagram = document(figures);
+    const QString fileName = tempDir.filePath(QString("save-%1.dgc").arg(figures));
+    ChunkedDocument chunked;
+    auto saveInBackground = [&]() {
+        QScopedPointer<DocumentTask> task(DocumentTask::save(fileName, diagram, nullptr, &chunked));
+        QSignalSpy finished(task.data(), &DocumentTask::finished);
+        return finished.wait(60000) && task->succeeded();
+    };
+    QVERIFY(saveInBackground());
+    const int id = diagram.figures().at(diagram.figureCount() / 2).id;
+    QBENCHMARK {
+        diagram.moveFigure(id, QPoint(1, 0));
+        QVERIFY(saveInBackground());
+    }
+    QCOMPARE(chunked.lastWrittenChunks(), 1);
+}
+
+void DiagramBench::exportSvg() {
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QString fileName = tempDir.filePath(QString("export-%1.svg").arg(figures));
+    QBENCHMARK {
+        QVERIFY(::exportSvg(fileName, diagram));
+    }
+}
+
+void DiagramBench::exportPdf() {
+    QFETCH(int, figures);
+    const Diagram &diagram = document(figures);
+    const QString fileName = tempDir.filePath(QString("export-%1.pdf").arg(figures));
+    QBENCHMARK {
+        QVERIFY(::exportPdf(fileName, diagram));
+    }
+}
+
+QTEST_MAIN(DiagramBench)
+
+#include "diagrambench.moc"
@@ -0,0 +1,52 @@
+#include "documentgenerator.h"
+
+#include <QRandomGenerator>
+#include <QtMath>
+
+namespace {
+// Связь ведет к одной из ближайших по id фигур
+const int kConnectionReach = 64;
+
+int columnsFor(int figureCount) {
+    return qMax(1, int(qCeil(qSqrt(qreal(figureCount)))));
+}
+}
+
+Diagram generateDiagram(int figureCount, int connectionCount, quint32 seed) {
+    QRandomGenerator random(seed);
+    const int columns = columnsFor(figureCount);
+
+    QVector<Figure> figures;
+    figures.reserve(figureCount);
+    for (int i = 0; i < figureCount; ++i) {
+        const Shape shape = static_cast<Shape>(Rectangle + i % 3);
+        const int width = 12 + random.bounded(kGeneratedCellSize - 16);
+        const int height = 12 + random.bounded(kGeneratedCellSize - 16);
+        figures.append({ i + 1, shape, QRect((i % columns) * kGeneratedCellSize + 2,
+                                             (i / columns) * kGeneratedCellSize + 2, width, height) });
+    }
+
+    QVector<Connection> connections;
+    connections.reserve(connectionCount);
+    if (figureCount > 1) {
+        for (int i = 0; i < connectionCount; ++i) {
+            const int from = 1 + random.bounded(figureCount);
+            const int offset = 1 + random.bounded(kConnectionReach);
+            const int to = from + offset <= figureCount ? from + offset : from - offset;
+            if (to >= 1) {
+                connections.append({ from, to });
+            }
+        }
+    }
+
+    // Повторяющиеся связи граф отбросит сам
+    Diagram diagram;
+    diagram.assign(figures, connections);
+    return diagram;
+}
+
+QRect generatedBounds(int figureCount) {
+    const int columns = columnsFor(figureCount);
+    const int rows = qMax(1, (figureCount + columns - 1) / columns);
+    return QRect(0, 0, columns * kGeneratedCellSize, rows * kGeneratedCellSize);
+}
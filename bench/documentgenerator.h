@@ -0,0 +1,21 @@
+// documentgenerator.h
+
+#ifndef DOCUMENTGENERATOR_H
+#define DOCUMENTGENERATOR_H
+
+#include <QRect>
+
+#include "diagram.h"
+
+// Синтетические документы для замеров.
+// Фигуры лежат на квадратной сетке с шагом kGeneratedCellSize, связи соединяют
+// фигуры, близкие по id, то есть в основном соседние на холсте.
+// Одинаковые параметры всегда дают один и тот же документ.
+const int kGeneratedCellSize = 40;
+
+Diagram generateDiagram(int figureCount, int connectionCount, quint32 seed = 1);
+
+// Прямоугольник сцены, занятый документом из figureCount фигур
+QRect generatedBounds(int figureCount);
+
+#endif // DOCUMENTGENERATOR_H
@@ -0,0 +1,41 @@
+#include "changetracker.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+std::atomic<quint64> lastLineage(0);
+}
+
+ChangeTracker::ChangeTracker() : symbolStamp(0), lineageNumber(++lastLineage) {}
+
+void ChangeTracker::restart() {
+    stamps.clear();
+    symbolStamp = 0;
+    lineageNumber = ++lastLineage;
+}
+
+void ChangeTracker::markFigures(const QVector<int> &ids, quint64 revision) {
+    // Соседние id обычно в одном куске: хэш трогается только при смене куска
+    int last = 0;
+    bool first = true;
+    for (int id : ids) {
+        const int chunk = chunkOf(id);
+        if (first || chunk != last) {
+            stamps[chunk] = revision;
+            last = chunk;
+            first = false;
+        }
+    }
+}
+
+QVector<int> ChangeTracker::chunksChangedSince(quint64 revision) const {
+    QVector<int> result;
+    for (auto it = stamps.constBegin(); it != stamps.constEnd(); ++it) {
+        if (it.value() > revision) {
+            result.append(it.key());
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
@@ -0,0 +1,42 @@
+// changetracker.h
+
+#ifndef CHANGETRACKER_H
+#define CHANGETRACKER_H
+
+#include <QHash>
+#include <QVector>
+
+// Учет правок по кускам документа для инкрементального сохранения.
+// Фигуры делятся на куски по id (kChunkIds подряд идущих id), связь относится
+// к куску своего меньшего конца. Для каждого куска помнится версия документа
+// при последней правке. Замена содержимого целиком начинает новую линию:
+// версии разных линий не сравниваются, и все куски считаются измененными.
+class ChangeTracker {
+public:
+    static const int kChunkIds = 4096;
+
+    // Номер куска фигуры по ее id (id бывают и отрицательными в чужих файлах)
+    static int chunkOf(int id) { return id >= 0 ? id / kChunkIds : -((-(id + 1)) / kChunkIds) - 1; }
+
+    ChangeTracker();
+
+    // Содержимое заменено целиком
+    void restart();
+    void markFigure(int id, quint64 revision) { stamps[chunkOf(id)] = revision; }
+    void markFigures(const QVector<int> &ids, quint64 revision);
+    void markConnection(int a, int b, quint64 revision) { markFigure(qMin(a, b), revision); }
+    void markSymbols(quint64 revision) { symbolStamp = revision; }
+
+    // Номер линии версий: уникален среди всех документов
+    quint64 lineage() const { return lineageNumber; }
+    // Куски по возрастанию номера, измененные после версии revision этой же линии
+    QVector<int> chunksChangedSince(quint64 revision) const;
+    bool symbolsChangedSince(quint64 revision) const { return symbolStamp > revision; }
+
+private:
+    QHash<int, quint64> stamps;    // Версия последней правки куска
+    quint64 symbolStamp;
+    quint64 lineageNumber;
+};
+
+#endif // CHANGETRACKER_H
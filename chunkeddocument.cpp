@@ -0,0 +1,512 @@
+#include "chunkeddocument.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
+
+#include "profiler.h"
+
+namespace {
+
+const quint32 kChunkedMagic = 0x4447434b;   // "DGCK"
+const quint16 kChunkedVersion = 1;
+
+// Заголовок оглавления: магическое число, версия, флаги, размер куска в id
+const qint64 kManifestHeaderSize = 4 + 2 + 2 + 4;
+// Запись оглавления: номер куска, число фигур и связей, хэш
+const int kHashSize = 32;
+const qint64 kEntrySize = 3 * 4 + kHashSize;
+// Размеры записей внутри куска: фигура, связь, номер символа экземпляра
+const qint64 kFigureRecordSize = 6 * 4;
+const qint64 kConnectionRecordSize = 2 * 4;
+const qint64 kInstanceRecordSize = 2 * 4;
+
+// Сколько кусков кодируется одной параллельной пачкой: в памяти одновременно
+// только закодированные куски пачки, а не весь документ
+const int kParallelChunks = 64;
+
+const char *const kCancelledMessage = "Операция отменена";
+
+void setError(QString *errorMessage, const QString &message) {
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+}
+
+bool isFigureShape(qint32 shape) {
+    return shape == Rectangle || shape == Triangle || shape == Ellipse || shape == Instance;
+}
+
+QByteArray hashOf(const QByteArray &bytes) {
+    return QCryptographicHash::hash(bytes, QCryptographicHash::Sha256);
+}
+
+qint64 chunkStart(int chunk) {
+    return qint64(chunk) * ChangeTracker::kChunkIds;
+}
+
+} // namespace
+
+ChunkedDocument::ChunkedDocument() : lineage(0), revision(0), writtenChunks(0) {}
+
+QString ChunkedDocument::chunkDirectory(const QString &fileName) {
+    return fileName + ".chunks";
+}
+
+QString ChunkedDocument::chunkName(const QByteArray &hash) {
+    return QString::fromLatin1(hash.toHex()) + ".chunk";
+}
+
+QByteArray ChunkedDocument::encodeChunk(const Diagram &diagram, int chunk, Entry &entry) {
+    // Фигуры куска - непрерывный участок списка, отсортированного по id
+    const QVector<Figure> &figures = diagram.figures();
+    const qint64 first = chunkStart(chunk);
+    const qint64 last = first + ChangeTracker::kChunkIds;
+    auto begin = std::lower_bound(figures.constBegin(), figures.constEnd(), first,
+                                  [](const Figure &figure, qint64 value) { return figure.id < value; });
+    auto end = std::lower_bound(begin, figures.constEnd(), last,
+                                [](const Figure &figure, qint64 value) { return figure.id < value; });
+
+    // Связи сортируются: одинаковое содержимое должно давать одинаковые байты и хэш
+    QVector<Connection> connections;
+    int instances = 0;
+    for (auto it = begin; it != end; ++it) {
+        for (int other : diagram.graph().neighbors(it->id)) {
+            if (it->id < other) {
+                connections.append({ it->id, other });
+            }
+        }
+        instances += it->shape == Instance;
+    }
+    std::sort(connections.begin(), connections.end(), [](const Connection &a, const Connection &b) {
+        return a.from != b.from ? a.from < b.from : a.to < b.to;
+    });
+
+    const int figureCount = int(end - begin);
+    QByteArray bytes;
+    bytes.reserve(int(12 + figureCount * kFigureRecordSize + connections.size() * kConnectionRecordSize
+                      + instances * kInstanceRecordSize));
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(figureCount);
+    for (auto it = begin; it != end; ++it) {
+        out << *it;
+    }
+    out << quint32(connections.size());
+    for (const Connection &connection : connections) {
+        out << connection;
+    }
+    out << quint32(instances);
+    for (auto it = begin; it != end; ++it) {
+        if (it->shape == Instance) {
+            out << qint32(it->id) << qint32(it->symbol);
+        }
+    }
+    entry.chunk = chunk;
+    entry.figures = quint32(figureCount);
+    entry.connections = quint32(connections.size());
+    entry.hash = hashOf(bytes);
+    return bytes;
+}
+
+bool ChunkedDocument::decodeChunk(const QByteArray &bytes, const Entry &entry, QVector<Figure> &figures,
+                                  QVector<Connection> &connections) {
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+    const qint64 first = chunkStart(entry.chunk);
+    const qint64 last = first + ChangeTracker::kChunkIds;
+    // Фигуры и связи чужого диапазона испортили бы следующее инкрементальное сохранение
+    auto inRange = [&](qint64 id) { return id >= first && id < last; };
+
+    quint32 figureCount = 0;
+    in >> figureCount;
+    if (in.status() != QDataStream::Ok || figureCount != entry.figures
+        || qint64(figureCount) * kFigureRecordSize > bytes.size()) {
+        return false;
+    }
+    figures.reserve(int(figureCount));
+    for (quint32 i = 0; i < figureCount; ++i) {
+        Figure figure;
+        in >> figure;
+        if (!isFigureShape(figure.shape) || !inRange(figure.id)
+            || (!figures.isEmpty() && figures.last().id >= figure.id)) {
+            return false;
+        }
+        figures.append(figure);
+    }
+    quint32 connectionCount = 0;
+    in >> connectionCount;
+    if (in.status() != QDataStream::Ok || connectionCount != entry.connections
+        || qint64(connectionCount) * kConnectionRecordSize > bytes.size()) {
+        return false;
+    }
+    connections.reserve(int(connectionCount));
+    for (quint32 i = 0; i < connectionCount; ++i) {
+        Connection connection;
+        in >> connection;
+        if (connection.from >= connection.to || !inRange(connection.from)) {
+            return false;
+        }
+        connections.append(connection);
+    }
+    quint32 instanceCount = 0;
+    in >> instanceCount;
+    if (in.status() != QDataStream::Ok || qint64(instanceCount) * kInstanceRecordSize > bytes.size()) {
+        return false;
+    }
+    // Пары идут по возрастанию id, как и фигуры
+    int next = 0;
+    for (quint32 i = 0; i < instanceCount; ++i) {
+        qint32 id = 0;
+        qint32 symbol = -1;
+        in >> id >> symbol;
+        while (next < figures.size() && figures[next].id < id) {
+            ++next;
+        }
+        if (next < figures.size() && figures[next].id == id) {
+            figures[next].symbol = symbol;
+        }
+    }
+    return in.status() == QDataStream::Ok && in.atEnd();
+}
+
+QByteArray ChunkedDocument::encodeManifest(const QVector<Entry> &entries, const QByteArray &symbolHash) {
+    QByteArray bytes;
+    bytes.reserve(int(kManifestHeaderSize + 8 + kHashSize + entries.size() * kEntrySize));
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << kChunkedMagic << kChunkedVersion << quint16(0) << qint32(ChangeTracker::kChunkIds);
+    out << symbolHash;
+    out << quint32(entries.size());
+    for (const Entry &entry : entries) {
+        out << entry.chunk << entry.figures << entry.connections;
+        out.writeRawData(entry.hash.constData(), kHashSize);
+    }
+    return bytes;
+}
+
+bool ChunkedDocument::decodeManifest(const QByteArray &bytes, QVector<Entry> &entries, QByteArray &symbolHash) {
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint16 flags = 0;
+    qint32 chunkIds = 0;
+    in >> magic >> version >> flags >> chunkIds;
+    // Куски другого размера разложены по другим диапазонам id
+    if (in.status() != QDataStream::Ok || magic != kChunkedMagic || version > kChunkedVersion
+        || chunkIds != ChangeTracker::kChunkIds) {
+        return false;
+    }
+    in >> symbolHash;
+    quint32 count = 0;
+    in >> count;
+    if (in.status() != QDataStream::Ok || (!symbolHash.isEmpty() && symbolHash.size() != kHashSize)
+        || qint64(count) * kEntrySize > bytes.size()) {
+        return false;
+    }
+    entries.clear();
+    entries.reserve(int(count));
+    for (quint32 i = 0; i < count; ++i) {
+        Entry entry;
+        in >> entry.chunk >> entry.figures >> entry.connections;
+        entry.hash.resize(kHashSize);
+        if (in.readRawData(entry.hash.data(), kHashSize) != kHashSize
+            || (!entries.isEmpty() && entries.last().chunk >= entry.chunk)) {
+            return false;
+        }
+        entries.append(entry);
+    }
+    return in.status() == QDataStream::Ok && in.atEnd();
+}
+
+bool ChunkedDocument::writeChunk(const QString &directory, const QByteArray &hash, const QByteArray &bytes,
+                                 QStringList &created) {
+    // Имя задано содержимым: готовый файл с таким именем уже содержит эти байты
+    const QString name = chunkName(hash);
+    const QString path = QDir(directory).filePath(name);
+    if (QFileInfo::exists(path)) {
+        return true;
+    }
+    // Файл куска появляется под своим именем только целиком
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(bytes) != bytes.size() || !out.commit()) {
+        return false;
+    }
+    created.append(name);
+    return true;
+}
+
+bool ChunkedDocument::readChunk(const QString &directory, const QByteArray &hash, QByteArray &bytes) {
+    QFile in(QDir(directory).filePath(chunkName(hash)));
+    if (!in.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    bytes = in.readAll();
+    // Хэш в имени заодно проверяет целостность куска
+    return hashOf(bytes) == hash;
+}
+
+bool ChunkedDocument::load(const QString &fileName, Diagram &diagram, QString *errorMessage,
+                           const ProgressCallback &progress) {
+    PROFILE_SCOPE("ChunkedDocument::load");
+    QFile in(fileName);
+    if (!in.open(QIODevice::ReadOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для чтения");
+        return false;
+    }
+    const QByteArray bytes = in.readAll();
+    QVector<Entry> fileEntries;
+    QByteArray fileSymbolHash;
+    if (!decodeManifest(bytes, fileEntries, fileSymbolHash)) {
+        setError(errorMessage, "Ошибка: оглавление документа повреждено или не поддерживается");
+        return false;
+    }
+    const QString directory = chunkDirectory(fileName);
+
+    SymbolLibrary symbols;
+    if (!fileSymbolHash.isEmpty()) {
+        QByteArray symbolBytes;
+        bool ok = readChunk(directory, fileSymbolHash, symbolBytes);
+        if (ok) {
+            QDataStream stream(symbolBytes);
+            stream.setVersion(QDataStream::Qt_5_0);
+            stream >> symbols;
+            ok = stream.status() == QDataStream::Ok;
+        }
+        if (!ok) {
+            setError(errorMessage, "Ошибка: определения символов повреждены");
+            return false;
+        }
+    }
+
+    // Куски читаются и разбираются параллельно, каждый в свой результат
+    struct Part {
+        const Entry *entry;
+        QVector<Figure> figures;
+        QVector<Connection> connections;
+        bool ok;
+    };
+    QVector<Part> parts;
+    parts.reserve(fileEntries.size());
+    for (const Entry &entry : fileEntries) {
+        parts.append(Part{ &entry, {}, {}, false });
+    }
+    std::atomic<int> done(0);
+    std::atomic<bool> cancelled(false);
+    QtConcurrent::blockingMap(parts, [&](Part &part) {
+        if (cancelled) {
+            return;
+        }
+        QByteArray chunkBytes;
+        part.ok = readChunk(directory, part.entry->hash, chunkBytes)
+                  && decodeChunk(chunkBytes, *part.entry, part.figures, part.connections);
+        if (progress && !progress(int(qint64(++done) * 100 / parts.size()))) {
+            cancelled = true;
+        }
+    });
+    if (cancelled) {
+        setError(errorMessage, kCancelledMessage);
+        return false;
+    }
+
+    qint64 figureCount = 0;
+    qint64 connectionCount = 0;
+    for (const Part &part : parts) {
+        if (!part.ok) {
+            setError(errorMessage, QString("Ошибка: кусок %1 поврежден или отсутствует").arg(part.entry->chunk));
+            return false;
+        }
+        figureCount += part.figures.size();
+        connectionCount += part.connections.size();
+    }
+    // Куски идут по возрастанию диапазонов id, поэтому фигуры уже отсортированы
+    QVector<Figure> figures;
+    QVector<Connection> connections;
+    figures.reserve(int(figureCount));
+    connections.reserve(int(connectionCount));
+    for (const Part &part : parts) {
+        figures += part.figures;
+        connections += part.connections;
+    }
+    symbols.resolve(figures);
+    diagram.assign(figures, connections, symbols);
+
+    file = QFileInfo(fileName).absoluteFilePath();
+    manifest = bytes;
+    entries = fileEntries;
+    symbolHash = fileSymbolHash;
+    lineage = diagram.changes().lineage();
+    revision = diagram.revision();
+    writtenChunks = 0;
+    return true;
+}
+
+void ChunkedDocument::rebase(const Diagram &diagram) {
+    lineage = diagram.changes().lineage();
+    revision = diagram.revision();
+}
+
+bool ChunkedDocument::save(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+                           const ProgressCallback &progress) {
+    PROFILE_SCOPE("ChunkedDocument::save");
+    const QString path = QFileInfo(fileName).absoluteFilePath();
+    const QString directory = chunkDirectory(path);
+    QDir chunks(directory);
+    if (!QDir().mkpath(directory)) {
+        setError(errorMessage, "Ошибка: не удалось создать каталог кусков");
+        return false;
+    }
+
+    // Только измененные куски пишутся поверх своей же прошлой записи: тот же файл,
+    // та же линия версий, и оглавление на диске с тех пор никто не менял
+    const ChangeTracker &changes = diagram.changes();
+    bool incremental = !file.isEmpty() && file == path && lineage == changes.lineage()
+                       && revision <= diagram.revision();
+    if (incremental) {
+        QFile current(path);
+        incremental = current.open(QIODevice::ReadOnly) && current.readAll() == manifest;
+    }
+
+    QVector<int> changed;
+    if (incremental) {
+        changed = changes.chunksChangedSince(revision);
+    } else {
+        for (const Figure &figure : diagram.figures()) {
+            const int chunk = ChangeTracker::chunkOf(figure.id);
+            if (changed.isEmpty() || changed.last() != chunk) {
+                changed.append(chunk);
+            }
+        }
+    }
+
+    // Измененные куски кодируются и хэшируются параллельно пачками, а пишутся по порядку
+    struct Pending {
+        int chunk;
+        Entry entry;
+        QByteArray bytes;
+    };
+    QVector<Entry> fresh;
+    QStringList created;
+    auto discardCreated = [&]() {
+        for (const QString &name : created) {
+            chunks.remove(name);
+        }
+    };
+    for (int start = 0; start < changed.size(); start += kParallelChunks) {
+        QVector<Pending> batch;
+        for (int i = start; i < qMin(start + kParallelChunks, changed.size()); ++i) {
+            batch.append(Pending{ changed[i], Entry(), QByteArray() });
+        }
+        QtConcurrent::blockingMap(batch, [&](Pending &pending) {
+            pending.bytes = encodeChunk(diagram, pending.chunk, pending.entry);
+        });
+        for (const Pending &pending : batch) {
+            // Опустевший кусок просто исчезает из оглавления
+            if (pending.entry.figures == 0) {
+                continue;
+            }
+            if (!writeChunk(directory, pending.entry.hash, pending.bytes, created)) {
+                discardCreated();
+                setError(errorMessage, "Ошибка: не удалось записать кусок документа");
+                return false;
+            }
+            fresh.append(pending.entry);
+        }
+        if (progress && !progress(int(qint64(start + batch.size()) * 100 / changed.size()))) {
+            discardCreated();
+            setError(errorMessage, kCancelledMessage);
+            return false;
+        }
+    }
+
+    // Новое оглавление: прежние записи нетронутых кусков и свежие записи измененных
+    QVector<Entry> result;
+    if (incremental) {
+        result.reserve(entries.size() + fresh.size());
+        auto next = fresh.constBegin();
+        for (const Entry &entry : entries) {
+            while (next != fresh.constEnd() && next->chunk < entry.chunk) {
+                result.append(*next++);
+            }
+            if (!std::binary_search(changed.constBegin(), changed.constEnd(), entry.chunk)) {
+                result.append(entry);
+            }
+        }
+        while (next != fresh.constEnd()) {
+            result.append(*next++);
+        }
+    } else {
+        result = fresh;
+    }
+
+    QByteArray newSymbolHash = symbolHash;
+    if (!incremental || changes.symbolsChangedSince(revision)) {
+        newSymbolHash.clear();
+        if (!diagram.symbols().isEmpty()) {
+            QByteArray bytes;
+            QDataStream out(&bytes, QIODevice::WriteOnly);
+            out.setVersion(QDataStream::Qt_5_0);
+            out << diagram.symbols();
+            newSymbolHash = hashOf(bytes);
+            if (!writeChunk(directory, newSymbolHash, bytes, created)) {
+                discardCreated();
+                setError(errorMessage, "Ошибка: не удалось записать символы документа");
+                return false;
+            }
+        }
+    }
+
+    // Подмена оглавления - единственный момент, когда документ на диске меняется
+    const QByteArray newManifest = encodeManifest(result, newSymbolHash);
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(newManifest) != newManifest.size() || !out.commit()) {
+        discardCreated();
+        setError(errorMessage, "Ошибка записи файла");
+        return false;
+    }
+
+    // Куски, на которые оглавление больше не ссылается, удаляются. После полной
+    // записи просматривается весь каталог: там могут остаться куски прерванных сохранений.
+    QSet<QString> live;
+    live.reserve(result.size() + 1);
+    for (const Entry &entry : result) {
+        live.insert(chunkName(entry.hash));
+    }
+    if (!newSymbolHash.isEmpty()) {
+        live.insert(chunkName(newSymbolHash));
+    }
+    QStringList stale;
+    if (incremental) {
+        for (const Entry &entry : entries) {
+            stale.append(chunkName(entry.hash));
+        }
+        if (!symbolHash.isEmpty()) {
+            stale.append(chunkName(symbolHash));
+        }
+    } else {
+        stale = chunks.entryList(QStringList() << "*.chunk", QDir::Files);
+    }
+    for (const QString &name : stale) {
+        if (!live.contains(name)) {
+            chunks.remove(name);
+        }
+    }
+
+    file = path;
+    manifest = newManifest;
+    entries = result;
+    symbolHash = newSymbolHash;
+    lineage = changes.lineage();
+    revision = diagram.revision();
+    writtenChunks = changed.size();
+    return true;
+}
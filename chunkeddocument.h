@@ -0,0 +1,74 @@
+// chunkeddocument.h
+
+#ifndef CHUNKEDDOCUMENT_H
+#define CHUNKEDDOCUMENT_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "diagram.h"
+#include "documentio.h"
+
+// Документ из кусков (*.dgc) для быстрого повторного сохранения больших диаграмм.
+// Файл *.dgc - небольшое оглавление; сами куски лежат рядом в каталоге
+// "<имя>.chunks", каждый в файле с именем по хэшу содержимого (SHA-256).
+// Кусок - фигуры из одного диапазона id (см. ChangeTracker), связи, у которых
+// меньший конец в этом диапазоне, и номера символов экземпляров; определения
+// символов - отдельный кусок.
+//
+// Повторное сохранение того же документа кодирует только куски, измененные
+// после прошлой записи (по учету правок в Diagram), добавляет файлы новых
+// кусков и атомарно подменяет оглавление. Файлы кусков не перезаписываются,
+// а ненужные удаляются только после подмены оглавления, поэтому сбой посреди
+// сохранения оставляет прежний документ целым.
+class ChunkedDocument {
+public:
+    ChunkedDocument();
+
+    // Чтение документа; при ошибке diagram не меняется. После успеха объект
+    // помнит оглавление файла (см. rebase()).
+    bool load(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr,
+              const ProgressCallback &progress = ProgressCallback());
+    // Запись снимка документа. Если этот объект уже записал в тот же файл более
+    // раннюю версию того же документа, перезаписываются только измененные куски.
+    bool save(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+              const ProgressCallback &progress = ProgressCallback());
+    // Документ, только что прочитанный load(), присвоен diagram (присваивание
+    // начинает новую линию версий): следующие сохранения считают правки от него
+    void rebase(const Diagram &diagram);
+
+    // Сколько кусков закодировала последняя запись
+    int lastWrittenChunks() const { return writtenChunks; }
+
+private:
+    struct Entry {
+        qint32 chunk;
+        quint32 figures;
+        quint32 connections;
+        QByteArray hash;
+    };
+
+    QString file;               // Файл, которому соответствует оглавление; пусто - нет
+    QByteArray manifest;        // Оглавление в том виде, как оно лежит в файле
+    QVector<Entry> entries;     // По возрастанию номера куска
+    QByteArray symbolHash;      // Пусто, если символов нет
+    quint64 lineage;
+    quint64 revision;
+    int writtenChunks;
+
+    static QString chunkDirectory(const QString &fileName);
+    static QString chunkName(const QByteArray &hash);
+    static QByteArray encodeChunk(const Diagram &diagram, int chunk, Entry &entry);
+    static bool decodeChunk(const QByteArray &bytes, const Entry &entry, QVector<Figure> &figures,
+                            QVector<Connection> &connections);
+    static QByteArray encodeManifest(const QVector<Entry> &entries, const QByteArray &symbolHash);
+    static bool decodeManifest(const QByteArray &bytes, QVector<Entry> &entries, QByteArray &symbolHash);
+    // Запись куска, если файла с таким содержимым еще нет; created - имена новых файлов
+    static bool writeChunk(const QString &directory, const QByteArray &hash, const QByteArray &bytes,
+                           QStringList &created);
+    static bool readChunk(const QString &directory, const QByteArray &hash, QByteArray &bytes);
+};
+
+#endif // CHUNKEDDOCUMENT_H
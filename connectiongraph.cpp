@@ -0,0 +1,90 @@
+#include "connectiongraph.h"
+
+ConnectionGraph::ConnectionGraph() : edges(0) {}
+
+bool ConnectionGraph::addEdge(int a, int b) {
+    if (a == b) {
+        return false;
+    }
+    QSet<int> &fromA = adjacency[a];
+    if (fromA.contains(b)) {
+        return false;
+    }
+    fromA.insert(b);
+    adjacency[b].insert(a);
+    ++edges;
+    return true;
+}
+
+bool ConnectionGraph::removeEdge(int a, int b) {
+    auto itA = adjacency.find(a);
+    if (itA == adjacency.end() || !itA.value().remove(b)) {
+        return false;
+    }
+    if (itA.value().isEmpty()) {
+        adjacency.erase(itA);
+    }
+    auto itB = adjacency.find(b);
+    if (itB != adjacency.end()) {
+        itB.value().remove(a);
+        if (itB.value().isEmpty()) {
+            adjacency.erase(itB);
+        }
+    }
+    --edges;
+    return true;
+}
+
+QSet<int> ConnectionGraph::removeNode(int id) {
+    QSet<int> former = adjacency.take(id);
+    // Убираем обратные ссылки только у соседей, не трогая остальной граф
+    for (int other : former) {
+        auto it = adjacency.find(other);
+        if (it != adjacency.end()) {
+            it.value().remove(id);
+            if (it.value().isEmpty()) {
+                adjacency.erase(it);
+            }
+        }
+    }
+    edges -= former.size();
+    return former;
+}
+
+void ConnectionGraph::clear() {
+    adjacency.clear();
+    edges = 0;
+}
+
+bool ConnectionGraph::hasEdge(int a, int b) const {
+    auto it = adjacency.constFind(a);
+    return it != adjacency.constEnd() && it.value().contains(b);
+}
+
+const QSet<int> &ConnectionGraph::neighbors(int id) const {
+    static const QSet<int> empty;
+    auto it = adjacency.constFind(id);
+    return it != adjacency.constEnd() ? it.value() : empty;
+}
+
+QVector<Connection> ConnectionGraph::connections() const {
+    QVector<Connection> result;
+    result.reserve(edges);
+    forEachEdge([&result](int from, int to) {
+        result.append({ from, to });
+    });
+    return result;
+}
+
+QDataStream &operator<<(QDataStream &out, const Connection &connection) {
+    out << qint32(connection.from) << qint32(connection.to);
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Connection &connection) {
+    qint32 from = 0, to = 0;
+    in >> from >> to;
+    connection.from = from;
+    connection.to = to;
+    return in;
+}
@@ -0,0 +1,66 @@
+// connectiongraph.h
+
+#ifndef CONNECTIONGRAPH_H
+#define CONNECTIONGRAPH_H
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QDataStream>
+
+// Связь между двумя фигурами, заданная их идентификаторами
+struct Connection {
+    int from;
+    int to;
+
+    bool operator==(const Connection &other) const {
+        return from == other.from && to == other.to;
+    }
+};
+
+QDataStream &operator<<(QDataStream &out, const Connection &connection);
+QDataStream &operator>>(QDataStream &in, Connection &connection);
+
+// Неориентированный граф связей между фигурами.
+// Списки смежности обновляются при каждой правке за O(степени вершины),
+// поэтому граф никогда не нужно перестраивать целиком.
+class ConnectionGraph {
+public:
+    ConnectionGraph();
+
+    // Добавление ребра; false, если ребро уже есть или концы совпадают
+    bool addEdge(int a, int b);
+    bool removeEdge(int a, int b);
+    // Удаление вершины вместе со всеми ее ребрами; возвращает бывших соседей
+    QSet<int> removeNode(int id);
+    void clear();
+
+    bool hasEdge(int a, int b) const;
+    const QSet<int> &neighbors(int id) const;
+    int degree(int id) const { return neighbors(id).size(); }
+    int edgeCount() const { return edges; }
+    int nodeCount() const { return adjacency.size(); }
+
+    // Все ребра по одному разу (from < to)
+    QVector<Connection> connections() const;
+
+    // Обход всех ребер по одному разу без промежуточного вектора
+    template <typename Func>
+    void forEachEdge(Func func) const {
+        for (auto it = adjacency.constBegin(); it != adjacency.constEnd(); ++it) {
+            for (int other : it.value()) {
+                if (it.key() < other) {
+                    func(it.key(), other);
+                }
+            }
+        }
+    }
+
+    const QHash<int, QSet<int>> &nodes() const { return adjacency; }
+
+private:
+    QHash<int, QSet<int>> adjacency;
+    int edges;
+};
+
+#endif // CONNECTIONGRAPH_H
@@ -0,0 +1,461 @@
+#include "diagram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+#include "hittest.h"
+#include "profiler.h"
+
+namespace {
+std::atomic<quint64> lastRevision(0);
+}
+
+Diagram::Diagram() : nextId(1), revisionNumber(++lastRevision), observer(nullptr) {}
+
+Diagram::Diagram(const Diagram &other)
+    : figureList(other.figureList), connectionGraph(other.connectionGraph), figureStore(other.figureStore),
+      spatialIndex(other.spatialIndex), segmentIndex(other.segmentIndex),
+      symbolLibrary(other.symbolLibrary), changeTracker(other.changeTracker), nextId(other.nextId), revisionNumber(other.revisionNumber),
+      observer(nullptr) {}
+
+Diagram &Diagram::operator=(const Diagram &other) {
+    if (this != &other) {
+        figureList = other.figureList;
+        connectionGraph = other.connectionGraph;
+        figureStore = other.figureStore;
+        spatialIndex = other.spatialIndex;
+        segmentIndex = other.segmentIndex;
+        symbolLibrary = other.symbolLibrary;
+        nextId = other.nextId;
+        revisionNumber = other.revisionNumber;
+        // Содержимое могло откатиться к старому снимку: сравнивать куски с прежними версиями нельзя
+        changeTracker.restart();
+        if (observer) {
+            observer->documentReplaced(*this);
+        }
+    }
+    return *this;
+}
+
+void Diagram::touch() {
+    revisionNumber = ++lastRevision;
+}
+
+int Diagram::indexOf(int id) const {
+    auto it = std::lower_bound(figureList.constBegin(), figureList.constEnd(), id,
+                               [](const Figure &figure, int value) { return figure.id < value; });
+    if (it == figureList.constEnd() || it->id != id) {
+        return -1;
+    }
+    return int(it - figureList.constBegin());
+}
+
+const Figure *Diagram::figure(int id) const {
+    int index = indexOf(id);
+    return index != -1 ? &figureList.at(index) : nullptr;
+}
+
+QRect Diagram::bounds() const {
+    QRect result;
+    for (const Figure &figure : figureList) {
+        result |= figure.rect.normalized();
+    }
+    return result;
+}
+
+bool Diagram::instanceContains(const Figure &figure, const QPoint &point) const {
+    return symbolLibrary.contains(figure.symbol, point - figure.rect.topLeft());
+}
+
+bool Diagram::instanceIntersects(const Figure &figure, const QRect &area) const {
+    return symbolLibrary.intersects(figure.symbol, area.translated(-figure.rect.topLeft()));
+}
+
+int Diagram::figureAt(const QPoint &point) const {
+    // Сетка отбирает фигуры по прямоугольникам, форма проверяется пакетом;
+    // экземпляры символов разворачиваются и проверяются по отдельности
+    const QVector<int> candidates = spatialIndex.keysAt(point);
+    if (candidates.size() == 1 && figure(candidates.first())->shape == Rectangle) {
+        return candidates.first();
+    }
+    HitBatch batch;
+    batch.reserve(candidates.size());
+    int best = -1;
+    for (int id : candidates) {
+        const Figure *f = figure(id);
+        if (f->shape != Instance) {
+            batch.append(id, f->shape, f->rect);
+        } else if (id > best && instanceContains(*f, point)) {
+            best = id;
+        }
+    }
+    QVector<uchar> hits;
+    hitTestPoint(batch, point, hits);
+    for (int i = 0; i < hits.size(); ++i) {
+        if (hits[i] && batch.ids[i] > best) {
+            best = batch.ids[i];
+        }
+    }
+    return best;
+}
+
+QVector<int> Diagram::figuresIn(const QRect &area) const {
+    return spatialIndex.query(area);
+}
+
+QVector<int> Diagram::figuresTouching(const QRect &area) const {
+    PROFILE_SCOPE("Diagram::figuresTouching");
+    const QVector<int> candidates = spatialIndex.query(area);
+    HitBatch batch;
+    batch.reserve(candidates.size());
+    QVector<int> result;
+    for (int id : candidates) {
+        const Figure *f = figure(id);
+        if (f->shape != Instance) {
+            batch.append(id, f->shape, f->rect);
+        } else if (instanceIntersects(*f, area)) {
+            result.append(id);
+        }
+    }
+    QVector<uchar> hits;
+    hitTestRect(batch, area, hits);
+    for (int i = 0; i < hits.size(); ++i) {
+        if (hits[i]) {
+            result.append(batch.ids[i]);
+        }
+    }
+    return result;
+}
+
+QLine Diagram::connectionLine(int from, int to) const {
+    return QLine(figure(from)->rect.center(), figure(to)->rect.center());
+}
+
+Connection Diagram::connectionAt(const QPoint &point, int tolerance) const {
+    return segmentIndex.nearest(point, tolerance);
+}
+
+void Diagram::indexConnection(int a, int b) {
+    segmentIndex.insert({ qMin(a, b), qMax(a, b) }, connectionLine(qMin(a, b), qMax(a, b)));
+}
+
+void Diagram::unindexConnection(int a, int b) {
+    segmentIndex.remove({ qMin(a, b), qMax(a, b) }, connectionLine(qMin(a, b), qMax(a, b)));
+}
+
+void Diagram::unindexConnections(int id) {
+    for (int other : connectionGraph.neighbors(id)) {
+        unindexConnection(id, other);
+    }
+}
+
+int Diagram::addFigure(Shape shape, const QRect &rect) {
+    const int id = nextId++;
+    figureList.append({ id, shape, rect });
+    figureStore.insert(figureList.last());
+    spatialIndex.insert(id, rect);
+    touch();
+    changeTracker.markFigure(id, revisionNumber);
+    if (observer) {
+        observer->figureAdded(figureList.last());
+    }
+    return id;
+}
+
+int Diagram::defineSymbol(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    const int symbol = symbolLibrary.define(figures, connections);
+    touch();
+    changeTracker.markSymbols(revisionNumber);
+    if (observer) {
+        observer->symbolDefined(figures, connections);
+    }
+    return symbol;
+}
+
+int Diagram::addInstance(int symbol, const QPoint &topLeft) {
+    const Symbol *definition = symbolLibrary.symbol(symbol);
+    if (!definition) {
+        return -1;
+    }
+    const int id = nextId++;
+    figureList.append({ id, Instance, definition->bounds.translated(topLeft), symbol });
+    figureStore.insert(figureList.last());
+    spatialIndex.insert(id, figureList.last().rect);
+    touch();
+    changeTracker.markFigure(id, revisionNumber);
+    if (observer) {
+        observer->figureAdded(figureList.last());
+    }
+    return id;
+}
+
+bool Diagram::shiftFigure(int id, const QPoint &delta) {
+    int index = indexOf(id);
+    if (index == -1) {
+        return false;
+    }
+    // Отрезки связей снимаются по старому положению и ставятся по новому;
+    // если второй конец тоже сдвигается, его отрезки обновятся еще раз
+    unindexConnections(id);
+    QRect &rect = figureList[index].rect;
+    const QRect oldRect = rect;
+    rect.translate(delta);
+    spatialIndex.move(id, oldRect, rect);
+    figureStore.setRect(figureList[index].shape, id, rect);
+    for (int other : connectionGraph.neighbors(id)) {
+        indexConnection(id, other);
+    }
+    return true;
+}
+
+void Diagram::moveFigure(int id, const QPoint &delta) {
+    if (!shiftFigure(id, delta)) {
+        return;
+    }
+    touch();
+    changeTracker.markFigure(id, revisionNumber);
+    if (observer) {
+        observer->figuresMoved(QVector<int>{ id }, delta);
+    }
+}
+
+void Diagram::moveFigures(const QVector<int> &ids, const QPoint &delta) {
+    // Связи рисуются между центрами, поэтому их концы сдвигаются вместе с фигурами
+    for (int id : ids) {
+        shiftFigure(id, delta);
+    }
+    touch();
+    changeTracker.markFigures(ids, revisionNumber);
+    if (observer) {
+        observer->figuresMoved(ids, delta);
+    }
+}
+
+void Diagram::moveFigures(const QVector<int> &ids, const QVector<QPoint> &deltas) {
+    for (int i = 0; i < ids.size(); ++i) {
+        shiftFigure(ids[i], deltas[i]);
+    }
+    touch();
+    changeTracker.markFigures(ids, revisionNumber);
+    if (observer) {
+        observer->figuresShifted(ids, deltas);
+    }
+}
+
+void Diagram::removeFigure(int id) {
+    int index = indexOf(id);
+    if (index == -1) {
+        return;
+    }
+    // Связи снимаются по списку смежности за O(степени), без обхода всех ребер
+    unindexConnections(id);
+    const QSet<int> neighbors = connectionGraph.removeNode(id);
+    spatialIndex.remove(id, figureList[index].rect);
+    figureStore.remove(figureList[index].shape, id);
+    figureList.remove(index);
+    touch();
+    changeTracker.markFigure(id, revisionNumber);
+    for (int other : neighbors) {
+        changeTracker.markConnection(id, other, revisionNumber);
+    }
+    if (observer) {
+        observer->figuresRemoved(QVector<int>{ id });
+    }
+}
+
+void Diagram::removeFigures(const QVector<int> &ids) {
+    PROFILE_SCOPE("Diagram::removeFigures");
+    QVector<int> sorted = ids;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    if (sorted.isEmpty()) {
+        return;
+    }
+
+    // Связи снимаются по спискам смежности удаляемых фигур.
+    // Если удаляется большая часть документа, сетки дешевле построить заново.
+    const bool rebuildIndex = sorted.size() > figureList.size() / 4;
+    // Связи относятся к куску меньшего конца: соседи с меньшим id тоже меняются
+    QVector<int> changedNeighbors;
+    for (int id : sorted) {
+        if (!rebuildIndex) {
+            unindexConnections(id);
+        }
+        for (int other : connectionGraph.removeNode(id)) {
+            if (other < id) {
+                changedNeighbors.append(other);
+            }
+        }
+    }
+
+    // Один проход по фигурам: оставшиеся сдвигаются к началу, порядок сохраняется
+    int kept = 0;
+    auto removed = sorted.constBegin();
+    for (int i = 0; i < figureList.size(); ++i) {
+        const Figure &figure = figureList[i];
+        removed = std::lower_bound(removed, sorted.constEnd(), figure.id);
+        if (removed != sorted.constEnd() && *removed == figure.id) {
+            if (!rebuildIndex) {
+                spatialIndex.remove(figure.id, figure.rect);
+            }
+            continue;
+        }
+        if (kept != i) {
+            figureList[kept] = figure;
+        }
+        ++kept;
+    }
+    figureList.resize(kept);
+    figureStore.removeAll(sorted);
+
+    if (rebuildIndex) {
+        spatialIndex.clear();
+        for (const Figure &figure : figureList) {
+            spatialIndex.insert(figure.id, figure.rect);
+        }
+        segmentIndex.clear();
+        connectionGraph.forEachEdge([this](int a, int b) { indexConnection(a, b); });
+    }
+    touch();
+    changeTracker.markFigures(sorted, revisionNumber);
+    std::sort(changedNeighbors.begin(), changedNeighbors.end());
+    changeTracker.markFigures(changedNeighbors, revisionNumber);
+    if (observer) {
+        observer->figuresRemoved(sorted);
+    }
+}
+
+bool Diagram::connectFigures(int from, int to) {
+    if (indexOf(from) == -1 || indexOf(to) == -1) {
+        return false;
+    }
+    if (!connectionGraph.addEdge(from, to)) {
+        return false;
+    }
+    indexConnection(from, to);
+    touch();
+    changeTracker.markConnection(from, to, revisionNumber);
+    if (observer) {
+        observer->figuresConnected(from, to);
+    }
+    return true;
+}
+
+bool Diagram::disconnectFigures(int from, int to) {
+    if (!connectionGraph.hasEdge(from, to)) {
+        return false;
+    }
+    unindexConnection(from, to);
+    connectionGraph.removeEdge(from, to);
+    touch();
+    changeTracker.markConnection(from, to, revisionNumber);
+    if (observer) {
+        observer->figuresDisconnected(from, to);
+    }
+    return true;
+}
+
+void Diagram::insertFigures(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    PROFILE_SCOPE("Diagram::insertFigures");
+    QVector<Figure> incoming;
+    incoming.reserve(figures.size());
+    for (const Figure &figure : figures) {
+        if (indexOf(figure.id) == -1) {
+            incoming.append(figure);
+        }
+    }
+    std::sort(incoming.begin(), incoming.end(),
+              [](const Figure &a, const Figure &b) { return a.id < b.id; });
+    incoming.erase(std::unique(incoming.begin(), incoming.end(),
+                               [](const Figure &a, const Figure &b) { return a.id == b.id; }),
+                   incoming.end());
+
+    if (incoming.size() == 1) {
+        // Одна фигура вставляется на свое место по id
+        const Figure &figure = incoming.first();
+        auto it = std::lower_bound(figureList.begin(), figureList.end(), figure.id,
+                                   [](const Figure &f, int value) { return f.id < value; });
+        figureList.insert(it, figure);
+        figureStore.insert(figure);
+        spatialIndex.insert(figure.id, figure.rect);
+    } else if (!incoming.isEmpty()) {
+        // Много фигур: слияние двух отсортированных списков за один проход,
+        // раскладка по типам строится заново, в сетку добавляются только новые фигуры
+        QVector<Figure> merged;
+        merged.reserve(figureList.size() + incoming.size());
+        std::merge(figureList.constBegin(), figureList.constEnd(), incoming.constBegin(), incoming.constEnd(),
+                   std::back_inserter(merged), [](const Figure &a, const Figure &b) { return a.id < b.id; });
+        figureList = merged;
+        figureStore.clear();
+        for (const Figure &figure : figureList) {
+            figureStore.insert(figure);
+        }
+        for (const Figure &figure : incoming) {
+            spatialIndex.insert(figure.id, figure.rect);
+        }
+    }
+    if (!figureList.isEmpty()) {
+        nextId = qMax(nextId, figureList.last().id + 1);
+    }
+
+    for (const Connection &connection : connections) {
+        if (indexOf(connection.from) != -1 && indexOf(connection.to) != -1
+            && connectionGraph.addEdge(connection.from, connection.to)) {
+            indexConnection(connection.from, connection.to);
+        }
+    }
+    touch();
+    for (const Figure &figure : incoming) {
+        changeTracker.markFigure(figure.id, revisionNumber);
+    }
+    for (const Connection &connection : connections) {
+        changeTracker.markConnection(connection.from, connection.to, revisionNumber);
+    }
+    if (observer) {
+        observer->figuresInserted(figures, connections);
+    }
+}
+
+void Diagram::reset() {
+    figureList.clear();
+    connectionGraph.clear();
+    spatialIndex.clear();
+    segmentIndex.clear();
+    figureStore.clear();
+    symbolLibrary.clear();
+    changeTracker.restart();
+    nextId = 1;
+    touch();
+}
+
+void Diagram::clear() {
+    reset();
+    if (observer) {
+        observer->documentReplaced(*this);
+    }
+}
+
+void Diagram::assign(const QVector<Figure> &figures, const QVector<Connection> &connections,
+                     const SymbolLibrary &symbols) {
+    PROFILE_SCOPE("Diagram::assign");
+    reset();
+    symbolLibrary = symbols;
+    figureList = figures;
+    for (const Figure &figure : figureList) {
+        spatialIndex.insert(figure.id, figure.rect);
+        figureStore.insert(figure);
+    }
+    if (!figureList.isEmpty()) {
+        nextId = figureList.last().id + 1;
+    }
+    for (const Connection &connection : connections) {
+        if (indexOf(connection.from) != -1 && indexOf(connection.to) != -1
+            && connectionGraph.addEdge(connection.from, connection.to)) {
+            indexConnection(connection.from, connection.to);
+        }
+    }
+    if (observer) {
+        observer->documentReplaced(*this);
+    }
+}
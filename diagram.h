@@ -0,0 +1,126 @@
+// diagram.h
+
+#ifndef DIAGRAM_H
+#define DIAGRAM_H
+
+#include <QRect>
+#include <QPoint>
+#include <QVector>
+
+#include "changetracker.h"
+#include "connectiongraph.h"
+#include "diagramlistener.h"
+#include "figure.h"
+#include "figurestore.h"
+#include "segmentindex.h"
+#include "spatialindex.h"
+#include "symbollibrary.h"
+
+// Модель документа: фигуры в порядке отрисовки, их раскладка по типам,
+// граф связей и сетки для поиска фигур и связей.
+// Все правки проходят через методы класса, поэтому раскладка, граф и сетки
+// всегда согласованы с фигурами и обновляются инкрементально.
+class Diagram {
+public:
+    Diagram();
+    // Наблюдатель не копируется: копия (снимок для истории или фоновой
+    // задачи) не должна сообщать о своих правках. Присваивание сохраняет
+    // наблюдателя документа и сообщает ему о замене содержимого.
+    Diagram(const Diagram &other);
+    Diagram &operator=(const Diagram &other);
+
+    // Наблюдатель за правками или nullptr; владеет им вызывающий
+    void setListener(DiagramListener *listener) { observer = listener; }
+    DiagramListener *listener() const { return observer; }
+
+    const QVector<Figure> &figures() const { return figureList; }
+    const ConnectionGraph &graph() const { return connectionGraph; }
+    // Те же фигуры, разложенные по типам для пакетной отрисовки
+    const FigureStore &store() const { return figureStore; }
+    // Определения символов, на которые ссылаются экземпляры
+    const SymbolLibrary &symbols() const { return symbolLibrary; }
+    int figureCount() const { return figureList.size(); }
+    int connectionCount() const { return connectionGraph.edgeCount(); }
+    // Номер версии содержимого: меняется при каждой правке и уникален
+    // среди всех диаграмм, поэтому по нему можно проверять кэши
+    quint64 revision() const { return revisionNumber; }
+    // Какие куски документа менялись и в каких версиях (для инкрементального сохранения).
+    // Копия продолжает ту же линию версий, присваивание и загрузка начинают новую.
+    const ChangeTracker &changes() const { return changeTracker; }
+
+    // Прямоугольник, охватывающий все фигуры; пустой для пустого документа
+    QRect bounds() const;
+
+    // Позиция фигуры в figures() по id (двоичный поиск) или -1
+    int indexOf(int id) const;
+    const Figure *figure(int id) const;
+    // Id самой верхней фигуры под точкой или -1. Учитывается форма:
+    // угол прямоугольника рядом с эллипсом или треугольником фигурой не считается
+    int figureAt(const QPoint &point) const;
+    // Id фигур, чьи прямоугольники пересекают область, в произвольном порядке
+    QVector<int> figuresIn(const QRect &area) const;
+    // Id фигур, которые задевает область с учетом формы, в произвольном порядке
+    QVector<int> figuresTouching(const QRect &area) const;
+    // Отрезок связи: связи рисуются между центрами фигур
+    QLine connectionLine(int from, int to) const;
+    // Ближайшая к точке связь не дальше tolerance (from < to) или { -1, -1 }
+    Connection connectionAt(const QPoint &point, int tolerance) const;
+    // Связи (from < to), чьи отрезки могут задевать область, по одному разу; ищутся по сетке отрезков
+    QVector<Connection> connectionsIn(const QRect &area) const { return segmentIndex.query(area); }
+
+    // Добавление фигуры поверх остальных; возвращает ее id
+    int addFigure(Shape shape, const QRect &rect);
+    // Новый символ из фигур (в координатах сцены) и связей между ними; возвращает номер символа.
+    // Сами фигуры в документе не меняются.
+    int defineSymbol(const QVector<Figure> &figures, const QVector<Connection> &connections);
+    // Экземпляр символа поверх остальных фигур с левым верхним углом в topLeft; возвращает id или -1
+    int addInstance(int symbol, const QPoint &topLeft);
+    void moveFigure(int id, const QPoint &delta);
+    // Сдвиг группы фигур на одно и то же смещение
+    void moveFigures(const QVector<int> &ids, const QPoint &delta);
+    // Сдвиг каждой фигуры на свое смещение (deltas параллельно ids)
+    void moveFigures(const QVector<int> &ids, const QVector<QPoint> &deltas);
+    // Удаление фигуры вместе с ее связями
+    void removeFigure(int id);
+    // Удаление группы фигур с их связями одним проходом уплотнения
+    void removeFigures(const QVector<int> &ids);
+    bool connectFigures(int from, int to);
+    bool disconnectFigures(int from, int to);
+    // Возврат ранее удаленных фигур с их прежними id и связей между ними
+    // (например, при отмене). Фигуры с уже занятыми id пропускаются.
+    void insertFigures(const QVector<Figure> &figures, const QVector<Connection> &connections);
+    void clear();
+    // Новые фигуры получат id не меньше firstFree (id фигур, которых нет в памяти, заняты)
+    void reserveIds(int firstFree) { nextId = qMax(nextId, firstFree); }
+
+    // Полная замена содержимого (например, при загрузке).
+    // Фигуры должны идти по возрастанию id; связи с неизвестными id отбрасываются.
+    // Экземпляры ссылаются на символы из symbols.
+    void assign(const QVector<Figure> &figures, const QVector<Connection> &connections,
+                const SymbolLibrary &symbols = SymbolLibrary());
+
+private:
+    QVector<Figure> figureList;    // Отсортированы по id, то есть в порядке отрисовки
+    ConnectionGraph connectionGraph;
+    FigureStore figureStore;
+    SpatialIndex spatialIndex;
+    SegmentIndex segmentIndex;     // Отрезки связей для поиска под курсором
+    SymbolLibrary symbolLibrary;
+    ChangeTracker changeTracker;
+    int nextId;
+    quint64 revisionNumber;
+    DiagramListener *observer;
+
+    void touch();
+    // Попадание в экземпляр проверяется по фигурам его символа
+    bool instanceContains(const Figure &figure, const QPoint &point) const;
+    bool instanceIntersects(const Figure &figure, const QRect &area) const;
+    bool shiftFigure(int id, const QPoint &delta);
+    void reset();
+    // Связь в сетку отрезков и из нее; граф при этом не меняется
+    void indexConnection(int a, int b);
+    void unindexConnection(int a, int b);
+    void unindexConnections(int id);
+};
+
+#endif // DIAGRAM_H
@@ -0,0 +1,36 @@
+// diagramlistener.h
+
+#ifndef DIAGRAMLISTENER_H
+#define DIAGRAMLISTENER_H
+
+#include <QPoint>
+#include <QVector>
+
+#include "connectiongraph.h"
+#include "figure.h"
+
+class Diagram;
+
+// Наблюдатель за правками документа (например, журнал автосохранения).
+// Методы вызываются в потоке, который правит документ, уже после правки.
+// Повтор тех же вызовов Diagram с теми же аргументами над прежним
+// состоянием дает то же самое состояние.
+class DiagramListener {
+public:
+    virtual ~DiagramListener() {}
+
+    virtual void figureAdded(const Figure &figure) = 0;
+    virtual void figuresMoved(const QVector<int> &ids, const QPoint &delta) = 0;
+    // Сдвиг каждой фигуры на свое смещение
+    virtual void figuresShifted(const QVector<int> &ids, const QVector<QPoint> &deltas) = 0;
+    virtual void figuresRemoved(const QVector<int> &ids) = 0;
+    virtual void figuresInserted(const QVector<Figure> &figures, const QVector<Connection> &connections) = 0;
+    virtual void figuresConnected(int from, int to) = 0;
+    virtual void figuresDisconnected(int from, int to) = 0;
+    // Новый символ (Diagram::defineSymbol с теми же аргументами)
+    virtual void symbolDefined(const QVector<Figure> &figures, const QVector<Connection> &connections) = 0;
+    // Содержимое заменено целиком: очистка, загрузка, присваивание
+    virtual void documentReplaced(const Diagram &diagram) = 0;
+};
+
+#endif // DIAGRAMLISTENER_H
@@ -0,0 +1,913 @@
+#include "documentio.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QDataStream>
+#include <QHash>
+#include <QtEndian>
+#include <QtConcurrent>
+
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#include "chunkeddocument.h"
+#include "pageddocument.h"
+#include "profiler.h"
+
+namespace {
+
+const quint32 kBinaryMagic = 0x4447524d;   // "DGRM"
+const quint16 kBinaryVersion = 1;
+const quint32 kFiguresTag = 0x46494753;    // "FIGS"
+const quint32 kConnectionsTag = 0x434f4e4e; // "CONN"
+const quint32 kSymbolsTag = 0x53594d53;    // "SYMS"
+const quint32 kInstancesTag = 0x494e5354;  // "INST"
+
+// Размеры записей в байтах: id, форма и четыре координаты; два id связи;
+// id экземпляра и номер его символа
+const qint64 kFigureRecordSize = 6 * 4;
+const qint64 kConnectionRecordSize = 2 * 4;
+const qint64 kInstanceRecordSize = 2 * 4;
+const qint64 kHeaderSize = 4 + 2 + 2;
+const qint64 kSectionHeaderSize = 4 + 8;
+
+// Сколько записей обрабатывается между отчетами о ходе операции
+const int kProgressStep = 1 << 16;
+// Сколько строк текстового файла разбирает одна задача пула потоков
+const int kLinesPerChunk = 1 << 14;
+
+const char *const kCancelledMessage = "Операция отменена";
+
+void setError(QString *errorMessage, const QString &message) {
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+}
+
+// Ключ хэша по центру фигуры (связи текстового формата заданы центрами)
+quint64 centerKey(const QPoint &point) {
+    return (quint64(quint32(point.x())) << 32) | quint32(point.y());
+}
+
+bool isFigureShape(qint32 shape) {
+    return shape == Rectangle || shape == Triangle || shape == Ellipse || shape == Instance;
+}
+
+// Номера символов из секции INST (пары id - символ) в экземпляры
+void applyInstances(QVector<Figure> &figures, const QHash<int, int> &symbolById) {
+    for (Figure &figure : figures) {
+        if (figure.shape == Instance) {
+            figure.symbol = symbolById.value(figure.id, -1);
+        }
+    }
+}
+
+// Пересчет выполненной работы в проценты и проверка отмены.
+// advance() можно вызывать одновременно из нескольких потоков пула.
+class ProgressTracker {
+public:
+    ProgressTracker(const ProgressCallback &callback, qint64 total)
+        : callback(callback), total(qMax<qint64>(1, total)), done(0), cancelled(false) {}
+
+    // Учет выполненной работы; false, если операцию нужно прервать
+    bool advance(qint64 amount) {
+        const qint64 value = done.fetch_add(amount) + amount;
+        if (callback && !callback(int(qMin<qint64>(99, value * 100 / total)))) {
+            cancelled = true;
+        }
+        return !cancelled;
+    }
+    bool isCancelled() const { return cancelled; }
+
+private:
+    const ProgressCallback &callback;
+    const qint64 total;
+    std::atomic<qint64> done;
+    std::atomic<bool> cancelled;
+};
+
+// Разбор двоичного документа из непрерывного блока памяти (отображенного файла).
+// Записи имеют фиксированный размер, поэтому читаются напрямую, без промежуточных объектов.
+bool parseBinary(const uchar *data, qint64 size, Diagram &diagram, QString *errorMessage,
+                 const ProgressCallback &progress) {
+    if (size < kHeaderSize || qFromBigEndian<quint32>(data) != kBinaryMagic) {
+        setError(errorMessage, "Файл не является двоичным документом");
+        return false;
+    }
+    const quint16 version = qFromBigEndian<quint16>(data + 4);
+    if (version > kBinaryVersion) {
+        setError(errorMessage, QString("Неподдерживаемая версия формата: %1").arg(int(version)));
+        return false;
+    }
+
+    ProgressTracker tracker(progress, size);
+    QVector<Figure> figures;
+    QVector<Connection> connections;
+    SymbolLibrary symbols;
+    QHash<int, int> symbolById;
+    qint64 pos = kHeaderSize;
+    while (pos < size) {
+        if (size - pos < kSectionHeaderSize) {
+            setError(errorMessage, "Файл поврежден: обрезан заголовок секции");
+            return false;
+        }
+        const quint32 tag = qFromBigEndian<quint32>(data + pos);
+        const quint64 length = qFromBigEndian<quint64>(data + pos + 4);
+        pos += kSectionHeaderSize;
+        if (length > quint64(size - pos)) {
+            setError(errorMessage, "Файл поврежден: секция выходит за конец файла");
+            return false;
+        }
+        const uchar *section = data + pos;
+
+        if (tag == kFiguresTag || tag == kConnectionsTag) {
+            const qint64 recordSize = tag == kFiguresTag ? kFigureRecordSize : kConnectionRecordSize;
+            const quint32 count = length >= 4 ? qFromBigEndian<quint32>(section) : 0;
+            if (length < 4 || quint64(count) * recordSize + 4 > length) {
+                setError(errorMessage, "Файл поврежден: неверная длина секции");
+                return false;
+            }
+            const uchar *record = section + 4;
+            if (tag == kFiguresTag) {
+                figures.resize(int(count));
+                for (quint32 i = 0; i < count; ++i, record += kFigureRecordSize) {
+                    Figure &figure = figures[int(i)];
+                    figure.id = qFromBigEndian<qint32>(record);
+                    const qint32 shape = qFromBigEndian<qint32>(record + 4);
+                    figure.shape = isFigureShape(shape) ? static_cast<Shape>(shape) : Rectangle;
+                    figure.rect.setCoords(qFromBigEndian<qint32>(record + 8), qFromBigEndian<qint32>(record + 12),
+                                          qFromBigEndian<qint32>(record + 16), qFromBigEndian<qint32>(record + 20));
+                    // Порядок по оси Z задается id, поэтому они обязаны возрастать
+                    if (i > 0 && figure.id <= figures[int(i) - 1].id) {
+                        setError(errorMessage, "Файл поврежден: id фигур не возрастают");
+                        return false;
+                    }
+                    if ((i + 1) % kProgressStep == 0 && !tracker.advance(kProgressStep * kFigureRecordSize)) {
+                        setError(errorMessage, kCancelledMessage);
+                        return false;
+                    }
+                }
+            } else {
+                connections.resize(int(count));
+                for (quint32 i = 0; i < count; ++i, record += kConnectionRecordSize) {
+                    connections[int(i)] = { qFromBigEndian<qint32>(record), qFromBigEndian<qint32>(record + 4) };
+                    if ((i + 1) % kProgressStep == 0 && !tracker.advance(kProgressStep * kConnectionRecordSize)) {
+                        setError(errorMessage, kCancelledMessage);
+                        return false;
+                    }
+                }
+            }
+        } else if (tag == kSymbolsTag) {
+            // Определений немного, поэтому они читаются обычным QDataStream
+            const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(section), int(length));
+            QDataStream in(bytes);
+            in.setVersion(QDataStream::Qt_5_0);
+            in >> symbols;
+            if (in.status() != QDataStream::Ok) {
+                setError(errorMessage, "Файл поврежден: неверная секция символов");
+                return false;
+            }
+        } else if (tag == kInstancesTag) {
+            const quint32 count = length >= 4 ? qFromBigEndian<quint32>(section) : 0;
+            if (length < 4 || quint64(count) * kInstanceRecordSize + 4 > length) {
+                setError(errorMessage, "Файл поврежден: неверная длина секции");
+                return false;
+            }
+            symbolById.reserve(int(count));
+            for (const uchar *record = section + 4; record < section + 4 + count * kInstanceRecordSize;
+                 record += kInstanceRecordSize) {
+                symbolById.insert(qFromBigEndian<qint32>(record), qFromBigEndian<qint32>(record + 4));
+            }
+        }
+        // Неизвестные секции пропускаются по длине
+        pos += qint64(length);
+    }
+
+    applyInstances(figures, symbolById);
+    symbols.resolve(figures);
+    diagram.assign(figures, connections, symbols);
+    return true;
+}
+
+// Запасной путь для устройств, которые нельзя отобразить в память:
+// те же записи читаются через симметричные операторы QDataStream
+bool readBinaryStream(QIODevice *device, Diagram &diagram, QString *errorMessage,
+                      const ProgressCallback &progress) {
+    QDataStream in(device);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint16 flags = 0;
+    in >> magic >> version >> flags;
+    if (in.status() != QDataStream::Ok || magic != kBinaryMagic) {
+        setError(errorMessage, "Файл не является двоичным документом");
+        return false;
+    }
+    if (version > kBinaryVersion) {
+        setError(errorMessage, QString("Неподдерживаемая версия формата: %1").arg(int(version)));
+        return false;
+    }
+
+    ProgressTracker tracker(progress, device->size());
+    QVector<Figure> figures;
+    QVector<Connection> connections;
+    SymbolLibrary symbols;
+    QHash<int, int> symbolById;
+    // Число записей сверяется с длиной секции и размером файла до выделения памяти под них
+    auto countFits = [&](quint32 count, qint64 recordSize, quint64 length) {
+        return quint64(count) * recordSize + 4 <= length && length <= quint64(device->size());
+    };
+    while (!in.atEnd()) {
+        quint32 tag = 0;
+        quint64 length = 0;
+        in >> tag >> length;
+        qint64 consumed = 0;
+        if (tag == kFiguresTag) {
+            quint32 count = 0;
+            in >> count;
+            if (!countFits(count, kFigureRecordSize, length)) {
+                setError(errorMessage, "Файл поврежден: неверная длина секции");
+                return false;
+            }
+            figures.resize(int(count));
+            for (Figure &figure : figures) {
+                in >> figure;
+                if (!isFigureShape(figure.shape)) {
+                    figure.shape = Rectangle;
+                }
+            }
+            consumed = 4 + qint64(count) * kFigureRecordSize;
+        } else if (tag == kConnectionsTag) {
+            quint32 count = 0;
+            in >> count;
+            if (!countFits(count, kConnectionRecordSize, length)) {
+                setError(errorMessage, "Файл поврежден: неверная длина секции");
+                return false;
+            }
+            connections.resize(int(count));
+            for (Connection &connection : connections) {
+                in >> connection;
+            }
+            consumed = 4 + qint64(count) * kConnectionRecordSize;
+        } else if (tag == kSymbolsTag) {
+            if (length > quint64(device->size()) || length > quint64(INT_MAX)) {
+                setError(errorMessage, "Файл поврежден: секция выходит за конец файла");
+                return false;
+            }
+            QByteArray bytes(int(length), Qt::Uninitialized);
+            in.readRawData(bytes.data(), bytes.size());
+            QDataStream section(bytes);
+            section.setVersion(QDataStream::Qt_5_0);
+            section >> symbols;
+            consumed = qint64(length);
+        } else if (tag == kInstancesTag) {
+            quint32 count = 0;
+            in >> count;
+            if (!countFits(count, kInstanceRecordSize, length)) {
+                setError(errorMessage, "Файл поврежден: неверная длина секции");
+                return false;
+            }
+            for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+                qint32 id = 0;
+                qint32 symbol = 0;
+                in >> id >> symbol;
+                symbolById.insert(id, symbol);
+            }
+            consumed = 4 + qint64(count) * kInstanceRecordSize;
+        }
+        // Остаток секции (или вся неизвестная секция) пропускается
+        for (qint64 rest = qint64(length) - consumed; rest > 0; ) {
+            const int chunk = int(qMin<qint64>(rest, 1 << 30));
+            if (in.skipRawData(chunk) != chunk) {
+                break;
+            }
+            rest -= chunk;
+        }
+        if (in.status() != QDataStream::Ok || qint64(length) < consumed) {
+            setError(errorMessage, "Файл поврежден: неверная длина секции");
+            return false;
+        }
+        if (!tracker.advance(kSectionHeaderSize + qint64(length))) {
+            setError(errorMessage, kCancelledMessage);
+            return false;
+        }
+    }
+
+    for (int i = 1; i < figures.size(); ++i) {
+        if (figures[i].id <= figures[i - 1].id) {
+            setError(errorMessage, "Файл поврежден: id фигур не возрастают");
+            return false;
+        }
+    }
+    applyInstances(figures, symbolById);
+    symbols.resolve(figures);
+    diagram.assign(figures, connections, symbols);
+    return true;
+}
+
+// Строки текстового файла поверх непрерывного блока памяти
+class TextLines {
+public:
+    TextLines(const char *data, qint64 size) : data(data), size(size) {
+        // Начала строк находятся одним последовательным проходом memchr
+        starts.append(0);
+        const char *end = data + size;
+        for (const char *p = data; p < end; ) {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+            if (!newline) {
+                break;
+            }
+            p = newline + 1;
+            starts.append(p - data);
+        }
+    }
+
+    int count() const { return starts.size(); }
+
+    void line(int index, const char *&begin, const char *&end) const {
+        begin = data + starts[index];
+        end = index + 1 < starts.size() ? data + starts[index + 1] - 1 : data + size;
+        // Файлы, записанные в Windows, заканчивают строки на \r\n
+        if (end > begin && end[-1] == '\r') {
+            --end;
+        }
+    }
+
+private:
+    const char *data;
+    qint64 size;
+    QVector<qint64> starts;
+};
+
+bool startsWith(const char *begin, const char *end, const char *prefix) {
+    const size_t length = strlen(prefix);
+    return size_t(end - begin) >= length && memcmp(begin, prefix, length) == 0;
+}
+
+bool equals(const char *begin, const char *end, const char *literal) {
+    const size_t length = strlen(literal);
+    return size_t(end - begin) == length && memcmp(begin, literal, length) == 0;
+}
+
+// Разбор целого числа со знаком без создания строк; пропускает ведущие пробелы
+bool parseInt(const char *&p, const char *end, int &value) {
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    qint64 result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        result = result * 10 + (*p - '0');
+        if (result > qint64(INT_MAX) + 1) {
+            return false;
+        }
+    }
+    if (!negative && result > INT_MAX) {
+        return false;
+    }
+    value = int(negative ? -result : result);
+    return true;
+}
+
+// Разбор строки вида "Имя: a b c d"; возвращает границы имени и четыре числа
+bool parseRecord(const char *begin, const char *end, const char *&nameEnd, int values[4]) {
+    const char *colon = static_cast<const char *>(memchr(begin, ':', size_t(end - begin)));
+    if (!colon || colon + 1 >= end || colon[1] != ' ') {
+        return false;
+    }
+    nameEnd = colon;
+    const char *p = colon + 2;
+    for (int i = 0; i < 4; ++i) {
+        if (!parseInt(p, end, values[i])) {
+            return false;
+        }
+    }
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    return p == end;
+}
+
+// Разбор строки фигуры: "Rectangle: x y w h" (а также Triangle, Ellipse)
+// или "Instance N: x y w h" для экземпляра символа N
+bool parseFigureLine(const char *begin, const char *end, Figure &figure) {
+    const char *nameEnd;
+    int values[4];
+    if (!parseRecord(begin, end, nameEnd, values)) {
+        return false;
+    }
+    figure.symbol = -1;
+    if (equals(begin, nameEnd, "Rectangle")) {
+        figure.shape = Rectangle;
+    } else if (equals(begin, nameEnd, "Triangle")) {
+        figure.shape = Triangle;
+    } else if (equals(begin, nameEnd, "Ellipse")) {
+        figure.shape = Ellipse;
+    } else if (startsWith(begin, nameEnd, "Instance ")) {
+        const char *p = begin + strlen("Instance ");
+        if (!parseInt(p, nameEnd, figure.symbol) || p != nameEnd) {
+            return false;
+        }
+        figure.shape = Instance;
+    } else {
+        return false;
+    }
+    figure.rect = QRect(values[0], values[1], values[2], values[3]);
+    return true;
+}
+
+int parseHeaderCount(const TextLines &lines, int index, const char *prefix) {
+    if (index >= lines.count()) {
+        return 0;
+    }
+    const char *begin;
+    const char *end;
+    lines.line(index, begin, end);
+    int value = 0;
+    if (startsWith(begin, end, prefix)) {
+        const char *p = begin + strlen(prefix);
+        if (!parseInt(p, end, value)) {
+            value = 0;
+        }
+    }
+    return qMax(0, value);
+}
+
+// Кусок секции текстового файла, который разбирается одной задачей пула
+struct FigureChunk {
+    int firstLine;
+    int lastLine;   // Не включительно
+    QVector<Figure> figures;
+    int malformed;
+    int firstMalformed;   // Номер строки с 1 или 0
+};
+
+struct ConnectionChunk {
+    int firstLine;
+    int lastLine;
+    QVector<Connection> connections;
+    int malformed;
+    int firstMalformed;
+    int dangling;
+    int firstDangling;
+};
+
+// Учет замечания в куске: счетчик и номер первой такой строки
+void noteIssue(int &count, int &firstLine, int line) {
+    if (count++ == 0) {
+        firstLine = line + 1;
+    }
+}
+
+// Блок символов после связей: "Symbols: K", затем для каждого символа строка
+// "Symbol: F C", F строк фигур в координатах символа и C строк связей между
+// их центрами. Разбирается последовательно: символов немного, и каждый может
+// ссылаться на предыдущие. Старые версии этих строк не читают.
+void parseSymbols(const TextLines &lines, int index, SymbolLibrary &symbols, int &malformed, int &firstMalformed) {
+    const int count = parseHeaderCount(lines, index, "Symbols: ");
+    ++index;
+    for (int s = 0; s < count && index < lines.count(); ++s) {
+        const char *begin;
+        const char *end;
+        lines.line(index, begin, end);
+        const char *p = begin + strlen("Symbol: ");
+        int figureCount = 0;
+        int connectionCount = 0;
+        if (!startsWith(begin, end, "Symbol: ") || !parseInt(p, end, figureCount) || !parseInt(p, end, connectionCount)
+            || figureCount < 0 || connectionCount < 0) {
+            // Без заголовка символа границы остальных символов неизвестны
+            noteIssue(malformed, firstMalformed, index);
+            return;
+        }
+        ++index;
+
+        QVector<Figure> figures;
+        for (int f = 0; f < figureCount && index < lines.count(); ++f, ++index) {
+            Figure figure;
+            lines.line(index, begin, end);
+            if (parseFigureLine(begin, end, figure)) {
+                figure.id = f;
+                figures.append(figure);
+            } else {
+                noteIssue(malformed, firstMalformed, index);
+            }
+        }
+        symbols.resolve(figures);
+        QHash<quint64, int> idByCenter;
+        for (const Figure &figure : figures) {
+            idByCenter.insert(centerKey(figure.rect.center()), figure.id);
+        }
+
+        QVector<Connection> connections;
+        for (int c = 0; c < connectionCount && index < lines.count(); ++c, ++index) {
+            const char *nameEnd;
+            int values[4];
+            lines.line(index, begin, end);
+            if (!parseRecord(begin, end, nameEnd, values) || !equals(begin, nameEnd, "Connection")) {
+                noteIssue(malformed, firstMalformed, index);
+                continue;
+            }
+            const int from = idByCenter.value(centerKey(QPoint(values[0], values[1])), -1);
+            const int to = idByCenter.value(centerKey(QPoint(values[2], values[3])), -1);
+            if (from != -1 && to != -1) {
+                connections.append({ from, to });
+            } else {
+                noteIssue(malformed, firstMalformed, index);
+            }
+        }
+        symbols.define(figures, connections);
+    }
+}
+
+bool parseText(const char *data, qint64 size, Diagram &diagram, QString *errorMessage,
+               const ProgressCallback &progress, LoadReport *report) {
+    const TextLines lines(data, size);
+
+    // Заголовок: количество фигур и количество связей
+    const int figureCount = parseHeaderCount(lines, 0, "Figures: ");
+    const int connectionCount = parseHeaderCount(lines, 1, "Connections: ");
+
+    // Строки каждой секции; недостающие строки в конце файла просто отсутствуют
+    const int firstFigureLine = 2;
+    const int figureLinesEnd = qMin(lines.count(), firstFigureLine + figureCount);
+    const int firstConnectionLine = firstFigureLine + figureCount;
+    const int connectionLinesEnd = int(qMin<qint64>(lines.count(), qint64(firstConnectionLine) + connectionCount));
+
+    ProgressTracker tracker(progress, qint64(figureCount) + connectionCount);
+
+    // Фигуры разбираются кусками параллельно; id фигуры - ее номер в секции,
+    // поэтому после склейки кусков по порядку id возрастают
+    QVector<FigureChunk> figureChunks;
+    for (int line = firstFigureLine; line < figureLinesEnd; line += kLinesPerChunk) {
+        figureChunks.append({ line, qMin(line + kLinesPerChunk, figureLinesEnd), QVector<Figure>(), 0, 0 });
+    }
+    QtConcurrent::blockingMap(figureChunks, [&](FigureChunk &chunk) {
+        PROFILE_SCOPE("parseText::figureChunk");
+        if (tracker.isCancelled()) {
+            return;
+        }
+        chunk.figures.reserve(chunk.lastLine - chunk.firstLine);
+        for (int line = chunk.firstLine; line < chunk.lastLine; ++line) {
+            const char *begin;
+            const char *end;
+            Figure figure;
+            lines.line(line, begin, end);
+            if (parseFigureLine(begin, end, figure)) {
+                figure.id = line - firstFigureLine + 1;
+                chunk.figures.append(figure);
+            } else {
+                noteIssue(chunk.malformed, chunk.firstMalformed, line);
+            }
+        }
+        tracker.advance(chunk.lastLine - chunk.firstLine);
+    });
+    if (tracker.isCancelled()) {
+        setError(errorMessage, kCancelledMessage);
+        return false;
+    }
+
+    QVector<Figure> figures;
+    figures.reserve(figureCount);
+    for (const FigureChunk &chunk : figureChunks) {
+        figures += chunk.figures;
+    }
+
+    // Символы нужны до связей: концы связей ищутся по центрам экземпляров
+    SymbolLibrary symbols;
+    int symbolMalformed = 0;
+    int firstSymbolMalformed = 0;
+    parseSymbols(lines, connectionLinesEnd, symbols, symbolMalformed, firstSymbolMalformed);
+    symbols.resolve(figures);
+
+    // Центр фигуры -> id; при совпадении центров побеждает верхняя фигура
+    QHash<quint64, int> idByCenter;
+    idByCenter.reserve(figures.size());
+    for (const Figure &figure : figures) {
+        idByCenter.insert(centerKey(figure.rect.center()), figure.id);
+    }
+
+    // Связи тоже разбираются параллельно; хэш центров в это время только читается
+    const QHash<quint64, int> &lookup = idByCenter;
+    QVector<ConnectionChunk> connectionChunks;
+    for (int line = firstConnectionLine; line < connectionLinesEnd; line += kLinesPerChunk) {
+        connectionChunks.append({ line, qMin(line + kLinesPerChunk, connectionLinesEnd), QVector<Connection>(),
+                                  0, 0, 0, 0 });
+    }
+    QtConcurrent::blockingMap(connectionChunks, [&](ConnectionChunk &chunk) {
+        PROFILE_SCOPE("parseText::connectionChunk");
+        if (tracker.isCancelled()) {
+            return;
+        }
+        chunk.connections.reserve(chunk.lastLine - chunk.firstLine);
+        for (int line = chunk.firstLine; line < chunk.lastLine; ++line) {
+            const char *begin;
+            const char *end;
+            const char *nameEnd;
+            int values[4];
+            lines.line(line, begin, end);
+            if (!parseRecord(begin, end, nameEnd, values) || !equals(begin, nameEnd, "Connection")) {
+                noteIssue(chunk.malformed, chunk.firstMalformed, line);
+                continue;
+            }
+            // Концы связи сопоставляются с фигурами один раз, при загрузке
+            const int from = lookup.value(centerKey(QPoint(values[0], values[1])), -1);
+            const int to = lookup.value(centerKey(QPoint(values[2], values[3])), -1);
+            if (from != -1 && to != -1) {
+                chunk.connections.append({ from, to });
+            } else {
+                noteIssue(chunk.dangling, chunk.firstDangling, line);
+            }
+        }
+        tracker.advance(chunk.lastLine - chunk.firstLine);
+    });
+    if (tracker.isCancelled()) {
+        setError(errorMessage, kCancelledMessage);
+        return false;
+    }
+
+    QVector<Connection> connections;
+    for (const ConnectionChunk &chunk : connectionChunks) {
+        connections += chunk.connections;
+    }
+
+    // Сетка и граф строятся один раз за O(F + C)
+    diagram.assign(figures, connections, symbols);
+
+    if (report) {
+        // Куски идут по порядку строк, поэтому первое замечание - в первом куске, где оно есть
+        *report = LoadReport();
+        for (const FigureChunk &chunk : figureChunks) {
+            if (chunk.malformed && !report->firstMalformedLine) {
+                report->firstMalformedLine = chunk.firstMalformed;
+            }
+            report->malformedLines += chunk.malformed;
+        }
+        for (const ConnectionChunk &chunk : connectionChunks) {
+            if (chunk.malformed && !report->firstMalformedLine) {
+                report->firstMalformedLine = chunk.firstMalformed;
+            }
+            if (chunk.dangling && !report->firstDanglingLine) {
+                report->firstDanglingLine = chunk.firstDangling;
+            }
+            report->malformedLines += chunk.malformed;
+            report->danglingConnections += chunk.dangling;
+        }
+        if (symbolMalformed && !report->firstMalformedLine) {
+            report->firstMalformedLine = firstSymbolMalformed;
+        }
+        report->malformedLines += symbolMalformed;
+        report->rejectedConnections = connections.size() - diagram.connectionCount();
+        report->missingLines = (figureCount - qMax(0, figureLinesEnd - firstFigureLine))
+                             + (connectionCount - qMax(0, connectionLinesEnd - firstConnectionLine));
+    }
+    return true;
+}
+
+} // namespace
+
+DocumentFormat formatForFile(const QString &fileName) {
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == "dgm") {
+        return DocumentFormat::Binary;
+    }
+    if (suffix == "dgc") {
+        return DocumentFormat::Chunked;
+    }
+    return suffix == "dgp" ? DocumentFormat::Paged : DocumentFormat::Text;
+}
+
+bool saveDocument(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+                  const ProgressCallback &progress) {
+    switch (formatForFile(fileName)) {
+    case DocumentFormat::Binary:
+        return saveBinary(fileName, diagram, errorMessage, progress);
+    case DocumentFormat::Paged:
+        return PagedDocument::write(fileName, diagram, errorMessage);
+    case DocumentFormat::Chunked:
+        // Без прошлой записи куски пишутся все; повторные сохранения - через свой ChunkedDocument
+        return ChunkedDocument().save(fileName, diagram, errorMessage, progress);
+    default:
+        return saveText(fileName, diagram, errorMessage, progress);
+    }
+}
+
+bool loadDocument(const QString &fileName, Diagram &diagram, QString *errorMessage,
+                  const ProgressCallback &progress, LoadReport *report) {
+    switch (formatForFile(fileName)) {
+    case DocumentFormat::Binary:
+        return loadBinary(fileName, diagram, errorMessage, progress);
+    case DocumentFormat::Paged:
+        return PagedDocument::readAll(fileName, diagram, errorMessage);
+    case DocumentFormat::Chunked:
+        return ChunkedDocument().load(fileName, diagram, errorMessage, progress);
+    default:
+        return loadText(fileName, diagram, errorMessage, progress, report);
+    }
+}
+
+bool saveText(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+              const ProgressCallback &progress) {
+    PROFILE_SCOPE("saveText");
+    // Файл пишется рядом и подменяет прежний только после успешной записи:
+    // отмена или ошибка оставляют старый документ нетронутым
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для записи");
+        return false;
+    }
+    // Создание объекта текстового потока для записи данных в файл
+    QTextStream out(&file);
+    ProgressTracker tracker(progress, qint64(diagram.figureCount()) + diagram.connectionCount());
+
+    // Записываем количество фигур и количество связей
+    out << "Figures: " << diagram.figureCount() << "\n";
+    out << "Connections: " << diagram.connectionCount() << "\n";
+
+    // Строка фигуры; экземпляр записывается с номером символа
+    auto writeFigure = [&out](const Figure &figure) {
+        switch (figure.shape) {
+        case Rectangle: out << "Rectangle"; break;
+        case Triangle: out << "Triangle"; break;
+        case Ellipse: out << "Ellipse"; break;
+        case Instance: out << "Instance " << figure.symbol; break;
+        default: out << "Unknown"; break;
+        }
+        out << ": " << figure.rect.left() << " " << figure.rect.top() << " "
+            << figure.rect.width() << " " << figure.rect.height() << "\n";
+    };
+
+    // Запись данных фигур в файл
+    int written = 0;
+    for (const auto& figure : diagram.figures()) {
+        writeFigure(figure);
+        if (++written % kProgressStep == 0 && !tracker.advance(kProgressStep)) {
+            break;
+        }
+    }
+
+    // Запись данных связей в файл (концы связи - центры фигур)
+    diagram.graph().forEachEdge([&](int from, int to) {
+        if (tracker.isCancelled()) {
+            return;
+        }
+        const QPoint first = diagram.figure(from)->rect.center();
+        const QPoint second = diagram.figure(to)->rect.center();
+        out << "Connection: " << first.x() << " " << first.y() << " "
+            << second.x() << " " << second.y() << "\n";
+        if (++written % kProgressStep == 0) {
+            tracker.advance(kProgressStep);
+        }
+    });
+
+    // Определения символов после связей, чтобы старые версии их не заметили
+    const SymbolLibrary &symbols = diagram.symbols();
+    if (!symbols.isEmpty() && !tracker.isCancelled()) {
+        out << "Symbols: " << symbols.count() << "\n";
+        for (int i = 0; i < symbols.count(); ++i) {
+            const Symbol *symbol = symbols.symbol(i);
+            out << "Symbol: " << symbol->figures.size() << " " << symbol->connections.size() << "\n";
+            for (const Figure &figure : symbol->figures) {
+                writeFigure(figure);
+            }
+            for (const Connection &connection : symbol->connections) {
+                const QPoint first = symbol->figures[connection.from].rect.center();
+                const QPoint second = symbol->figures[connection.to].rect.center();
+                out << "Connection: " << first.x() << " " << first.y() << " "
+                    << second.x() << " " << second.y() << "\n";
+            }
+        }
+    }
+
+    out.flush();
+    if (tracker.isCancelled()) {
+        // Недописанный файл не оставляем
+        file.cancelWriting();
+        setError(errorMessage, kCancelledMessage);
+        return false;
+    }
+    if (out.status() != QTextStream::Ok || !file.commit()) {
+        setError(errorMessage, "Ошибка записи файла");
+        return false;
+    }
+    return true;
+}
+
+bool loadText(const QString &fileName, Diagram &diagram, QString *errorMessage,
+              const ProgressCallback &progress, LoadReport *report) {
+    PROFILE_SCOPE("loadText");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для чтения");
+        return false;
+    }
+    // Файл разбирается прямо в отображенной памяти; если отобразить
+    // его нельзя, содержимое читается в буфер целиком
+    const qint64 size = file.size();
+    if (uchar *data = size > 0 ? file.map(0, size) : nullptr) {
+        const bool ok = parseText(reinterpret_cast<const char *>(data), size, diagram, errorMessage, progress, report);
+        file.unmap(data);
+        return ok;
+    }
+    const QByteArray bytes = file.readAll();
+    return parseText(bytes.constData(), bytes.size(), diagram, errorMessage, progress, report);
+}
+
+bool saveBinary(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+                const ProgressCallback &progress) {
+    PROFILE_SCOPE("saveBinary");
+    // Как и текстовый формат, пишется во временный файл и подменяет прежний целиком
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для записи");
+        return false;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    ProgressTracker tracker(progress, qint64(diagram.figureCount()) + diagram.connectionCount());
+
+    // Заголовок
+    out << kBinaryMagic << kBinaryVersion << quint16(0);
+
+    // Секция символов идет до фигур; старые версии ее пропускают,
+    // а экземпляры читают как прямоугольники по габариту символа
+    if (!diagram.symbols().isEmpty()) {
+        QByteArray bytes;
+        QDataStream section(&bytes, QIODevice::WriteOnly);
+        section.setVersion(QDataStream::Qt_5_0);
+        section << diagram.symbols();
+        out << kSymbolsTag << quint64(bytes.size());
+        out.writeRawData(bytes.constData(), bytes.size());
+    }
+
+    // Секция фигур: длина известна заранее, так как записи фиксированного размера
+    const QVector<Figure> &figures = diagram.figures();
+    out << kFiguresTag << quint64(4 + figures.size() * kFigureRecordSize) << quint32(figures.size());
+    for (int i = 0; i < figures.size() && !tracker.isCancelled(); ++i) {
+        out << figures[i];
+        if ((i + 1) % kProgressStep == 0) {
+            tracker.advance(kProgressStep);
+        }
+    }
+
+    // Секция связей
+    const QVector<Connection> connections = diagram.graph().connections();
+    out << kConnectionsTag << quint64(4 + connections.size() * kConnectionRecordSize)
+        << quint32(connections.size());
+    for (int i = 0; i < connections.size() && !tracker.isCancelled(); ++i) {
+        out << connections[i];
+        if ((i + 1) % kProgressStep == 0) {
+            tracker.advance(kProgressStep);
+        }
+    }
+
+    // Номера символов экземпляров: пары id - символ по возрастанию id
+    const FigureStore &store = diagram.store();
+    const QVector<int> &instanceIds = store.ids(Instance);
+    if (!instanceIds.isEmpty()) {
+        out << kInstancesTag << quint64(4 + instanceIds.size() * kInstanceRecordSize)
+            << quint32(instanceIds.size());
+        for (int i = 0; i < instanceIds.size(); ++i) {
+            out << qint32(instanceIds[i]) << qint32(store.instanceSymbols()[i]);
+        }
+    }
+
+    if (tracker.isCancelled()) {
+        file.cancelWriting();
+        setError(errorMessage, kCancelledMessage);
+        return false;
+    }
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        setError(errorMessage, "Ошибка записи файла");
+        return false;
+    }
+    return true;
+}
+
+bool loadBinary(const QString &fileName, Diagram &diagram, QString *errorMessage,
+                const ProgressCallback &progress) {
+    PROFILE_SCOPE("loadBinary");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для чтения");
+        return false;
+    }
+    // Файл отображается в память и разбирается на месте, без копирования в буфер
+    const qint64 size = file.size();
+    if (uchar *data = size > 0 ? file.map(0, size) : nullptr) {
+        const bool ok = parseBinary(data, size, diagram, errorMessage, progress);
+        file.unmap(data);
+        return ok;
+    }
+    return readBinaryStream(&file, diagram, errorMessage, progress);
+}
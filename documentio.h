@@ -0,0 +1,67 @@
+// documentio.h
+
+#ifndef DOCUMENTIO_H
+#define DOCUMENTIO_H
+
+#include <QString>
+#include <functional>
+
+#include "diagram.h"
+
+// Форматы файлов документа
+enum class DocumentFormat {
+    Text,    // Построчный текстовый формат (*.txt)
+    Binary,  // Версионный двоичный формат (*.dgm)
+    Paged,   // Страничный формат для очень больших документов (*.dgp), см. PagedDocument
+    Chunked  // Документ из кусков с быстрым повторным сохранением (*.dgc), см. ChunkedDocument
+};
+
+// Отчет о ходе чтения или записи в процентах; вернув false, вызывающий
+// прерывает операцию. Может вызываться из нескольких потоков одновременно.
+using ProgressCallback = std::function<bool(int percent)>;
+
+// Замечания к содержимому текстового файла, найденные при разборе.
+// Файл при этом все равно загружается: такие строки пропускаются.
+struct LoadReport {
+    int malformedLines = 0;        // Строки, не похожие на запись фигуры или связи
+    int danglingConnections = 0;   // Конец связи не совпадает с центром ни одной фигуры
+    int rejectedConnections = 0;   // Петли и повторы, которые граф не принял
+    int missingLines = 0;          // Строк меньше, чем объявлено в заголовке
+    int firstMalformedLine = 0;    // Номер строки (с 1) первого замечания или 0
+    int firstDanglingLine = 0;
+
+    bool isClean() const {
+        return malformedLines == 0 && danglingConnections == 0 && rejectedConnections == 0 && missingLines == 0;
+    }
+};
+
+// Формат определяется по расширению файла
+DocumentFormat formatForFile(const QString &fileName);
+
+// Сохранение и загрузка в формате, выбранном по расширению.
+// При ошибке или отмене возвращают false и описание в errorMessage;
+// при загрузке diagram в этом случае не меняется. Отчет report
+// заполняется только для текстового формата.
+bool saveDocument(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+                  const ProgressCallback &progress = ProgressCallback());
+bool loadDocument(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr,
+                  const ProgressCallback &progress = ProgressCallback(), LoadReport *report = nullptr);
+
+// Текстовый формат. Строки фигур и связей разбираются параллельно,
+// кусками, прямо из отображенного в память файла. Определения символов
+// записываются блоком после связей.
+bool saveText(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+              const ProgressCallback &progress = ProgressCallback());
+bool loadText(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr,
+              const ProgressCallback &progress = ProgressCallback(), LoadReport *report = nullptr);
+
+// Двоичный формат: заголовок (магическое число, версия) и секции
+// "тег + длина + данные" для символов, фигур, связей и номеров символов
+// экземпляров. Неизвестные секции
+// пропускаются по длине, поэтому старые версии читают новые файлы.
+bool saveBinary(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+                const ProgressCallback &progress = ProgressCallback());
+bool loadBinary(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr,
+                const ProgressCallback &progress = ProgressCallback());
+
+#endif // DOCUMENTIO_H
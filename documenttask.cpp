@@ -0,0 +1,82 @@
+#include "documenttask.h"
+
+#include <QtConcurrent>
+
+#include "documentio.h"
+#include "vectorexport.h"
+
+DocumentTask::DocumentTask(const QString &fileName, bool loading, const Diagram &snapshot, QObject *parent)
+    : QObject(parent), file(fileName), loading(loading), exporting(false), chunked(nullptr), diagram(snapshot),
+      ok(false), cancelled(false), lastPercent(-1) {
+    connect(&watcher, &QFutureWatcher<bool>::finished, this, [this]() {
+        ok = watcher.result();
+        emit finished();
+    });
+}
+
+DocumentTask *DocumentTask::load(const QString &fileName, QObject *parent, ChunkedDocument *chunked) {
+    DocumentTask *task = new DocumentTask(fileName, true, Diagram(), parent);
+    task->chunked = chunked;
+    task->start();
+    return task;
+}
+
+DocumentTask *DocumentTask::save(const QString &fileName, const Diagram &snapshot, QObject *parent,
+                                 ChunkedDocument *chunked) {
+    DocumentTask *task = new DocumentTask(fileName, false, snapshot, parent);
+    task->chunked = chunked;
+    task->start();
+    return task;
+}
+
+DocumentTask *DocumentTask::exportVector(const QString &fileName, const Diagram &snapshot, QObject *parent) {
+    DocumentTask *task = new DocumentTask(fileName, false, snapshot, parent);
+    task->exporting = true;
+    task->start();
+    return task;
+}
+
+DocumentTask::~DocumentTask() {
+    // Рабочий поток обращается к полям задачи, поэтому дожидаемся его
+    cancel();
+    watcher.waitForFinished();
+}
+
+void DocumentTask::start() {
+    // Рабочий поток пишет только в diagram и error; до сигнала finished
+    // главный поток их не читает
+    watcher.setFuture(QtConcurrent::run([this]() {
+        const ProgressCallback progress = [this](int percent) { return reportProgress(percent); };
+        if (exporting) {
+            return ::exportVector(file, diagram, &error, progress);
+        }
+        if (chunked && formatForFile(file) == DocumentFormat::Chunked) {
+            return loading ? chunked->load(file, diagram, &error, progress)
+                           : chunked->save(file, diagram, &error, progress);
+        }
+        return loading ? loadDocument(file, diagram, &error, progress)
+                       : saveDocument(file, diagram, &error, progress);
+    }));
+}
+
+bool DocumentTask::reportProgress(int percent) {
+    // Сигнал отправляется только при смене процента, чтобы не засорять очередь событий
+    int previous = lastPercent.load();
+    while (percent > previous) {
+        if (lastPercent.compare_exchange_weak(previous, percent)) {
+            emit progressChanged(percent);
+            break;
+        }
+    }
+    return !cancelled;
+}
+
+void DocumentTask::cancel() {
+    cancelled = true;
+}
+
+Diagram DocumentTask::takeDiagram() {
+    Diagram result;
+    std::swap(result, diagram);
+    return result;
+}
@@ -0,0 +1,73 @@
+// documenttask.h
+
+#ifndef DOCUMENTTASK_H
+#define DOCUMENTTASK_H
+
+#include <QObject>
+#include <QString>
+#include <QFutureWatcher>
+
+#include <atomic>
+
+#include "chunkeddocument.h"
+#include "diagram.h"
+
+// Загрузка, сохранение или векторный экспорт документа в пуле потоков.
+// Окно не блокируется: ход операции приходит сигналом progressChanged,
+// результат - сигналом finished. Загруженная диаграмма (вместе с сеткой
+// и графом связей) полностью строится в рабочем потоке и забирается
+// одним присваиванием через takeDiagram().
+class DocumentTask : public QObject {
+    Q_OBJECT
+
+public:
+    // Запуск загрузки файла. Документ из кусков (*.dgc) читается через chunked,
+    // если он задан: тот запоминает оглавление для следующих сохранений.
+    // До сигнала finished вызывающий не трогает chunked.
+    static DocumentTask *load(const QString &fileName, QObject *parent = nullptr,
+                              ChunkedDocument *chunked = nullptr);
+    // Запуск сохранения; снимок документа копируется дешево
+    // (контейнеры Qt разделяются до первого изменения). Документ из кусков
+    // пишется через chunked: переписываются только измененные куски.
+    static DocumentTask *save(const QString &fileName, const Diagram &snapshot, QObject *parent = nullptr,
+                              ChunkedDocument *chunked = nullptr);
+    // Запуск экспорта в SVG или PDF (по расширению)
+    static DocumentTask *exportVector(const QString &fileName, const Diagram &snapshot, QObject *parent = nullptr);
+
+    ~DocumentTask();
+
+    bool isLoading() const { return loading; }
+    bool isExporting() const { return exporting; }
+    QString fileName() const { return file; }
+    bool succeeded() const { return ok; }
+    QString errorMessage() const { return error; }
+    Diagram takeDiagram();
+
+public slots:
+    // Просьба прервать операцию; finished все равно будет отправлен
+    void cancel();
+
+signals:
+    void progressChanged(int percent);
+    void finished();
+
+private:
+    // Снимок строится конструктором копирования: он сохраняет линию версий
+    // документа, и сохранение из кусков остается инкрементальным
+    DocumentTask(const QString &fileName, bool loading, const Diagram &snapshot, QObject *parent);
+    void start();
+    bool reportProgress(int percent);
+
+    QString file;
+    bool loading;
+    bool exporting;
+    ChunkedDocument *chunked;
+    Diagram diagram;
+    bool ok;
+    QString error;
+    std::atomic<bool> cancelled;
+    std::atomic<int> lastPercent;
+    QFutureWatcher<bool> watcher;
+};
+
+#endif // DOCUMENTTASK_H
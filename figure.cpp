@@ -0,0 +1,19 @@
+#include "figure.h"
+
+QDataStream &operator<<(QDataStream &out, const Figure &figure) {
+    // Запись id, типа фигуры и координат углов; operator>> читает поля в том же порядке
+    out << qint32(figure.id) << qint32(figure.shape)
+        << qint32(figure.rect.left()) << qint32(figure.rect.top())
+        << qint32(figure.rect.right()) << qint32(figure.rect.bottom());
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Figure &figure) {
+    // Чтение фигуры из потока данных
+    qint32 id = 0, shape = 0, left = 0, top = 0, right = 0, bottom = 0;
+    in >> id >> shape >> left >> top >> right >> bottom;
+    figure.id = id;
+    figure.shape = static_cast<Shape>(shape);
+    figure.rect.setCoords(left, top, right, bottom);
+    return in;
+}
@@ -0,0 +1,31 @@
+// figure.h
+
+#ifndef FIGURE_H
+#define FIGURE_H
+
+#include <QRect>
+#include <QDataStream>
+
+// Перечисление форм. Instance - экземпляр символа (см. SymbolLibrary)
+enum Shape { None, Rectangle, Triangle, Ellipse, Line, Move, Delete, Connect, Instance };
+
+// Структура, представляющая фигуру
+struct Figure {
+    int id;       // Постоянный идентификатор; больший id лежит выше по оси Z
+    Shape shape;
+    QRect rect;   // У экземпляра - габарит символа, сдвинутый в место вставки
+    int symbol = -1;  // Номер символа экземпляра, у остальных фигур -1
+
+    // Оператор сравнения
+    bool operator==(const Figure &other) const {
+        return id == other.id && shape == other.shape && rect == other.rect && symbol == other.symbol;
+    }
+};
+
+// Перегрузка операторов потокового ввода/вывода для структуры Figure.
+// Записываются id, форма и прямоугольник (запись фиксированной длины);
+// номер символа экземпляра форматы хранят отдельно
+QDataStream &operator<<(QDataStream &out, const Figure &figure);
+QDataStream &operator>>(QDataStream &in, Figure &figure);
+
+#endif // FIGURE_H
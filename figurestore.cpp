@@ -0,0 +1,135 @@
+#include "figurestore.h"
+
+#include <algorithm>
+
+void FigureStore::appendTriangleOutline(QVector<QLine> &lines, const QRect &rect) {
+    // Те же вершины, что у многоугольника в SceneRenderer::drawFigure
+    const QPoint left(rect.left(), rect.bottom());
+    const QPoint right(rect.right(), rect.bottom());
+    const QPoint top(rect.center().x(), rect.top());
+    lines.append(QLine(left, right));
+    lines.append(QLine(right, top));
+    lines.append(QLine(top, left));
+}
+
+int FigureStore::slotOf(const Group &group, int id) const {
+    auto it = std::lower_bound(group.ids.constBegin(), group.ids.constEnd(), id);
+    if (it == group.ids.constEnd() || *it != id) {
+        return -1;
+    }
+    return int(it - group.ids.constBegin());
+}
+
+void FigureStore::insert(const Figure &figure) {
+    if (!isStored(figure.shape)) {
+        return;
+    }
+    Group &g = group(figure.shape);
+    // Новые фигуры получают наибольший id, поэтому обычно просто дописываются в конец
+    const int slot = int(std::lower_bound(g.ids.constBegin(), g.ids.constEnd(), figure.id) - g.ids.constBegin());
+    g.ids.insert(slot, figure.id);
+    g.rects.insert(slot, figure.rect);
+
+    if (figure.shape == Triangle) {
+        QVector<QLine> outline;
+        appendTriangleOutline(outline, figure.rect);
+        for (int i = 0; i < 3; ++i) {
+            triangleLines.insert(slot * 3 + i, outline[i]);
+        }
+    } else if (figure.shape == Instance) {
+        symbols.insert(slot, figure.symbol);
+    }
+}
+
+void FigureStore::remove(Shape shape, int id) {
+    if (!isStored(shape)) {
+        return;
+    }
+    Group &g = group(shape);
+    const int slot = slotOf(g, id);
+    if (slot == -1) {
+        return;
+    }
+    // Удаление со сдвигом сохраняет порядок по оси Z внутри типа
+    g.ids.remove(slot);
+    g.rects.remove(slot);
+    if (shape == Triangle) {
+        triangleLines.remove(slot * 3, 3);
+    } else if (shape == Instance) {
+        symbols.remove(slot);
+    }
+}
+
+void FigureStore::removeAll(const QVector<int> &sortedIds) {
+    for (int g = 0; g < kGroupCount; ++g) {
+        Group &group = groups[g];
+        const bool triangles = g == groupIndex(Triangle);
+        const bool instances = g == kInstanceGroup;
+        // Оба списка отсортированы, поэтому достаточно одного совместного прохода
+        int kept = 0;
+        auto removed = sortedIds.constBegin();
+        for (int i = 0; i < group.ids.size(); ++i) {
+            const int id = group.ids[i];
+            removed = std::lower_bound(removed, sortedIds.constEnd(), id);
+            if (removed != sortedIds.constEnd() && *removed == id) {
+                continue;
+            }
+            if (kept != i) {
+                group.ids[kept] = id;
+                group.rects[kept] = group.rects[i];
+                if (triangles) {
+                    std::copy(triangleLines.constBegin() + 3 * i, triangleLines.constBegin() + 3 * i + 3,
+                              triangleLines.begin() + 3 * kept);
+                }
+                if (instances) {
+                    symbols[kept] = symbols[i];
+                }
+            }
+            ++kept;
+        }
+        group.ids.resize(kept);
+        group.rects.resize(kept);
+        if (triangles) {
+            triangleLines.resize(3 * kept);
+        }
+        if (instances) {
+            symbols.resize(kept);
+        }
+    }
+}
+
+void FigureStore::setRect(Shape shape, int id, const QRect &rect) {
+    if (!isStored(shape)) {
+        return;
+    }
+    Group &g = group(shape);
+    const int slot = slotOf(g, id);
+    if (slot == -1) {
+        return;
+    }
+    g.rects[slot] = rect;
+    if (shape == Triangle) {
+        QVector<QLine> outline;
+        appendTriangleOutline(outline, rect);
+        std::copy(outline.constBegin(), outline.constEnd(), triangleLines.begin() + slot * 3);
+    }
+}
+
+void FigureStore::clear() {
+    for (Group &g : groups) {
+        g.ids.clear();
+        g.rects.clear();
+    }
+    triangleLines.clear();
+    symbols.clear();
+}
+
+const QVector<int> &FigureStore::ids(Shape shape) const {
+    static const QVector<int> empty;
+    return isStored(shape) ? group(shape).ids : empty;
+}
+
+const QVector<QRect> &FigureStore::rects(Shape shape) const {
+    static const QVector<QRect> empty;
+    return isStored(shape) ? group(shape).rects : empty;
+}
@@ -0,0 +1,56 @@
+// figurestore.h
+
+#ifndef FIGURESTORE_H
+#define FIGURESTORE_H
+
+#include <QRect>
+#include <QLine>
+#include <QVector>
+
+#include "figure.h"
+
+// Прямоугольники фигур, разложенные по типам в непрерывные массивы.
+// Внутри каждого типа фигуры идут по возрастанию id, то есть в порядке по оси Z.
+// Для треугольников заранее построены контуры (по три отрезка на фигуру),
+// поэтому отрисовка передает в QPainter целые массивы одним вызовом.
+// Экземпляры символов хранятся отдельной группой с параллельным массивом номеров символов.
+class FigureStore {
+public:
+    void insert(const Figure &figure);
+    void remove(Shape shape, int id);
+    // Удаление группы фигур одним проходом уплотнения; ids отсортированы
+    void removeAll(const QVector<int> &sortedIds);
+    void setRect(Shape shape, int id, const QRect &rect);
+    void clear();
+
+    // Id и прямоугольники фигур одного типа; массивы параллельны
+    const QVector<int> &ids(Shape shape) const;
+    const QVector<QRect> &rects(Shape shape) const;
+    // Контуры треугольников: отрезки 3*i .. 3*i+2 принадлежат фигуре ids(Triangle)[i]
+    const QVector<QLine> &triangleOutlines() const { return triangleLines; }
+    // Номера символов экземпляров, параллельно ids(Instance)
+    const QVector<int> &instanceSymbols() const { return symbols; }
+
+    static bool isStored(Shape shape) { return (shape >= Rectangle && shape <= Ellipse) || shape == Instance; }
+    static void appendTriangleOutline(QVector<QLine> &lines, const QRect &rect);
+
+private:
+    struct Group {
+        QVector<int> ids;
+        QVector<QRect> rects;
+    };
+
+    static const int kGroupCount = 4;
+    static const int kInstanceGroup = 3;
+
+    Group groups[kGroupCount];
+    QVector<QLine> triangleLines;
+    QVector<int> symbols;
+
+    static int groupIndex(Shape shape) { return shape == Instance ? kInstanceGroup : shape - Rectangle; }
+    const Group &group(Shape shape) const { return groups[groupIndex(shape)]; }
+    Group &group(Shape shape) { return groups[groupIndex(shape)]; }
+    int slotOf(const Group &group, int id) const;
+};
+
+#endif // FIGURESTORE_H
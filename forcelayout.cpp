@@ -0,0 +1,165 @@
+#include "forcelayout.h"
+
+#include <QHash>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include "profiler.h"
+
+namespace {
+// Вершин на одну задачу пула потоков
+const int kNodesPerChunk = 1024;
+const int kMaxIterations = 500;
+// Укладка останавливается, когда вершины почти не двигаются
+const qreal kMinShift = 0.5;
+const qreal kCooling = 0.95;
+// Слабое притяжение к общему центру не дает несвязанным частям разлетаться
+const qreal kGravity = 0.02;
+
+struct NodeChunk {
+    int begin;
+    int end;
+};
+
+quint64 packCell(int cx, int cy) {
+    return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+}
+
+ForceLayout::ForceLayout(const Diagram &diagram)
+    : idealLength(40), temperature(0), iterations(0), lastShift(-1) {
+    const QVector<Figure> &figures = diagram.figures();
+    const int count = figures.size();
+    figureIds.reserve(count);
+    pos.reserve(count);
+
+    // Идеальная длина связи зависит от среднего размера фигур
+    qreal sizeSum = 0;
+    QHash<int, int> indexById;
+    indexById.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        const QRect rect = figures[i].rect.normalized();
+        figureIds.append(figures[i].id);
+        pos.append(QPointF(rect.center()));
+        indexById.insert(figures[i].id, i);
+        sizeSum += qMax(rect.width(), rect.height());
+    }
+    if (count > 0) {
+        idealLength = qMax<qreal>(idealLength, 2 * sizeSum / count);
+    }
+    disp.resize(count);
+
+    offsets.reserve(count + 1);
+    offsets.append(0);
+    for (int i = 0; i < count; ++i) {
+        for (int other : diagram.graph().neighbors(figureIds[i])) {
+            adjacency.append(indexById.value(other));
+        }
+        offsets.append(adjacency.size());
+    }
+
+    // Начальная температура ограничивает шаг вершины и со временем остывает
+    temperature = idealLength * qMax<qreal>(1, 0.1 * qSqrt(qreal(count)));
+}
+
+bool ForceLayout::isFinished() const {
+    return figureIds.size() < 2 || iterations >= kMaxIterations
+        || (lastShift >= 0 && lastShift < kMinShift);
+}
+
+quint64 ForceLayout::cellOf(const QPointF &point) const {
+    const qreal cellSize = 2 * idealLength;
+    return packCell(qFloor(point.x() / cellSize), qFloor(point.y() / cellSize));
+}
+
+void ForceLayout::computeForces(int begin, int end, const QHash<quint64, QVector<int>> &grid,
+                                const QPointF &centroid) {
+    const qreal k = idealLength;
+    const qreal k2 = k * k;
+    const qreal reach2 = 4 * k2;
+    const qreal cellSize = 2 * k;
+
+    for (int i = begin; i < end; ++i) {
+        const QPointF p = pos[i];
+        QPointF force;
+
+        // Отталкивание k^2 / d от вершин из соседних ячеек в радиусе 2k
+        const int cx = qFloor(p.x() / cellSize);
+        const int cy = qFloor(p.y() / cellSize);
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                auto it = grid.constFind(packCell(cx + dx, cy + dy));
+                if (it == grid.constEnd()) {
+                    continue;
+                }
+                for (int j : it.value()) {
+                    if (j == i) {
+                        continue;
+                    }
+                    QPointF delta = p - pos[j];
+                    qreal d2 = QPointF::dotProduct(delta, delta);
+                    if (d2 > reach2) {
+                        continue;
+                    }
+                    if (d2 < 0.01) {
+                        // Совпавшие вершины разводятся в детерминированном направлении
+                        const qreal angle = (quint32(i) * 7919u + quint32(j) * 104729u) % 360u * M_PI / 180;
+                        delta = QPointF(qCos(angle), qSin(angle)) * 0.1;
+                        d2 = 0.01;
+                    }
+                    force += delta * (k2 / d2);
+                }
+            }
+        }
+
+        // Притяжение d^2 / k вдоль связей
+        for (int n = offsets[i]; n < offsets[i + 1]; ++n) {
+            const QPointF delta = pos[adjacency[n]] - p;
+            force += delta * (qSqrt(QPointF::dotProduct(delta, delta)) / k);
+        }
+
+        force += (centroid - p) * kGravity;
+        disp[i] = force;
+    }
+}
+
+qreal ForceLayout::step() {
+    PROFILE_SCOPE("ForceLayout::step");
+    if (isFinished()) {
+        return 0;
+    }
+    const int count = pos.size();
+
+    // Сетка для отталкивания строится заново: вершины сдвинулись
+    QHash<quint64, QVector<int>> grid;
+    QPointF centroid;
+    for (int i = 0; i < count; ++i) {
+        grid[cellOf(pos[i])].append(i);
+        centroid += pos[i];
+    }
+    centroid /= count;
+
+    // Каждая задача пишет только смещения своих вершин, поэтому блокировки не нужны
+    QVector<NodeChunk> chunks;
+    for (int begin = 0; begin < count; begin += kNodesPerChunk) {
+        chunks.append({ begin, qMin(begin + kNodesPerChunk, count) });
+    }
+    QtConcurrent::blockingMap(chunks, [&](const NodeChunk &chunk) {
+        computeForces(chunk.begin, chunk.end, grid, centroid);
+    });
+
+    // Смещение ограничено температурой
+    qreal maxShift = 0;
+    for (int i = 0; i < count; ++i) {
+        const qreal length = qSqrt(QPointF::dotProduct(disp[i], disp[i]));
+        if (length > 0) {
+            const qreal shift = qMin(length, temperature);
+            pos[i] += disp[i] * (shift / length);
+            maxShift = qMax(maxShift, shift);
+        }
+    }
+    temperature *= kCooling;
+    ++iterations;
+    lastShift = maxShift;
+    return maxShift;
+}
@@ -0,0 +1,46 @@
+// forcelayout.h
+
+#ifndef FORCELAYOUT_H
+#define FORCELAYOUT_H
+
+#include <QPointF>
+#include <QVector>
+
+#include "diagram.h"
+
+// Силовая укладка графа связей (алгоритм Фрюхтермана - Рейнгольда).
+// Связанные фигуры притягиваются, все фигуры отталкиваются друг от друга.
+// Отталкивание считается только между соседями по равномерной сетке
+// с шагом в две идеальные длины связи, поэтому шаг стоит O(V + E), а не O(V^2).
+// Силы для вершин считаются параллельно в пуле потоков.
+class ForceLayout {
+public:
+    // Снимок фигур и связей документа; сам документ после этого не нужен
+    explicit ForceLayout(const Diagram &diagram);
+
+    // Одна итерация; возвращает наибольшее смещение вершины
+    qreal step();
+    bool isFinished() const;
+
+    // Id фигур и текущие положения их центров; векторы параллельны
+    const QVector<int> &ids() const { return figureIds; }
+    const QVector<QPointF> &positions() const { return pos; }
+
+private:
+    QVector<int> figureIds;
+    QVector<QPointF> pos;
+    QVector<QPointF> disp;
+    // Списки соседей в сжатом виде: соседи вершины i - adjacency[offsets[i] .. offsets[i+1])
+    QVector<int> offsets;
+    QVector<int> adjacency;
+
+    qreal idealLength;
+    qreal temperature;
+    int iterations;
+    qreal lastShift;
+
+    void computeForces(int begin, int end, const QHash<quint64, QVector<int>> &grid, const QPointF &centroid);
+    quint64 cellOf(const QPointF &point) const;
+};
+
+#endif // FORCELAYOUT_H
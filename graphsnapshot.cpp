@@ -0,0 +1,191 @@
+#include "graphsnapshot.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+#include "profiler.h"
+
+GraphSnapshot::GraphSnapshot(const Diagram &diagram) : sourceRevision(diagram.revision()) {
+    PROFILE_SCOPE("GraphSnapshot::build");
+    const QVector<Figure> &figures = diagram.figures();
+    const int count = figures.size();
+    figureIds.reserve(count);
+    centers.reserve(count);
+    for (const Figure &figure : figures) {
+        figureIds.append(figure.id);
+        centers.append(QPointF(figure.rect.center()));
+    }
+
+    // Два прохода по ребрам: подсчет степеней, затем раскладка соседей по местам
+    QVector<int> degrees(count, 0);
+    QVector<std::pair<int, int>> edges;
+    edges.reserve(diagram.connectionCount());
+    diagram.graph().forEachEdge([&](int from, int to) {
+        const int a = indexOf(from);
+        const int b = indexOf(to);
+        edges.append({ a, b });
+        ++degrees[a];
+        ++degrees[b];
+    });
+
+    offsets.resize(count + 1);
+    offsets[0] = 0;
+    for (int i = 0; i < count; ++i) {
+        offsets[i + 1] = offsets[i] + degrees[i];
+    }
+    targets.resize(offsets[count]);
+    QVector<int> fill = offsets;
+    for (const auto &edge : edges) {
+        targets[fill[edge.first]++] = edge.second;
+        targets[fill[edge.second]++] = edge.first;
+    }
+}
+
+int GraphSnapshot::indexOf(int id) const {
+    auto it = std::lower_bound(figureIds.constBegin(), figureIds.constEnd(), id);
+    if (it == figureIds.constEnd() || *it != id) {
+        return -1;
+    }
+    return int(it - figureIds.constBegin());
+}
+
+QVector<int> GraphSnapshot::components(int *count) const {
+    const int n = nodeCount();
+    QVector<int> label(n, -1);
+    QVector<int> queue;
+    queue.reserve(n);
+    int next = 0;
+    for (int start = 0; start < n; ++start) {
+        if (label[start] != -1) {
+            continue;
+        }
+        // Обход в ширину с очередью на плоском массиве
+        label[start] = next;
+        queue.clear();
+        queue.append(start);
+        for (int head = 0; head < queue.size(); ++head) {
+            const int node = queue[head];
+            for (int e = offsets[node]; e < offsets[node + 1]; ++e) {
+                const int other = targets[e];
+                if (label[other] == -1) {
+                    label[other] = next;
+                    queue.append(other);
+                }
+            }
+        }
+        ++next;
+    }
+    if (count) {
+        *count = next;
+    }
+    return label;
+}
+
+QVector<int> GraphSnapshot::reachableFrom(const QVector<int> &seeds) const {
+    QVector<char> visited(nodeCount(), 0);
+    QVector<int> queue;
+    for (int id : seeds) {
+        const int index = indexOf(id);
+        if (index != -1 && !visited[index]) {
+            visited[index] = 1;
+            queue.append(index);
+        }
+    }
+    for (int head = 0; head < queue.size(); ++head) {
+        const int node = queue[head];
+        for (int e = offsets[node]; e < offsets[node + 1]; ++e) {
+            const int other = targets[e];
+            if (!visited[other]) {
+                visited[other] = 1;
+                queue.append(other);
+            }
+        }
+    }
+
+    // Проход по флагам сразу дает id по возрастанию
+    QVector<int> result;
+    result.reserve(queue.size());
+    for (int i = 0; i < visited.size(); ++i) {
+        if (visited[i]) {
+            result.append(figureIds[i]);
+        }
+    }
+    return result;
+}
+
+QVector<int> GraphSnapshot::tracePath(const QVector<int> &parent, int from, int to) const {
+    QVector<int> path;
+    for (int node = to; node != -1; node = node == from ? -1 : parent[node]) {
+        path.append(figureIds[node]);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+QVector<int> GraphSnapshot::shortestHops(int from, int to) const {
+    const int source = indexOf(from);
+    const int target = indexOf(to);
+    if (source == -1 || target == -1) {
+        return QVector<int>();
+    }
+    QVector<int> parent(nodeCount(), -1);
+    parent[source] = source;
+    QVector<int> queue;
+    queue.append(source);
+    // Обход останавливается, как только найдена цель
+    for (int head = 0; head < queue.size() && parent[target] == -1; ++head) {
+        const int node = queue[head];
+        for (int e = offsets[node]; e < offsets[node + 1]; ++e) {
+            const int other = targets[e];
+            if (parent[other] == -1) {
+                parent[other] = node;
+                queue.append(other);
+            }
+        }
+    }
+    return parent[target] == -1 ? QVector<int>() : tracePath(parent, source, target);
+}
+
+QVector<int> GraphSnapshot::shortestPath(int from, int to) const {
+    const int source = indexOf(from);
+    const int target = indexOf(to);
+    if (source == -1 || target == -1) {
+        return QVector<int>();
+    }
+    QVector<qreal> distance(nodeCount(), std::numeric_limits<qreal>::infinity());
+    QVector<int> parent(nodeCount(), -1);
+    using Entry = std::pair<qreal, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+    distance[source] = 0;
+    parent[source] = source;
+    heap.push({ 0, source });
+    while (!heap.empty()) {
+        const Entry top = heap.top();
+        heap.pop();
+        const int node = top.second;
+        // Устаревшие записи кучи пропускаются вместо уменьшения ключа
+        if (top.first > distance[node]) {
+            continue;
+        }
+        if (node == target) {
+            break;
+        }
+        for (int e = offsets[node]; e < offsets[node + 1]; ++e) {
+            const int other = targets[e];
+            const QPointF delta = centers[other] - centers[node];
+            const qreal candidate = top.first + qSqrt(QPointF::dotProduct(delta, delta));
+            if (candidate < distance[other]) {
+                distance[other] = candidate;
+                parent[other] = node;
+                heap.push({ candidate, other });
+            }
+        }
+    }
+    return parent[target] == -1 ? QVector<int>() : tracePath(parent, source, target);
+}
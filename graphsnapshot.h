@@ -0,0 +1,45 @@
+// graphsnapshot.h
+
+#ifndef GRAPHSNAPSHOT_H
+#define GRAPHSNAPSHOT_H
+
+#include <QVector>
+
+#include "diagram.h"
+
+// Неизменяемый снимок графа связей в сжатом виде (CSR): соседи вершины i
+// лежат подряд в targets[offsets[i] .. offsets[i+1]). Вершины нумеруются
+// по порядку фигур в документе, поэтому все обходы работают с плоскими
+// массивами, а не с хэшами и множествами.
+// Методы принимают и возвращают id фигур.
+class GraphSnapshot {
+public:
+    explicit GraphSnapshot(const Diagram &diagram);
+
+    int nodeCount() const { return figureIds.size(); }
+    int edgeCount() const { return targets.size() / 2; }
+    // Ревизия документа, с которого снят снимок
+    quint64 revision() const { return sourceRevision; }
+
+    // Номер компоненты связности для каждой фигуры (в порядке figures());
+    // количество компонент возвращается через count
+    QVector<int> components(int *count = nullptr) const;
+    // Все фигуры, достижимые из любой из seeds (включая сами seeds), по возрастанию id
+    QVector<int> reachableFrom(const QVector<int> &seeds) const;
+    // Кратчайший путь по числу связей (обход в ширину); id от from до to или пусто
+    QVector<int> shortestHops(int from, int to) const;
+    // Кратчайший путь по суммарной длине связей между центрами (Дейкстра)
+    QVector<int> shortestPath(int from, int to) const;
+
+private:
+    QVector<int> figureIds;   // Id вершин по возрастанию
+    QVector<QPointF> centers; // Центры фигур для длин связей
+    QVector<int> offsets;
+    QVector<int> targets;
+    quint64 sourceRevision;
+
+    int indexOf(int id) const;
+    QVector<int> tracePath(const QVector<int> &parent, int from, int to) const;
+};
+
+#endif // GRAPHSNAPSHOT_H
@@ -0,0 +1,270 @@
+#include "hittest.h"
+
+#include <QtGlobal>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIAGRAM_HIT_SSE2
+#endif
+
+namespace {
+
+// Проверки одной фигуры. Пакетные версии ниже повторяют те же операции
+// в том же порядке, поэтому дают те же ответы до последнего бита.
+
+bool pointHit(float l, float t, float r, float b, qint32 shape, float px, float py) {
+    const float x0 = qMin(l, r);
+    const float x1 = qMax(l, r);
+    const float y0 = qMin(t, b);
+    const float y1 = qMax(t, b);
+    if (!(px >= x0 && px <= x1 && py >= y0 && py <= y1)) {
+        return false;
+    }
+    const float cx = (l + r) * 0.5f;
+    const float cy = (t + b) * 0.5f;
+    switch (shape) {
+    case Rectangle:
+        return true;
+    case Ellipse: {
+        // Полуоси на полпикселя больше: эллипс вписан в прямоугольник шириной width()
+        const float dx = (px - cx) / ((x1 - x0) * 0.5f + 0.5f);
+        const float dy = (py - cy) / ((y1 - y0) * 0.5f + 0.5f);
+        return dx * dx + dy * dy <= 1.0f;
+    }
+    case Triangle: {
+        // Вершины (l, b), (r, b), (cx, t); точка внутри, если она по одну
+        // сторону от всех трех ребер (при любом обходе вершин)
+        const float d1 = (r - l) * (py - b);
+        const float d2 = (cx - r) * (py - b) - (t - b) * (px - r);
+        const float d3 = (l - cx) * (py - t) - (b - t) * (px - cx);
+        return qMin(d1, qMin(d2, d3)) >= 0.0f || qMax(d1, qMax(d2, d3)) <= 0.0f;
+    }
+    default:
+        return false;
+    }
+}
+
+// Разделяет ли ось n проекции треугольника [p, q] и прямоугольника
+bool separated(float nx, float ny, float p, float q, float ax0, float ay0, float ax1, float ay1) {
+    const float areaMin = qMin(nx * ax0, nx * ax1) + qMin(ny * ay0, ny * ay1);
+    const float areaMax = qMax(nx * ax0, nx * ax1) + qMax(ny * ay0, ny * ay1);
+    return areaMax < qMin(p, q) || areaMin > qMax(p, q);
+}
+
+bool rectHit(float l, float t, float r, float b, qint32 shape, float ax0, float ay0, float ax1, float ay1) {
+    const float x0 = qMin(l, r);
+    const float x1 = qMax(l, r);
+    const float y0 = qMin(t, b);
+    const float y1 = qMax(t, b);
+    if (!(x1 >= ax0 && x0 <= ax1 && y1 >= ay0 && y0 <= ay1)) {
+        return false;
+    }
+    const float cx = (l + r) * 0.5f;
+    const float cy = (t + b) * 0.5f;
+    switch (shape) {
+    case Rectangle:
+        return true;
+    case Ellipse: {
+        // Ближайшая к центру точка области; покоординатное ограничение
+        // дает ее и после сжатия эллипса в круг
+        const float dx = (qMin(qMax(cx, ax0), ax1) - cx) / ((x1 - x0) * 0.5f + 0.5f);
+        const float dy = (qMin(qMax(cy, ay0), ay1) - cy) / ((y1 - y0) * 0.5f + 0.5f);
+        return dx * dx + dy * dy <= 1.0f;
+    }
+    case Triangle: {
+        // Теорема о разделяющей оси: оси x и y уже проверены габаритами,
+        // остаются нормали двух наклонных ребер
+        const float n1x = b - t;
+        const float n1y = cx - r;
+        const float n2x = t - b;
+        const float n2y = l - cx;
+        return !separated(n1x, n1y, n1x * r + n1y * b, n1x * l + n1y * b, ax0, ay0, ax1, ay1)
+            && !separated(n2x, n2y, n2x * l + n2y * b, n2x * r + n2y * b, ax0, ay0, ax1, ay1);
+    }
+    default:
+        return false;
+    }
+}
+
+#ifdef DIAGRAM_HIT_SSE2
+inline __m128 shapeMask(__m128i shapes, Shape shape) {
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(shapes, _mm_set1_epi32(shape)));
+}
+
+inline __m128 selectByShape(__m128i shapes, __m128 box, __m128 ellipse, __m128 triangle) {
+    return _mm_and_ps(box, _mm_or_ps(shapeMask(shapes, Rectangle),
+                                     _mm_or_ps(_mm_and_ps(shapeMask(shapes, Ellipse), ellipse),
+                                               _mm_and_ps(shapeMask(shapes, Triangle), triangle))));
+}
+
+inline void storeMask(__m128 mask, uchar *hits) {
+    const int bits = _mm_movemask_ps(mask);
+    hits[0] = uchar(bits & 1);
+    hits[1] = uchar((bits >> 1) & 1);
+    hits[2] = uchar((bits >> 2) & 1);
+    hits[3] = uchar((bits >> 3) & 1);
+}
+
+inline __m128 separated4(__m128 nx, __m128 ny, __m128 p, __m128 q,
+                         __m128 ax0, __m128 ay0, __m128 ax1, __m128 ay1) {
+    const __m128 areaMin = _mm_add_ps(_mm_min_ps(_mm_mul_ps(nx, ax0), _mm_mul_ps(nx, ax1)),
+                                      _mm_min_ps(_mm_mul_ps(ny, ay0), _mm_mul_ps(ny, ay1)));
+    const __m128 areaMax = _mm_add_ps(_mm_max_ps(_mm_mul_ps(nx, ax0), _mm_mul_ps(nx, ax1)),
+                                      _mm_max_ps(_mm_mul_ps(ny, ay0), _mm_mul_ps(ny, ay1)));
+    return _mm_or_ps(_mm_cmplt_ps(areaMax, _mm_min_ps(p, q)), _mm_cmpgt_ps(areaMin, _mm_max_ps(p, q)));
+}
+#endif
+
+}
+
+void HitBatch::reserve(int count) {
+    ids.reserve(count);
+    shapes.reserve(count);
+    left.reserve(count);
+    top.reserve(count);
+    right.reserve(count);
+    bottom.reserve(count);
+}
+
+void HitBatch::clear() {
+    ids.clear();
+    shapes.clear();
+    left.clear();
+    top.clear();
+    right.clear();
+    bottom.clear();
+}
+
+void HitBatch::append(int id, Shape shape, const QRect &rect) {
+    ids.append(id);
+    shapes.append(shape);
+    left.append(float(rect.left()));
+    top.append(float(rect.top()));
+    right.append(float(rect.right()));
+    bottom.append(float(rect.bottom()));
+}
+
+bool shapeContains(Shape shape, const QRect &rect, const QPoint &point) {
+    return pointHit(float(rect.left()), float(rect.top()), float(rect.right()), float(rect.bottom()), shape,
+                    float(point.x()), float(point.y()));
+}
+
+bool shapeIntersects(Shape shape, const QRect &rect, const QRect &area) {
+    const QRect a = area.normalized();
+    return rectHit(float(rect.left()), float(rect.top()), float(rect.right()), float(rect.bottom()), shape,
+                   float(a.left()), float(a.top()), float(a.right()), float(a.bottom()));
+}
+
+void hitTestPoint(const HitBatch &batch, const QPoint &point, QVector<uchar> &hits) {
+    const int count = batch.size();
+    hits.resize(count);
+    const float px = float(point.x());
+    const float py = float(point.y());
+    const float *L = batch.left.constData();
+    const float *T = batch.top.constData();
+    const float *R = batch.right.constData();
+    const float *B = batch.bottom.constData();
+    const qint32 *S = batch.shapes.constData();
+    uchar *out = hits.data();
+    int i = 0;
+#ifdef DIAGRAM_HIT_SSE2
+    const __m128 px4 = _mm_set1_ps(px);
+    const __m128 py4 = _mm_set1_ps(py);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        const __m128 l = _mm_loadu_ps(L + i);
+        const __m128 t = _mm_loadu_ps(T + i);
+        const __m128 r = _mm_loadu_ps(R + i);
+        const __m128 b = _mm_loadu_ps(B + i);
+        const __m128i shapes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(S + i));
+        const __m128 x0 = _mm_min_ps(l, r);
+        const __m128 x1 = _mm_max_ps(l, r);
+        const __m128 y0 = _mm_min_ps(t, b);
+        const __m128 y1 = _mm_max_ps(t, b);
+        const __m128 box = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px4, x0), _mm_cmple_ps(px4, x1)),
+                                      _mm_and_ps(_mm_cmpge_ps(py4, y0), _mm_cmple_ps(py4, y1)));
+        const __m128 cx = _mm_mul_ps(_mm_add_ps(l, r), half);
+        const __m128 cy = _mm_mul_ps(_mm_add_ps(t, b), half);
+
+        const __m128 dx = _mm_div_ps(_mm_sub_ps(px4, cx), _mm_add_ps(_mm_mul_ps(_mm_sub_ps(x1, x0), half), half));
+        const __m128 dy = _mm_div_ps(_mm_sub_ps(py4, cy), _mm_add_ps(_mm_mul_ps(_mm_sub_ps(y1, y0), half), half));
+        const __m128 ellipse = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one);
+
+        const __m128 d1 = _mm_mul_ps(_mm_sub_ps(r, l), _mm_sub_ps(py4, b));
+        const __m128 d2 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(cx, r), _mm_sub_ps(py4, b)),
+                                     _mm_mul_ps(_mm_sub_ps(t, b), _mm_sub_ps(px4, r)));
+        const __m128 d3 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(l, cx), _mm_sub_ps(py4, t)),
+                                     _mm_mul_ps(_mm_sub_ps(b, t), _mm_sub_ps(px4, cx)));
+        const __m128 triangle = _mm_or_ps(_mm_cmpge_ps(_mm_min_ps(d1, _mm_min_ps(d2, d3)), zero),
+                                          _mm_cmple_ps(_mm_max_ps(d1, _mm_max_ps(d2, d3)), zero));
+
+        storeMask(selectByShape(shapes, box, ellipse, triangle), out + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = pointHit(L[i], T[i], R[i], B[i], S[i], px, py) ? 1 : 0;
+    }
+}
+
+void hitTestRect(const HitBatch &batch, const QRect &area, QVector<uchar> &hits) {
+    const int count = batch.size();
+    hits.resize(count);
+    const QRect a = area.normalized();
+    const float ax0 = float(a.left());
+    const float ay0 = float(a.top());
+    const float ax1 = float(a.right());
+    const float ay1 = float(a.bottom());
+    const float *L = batch.left.constData();
+    const float *T = batch.top.constData();
+    const float *R = batch.right.constData();
+    const float *B = batch.bottom.constData();
+    const qint32 *S = batch.shapes.constData();
+    uchar *out = hits.data();
+    int i = 0;
+#ifdef DIAGRAM_HIT_SSE2
+    const __m128 ax04 = _mm_set1_ps(ax0);
+    const __m128 ay04 = _mm_set1_ps(ay0);
+    const __m128 ax14 = _mm_set1_ps(ax1);
+    const __m128 ay14 = _mm_set1_ps(ay1);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4) {
+        const __m128 l = _mm_loadu_ps(L + i);
+        const __m128 t = _mm_loadu_ps(T + i);
+        const __m128 r = _mm_loadu_ps(R + i);
+        const __m128 b = _mm_loadu_ps(B + i);
+        const __m128i shapes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(S + i));
+        const __m128 x0 = _mm_min_ps(l, r);
+        const __m128 x1 = _mm_max_ps(l, r);
+        const __m128 y0 = _mm_min_ps(t, b);
+        const __m128 y1 = _mm_max_ps(t, b);
+        const __m128 box = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x1, ax04), _mm_cmple_ps(x0, ax14)),
+                                      _mm_and_ps(_mm_cmpge_ps(y1, ay04), _mm_cmple_ps(y0, ay14)));
+        const __m128 cx = _mm_mul_ps(_mm_add_ps(l, r), half);
+        const __m128 cy = _mm_mul_ps(_mm_add_ps(t, b), half);
+
+        const __m128 dx = _mm_div_ps(_mm_sub_ps(_mm_min_ps(_mm_max_ps(cx, ax04), ax14), cx),
+                                     _mm_add_ps(_mm_mul_ps(_mm_sub_ps(x1, x0), half), half));
+        const __m128 dy = _mm_div_ps(_mm_sub_ps(_mm_min_ps(_mm_max_ps(cy, ay04), ay14), cy),
+                                     _mm_add_ps(_mm_mul_ps(_mm_sub_ps(y1, y0), half), half));
+        const __m128 ellipse = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one);
+
+        const __m128 n1x = _mm_sub_ps(b, t);
+        const __m128 n1y = _mm_sub_ps(cx, r);
+        const __m128 n2x = _mm_sub_ps(t, b);
+        const __m128 n2y = _mm_sub_ps(l, cx);
+        const __m128 sep1 = separated4(n1x, n1y, _mm_add_ps(_mm_mul_ps(n1x, r), _mm_mul_ps(n1y, b)),
+                                       _mm_add_ps(_mm_mul_ps(n1x, l), _mm_mul_ps(n1y, b)), ax04, ay04, ax14, ay14);
+        const __m128 sep2 = separated4(n2x, n2y, _mm_add_ps(_mm_mul_ps(n2x, l), _mm_mul_ps(n2y, b)),
+                                       _mm_add_ps(_mm_mul_ps(n2x, r), _mm_mul_ps(n2y, b)), ax04, ay04, ax14, ay14);
+        const __m128 triangle = _mm_andnot_ps(_mm_or_ps(sep1, sep2), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+        storeMask(selectByShape(shapes, box, ellipse, triangle), out + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = rectHit(L[i], T[i], R[i], B[i], S[i], ax0, ay0, ax1, ay1) ? 1 : 0;
+    }
+}
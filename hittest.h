@@ -0,0 +1,42 @@
+// hittest.h
+
+#ifndef HITTEST_H
+#define HITTEST_H
+
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+#include "figure.h"
+
+// Точная проверка попадания в фигуру с той же геометрией, что и при
+// отрисовке: треугольник с основанием внизу прямоугольника и вершиной
+// посередине верха, эллипс, вписанный в прямоугольник.
+// Прямоугольник проверяется как QRect::contains и QRect::intersects.
+
+// Кандидаты для пакетной проверки в виде структуры массивов:
+// координаты лежат подряд, поэтому проверка идет по нескольку фигур
+// за команду SIMD без разбора каждой фигуры по отдельности
+struct HitBatch {
+    QVector<int> ids;
+    QVector<qint32> shapes;
+    QVector<float> left;     // Края как у QRect: right() и bottom() включительно
+    QVector<float> top;
+    QVector<float> right;
+    QVector<float> bottom;
+
+    int size() const { return ids.size(); }
+    void reserve(int count);
+    void clear();
+    void append(int id, Shape shape, const QRect &rect);
+};
+
+bool shapeContains(Shape shape, const QRect &rect, const QPoint &point);
+bool shapeIntersects(Shape shape, const QRect &rect, const QRect &area);
+
+// Пакетные проверки: hits[i] != 0, если точка (область) задевает фигуру i.
+// На x86 считают по четыре фигуры за раз (SSE2), иначе по одной.
+void hitTestPoint(const HitBatch &batch, const QPoint &point, QVector<uchar> &hits);
+void hitTestRect(const HitBatch &batch, const QRect &area, QVector<uchar> &hits);
+
+#endif // HITTEST_H
@@ -0,0 +1,69 @@
+#include "layouttask.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+#include "forcelayout.h"
+
+namespace {
+// Как часто промежуточные положения отправляются на холст
+const int kPublishIntervalMs = 33;
+}
+
+LayoutTask::LayoutTask(QObject *parent) : QObject(parent), pending(false), cancelled(false) {
+    connect(&watcher, &QFutureWatcher<void>::finished, this, &LayoutTask::finished);
+}
+
+LayoutTask *LayoutTask::start(const Diagram &snapshot, QObject *parent) {
+    LayoutTask *task = new LayoutTask(parent);
+    task->figureIds.reserve(snapshot.figureCount());
+    for (const Figure &figure : snapshot.figures()) {
+        task->figureIds.append(figure.id);
+    }
+    // Снимок документа копируется дешево и дальше принадлежит рабочему потоку
+    task->watcher.setFuture(QtConcurrent::run([task, snapshot]() { task->run(snapshot); }));
+    return task;
+}
+
+LayoutTask::~LayoutTask() {
+    cancel();
+    watcher.waitForFinished();
+}
+
+void LayoutTask::cancel() {
+    cancelled = true;
+}
+
+void LayoutTask::run(const Diagram &snapshot) {
+    ForceLayout layout(snapshot);
+    QElapsedTimer timer;
+    timer.start();
+    while (!cancelled && !layout.isFinished()) {
+        layout.step();
+        if (timer.elapsed() >= kPublishIntervalMs) {
+            publish(layout.positions());
+            timer.restart();
+        }
+    }
+    // Итоговые положения отправляются и при отмене: окно останавливается там, где была укладка
+    publish(layout.positions());
+}
+
+void LayoutTask::publish(const QVector<QPointF> &positions) {
+    {
+        QMutexLocker locker(&mutex);
+        latest = positions;
+    }
+    if (!pending.exchange(true)) {
+        emit positionsChanged();
+    }
+}
+
+QVector<QPointF> LayoutTask::takePositions() {
+    QMutexLocker locker(&mutex);
+    pending = false;
+    QVector<QPointF> result;
+    std::swap(result, latest);
+    return result;
+}
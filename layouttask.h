@@ -0,0 +1,52 @@
+// layouttask.h
+
+#ifndef LAYOUTTASK_H
+#define LAYOUTTASK_H
+
+#include <QObject>
+#include <QMutex>
+#include <QFutureWatcher>
+#include <QPointF>
+#include <QVector>
+
+#include <atomic>
+
+#include "diagram.h"
+
+// Автоматическая укладка документа в фоновом потоке.
+// Промежуточные положения публикуются несколько раз в секунду: сигнал
+// positionsChanged сообщает, что их можно забрать через takePositions().
+// Пока окно не забрало предыдущие положения, новый сигнал не отправляется.
+class LayoutTask : public QObject {
+    Q_OBJECT
+
+public:
+    static LayoutTask *start(const Diagram &snapshot, QObject *parent = nullptr);
+    ~LayoutTask();
+
+    // Id фигур, которые укладываются; порядок совпадает с takePositions()
+    const QVector<int> &ids() const { return figureIds; }
+    // Последние опубликованные центры фигур или пустой вектор, если новых нет
+    QVector<QPointF> takePositions();
+
+public slots:
+    void cancel();
+
+signals:
+    void positionsChanged();
+    void finished();
+
+private:
+    explicit LayoutTask(QObject *parent);
+    void run(const Diagram &snapshot);
+    void publish(const QVector<QPointF> &positions);
+
+    QVector<int> figureIds;
+    QMutex mutex;
+    QVector<QPointF> latest;
+    std::atomic<bool> pending;
+    std::atomic<bool> cancelled;
+    QFutureWatcher<void> watcher;
+};
+
+#endif // LAYOUTTASK_H
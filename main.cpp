@@ -1,7 +1,13 @@
 #include "mainwindow.h"
 #include <QApplication>
 
+#include "batchmode.h"
+
 int main(int argc, char *argv[]) {
+    // Команды validate, convert, render и export выполняются без окна
+    if (isBatchCommand(argc, argv)) {
+        return runBatch(argc, argv);
+    }
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
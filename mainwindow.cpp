@@ -1,13 +1,54 @@
 #include "mainwindow.h"
+#include <QScreen>
+#include <QInputDialog>
 #include <QToolBar>
 #include <QAction>
 #include <QMenu>
 #include <QMenuBar>
+#include <QMessageBox>
 #include <QFileDialog>
 #include <QDataStream>
+#include <QtMath>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <algorithm>
+#include <iterator>
+
+#include "documentio.h"
+#include "profiler.h"
+
+namespace {
+// Фильтры диалогов открытия и сохранения
+const char *const kDocumentFilters =
+    "Text Files (*.txt);;Diagram Files (*.dgm);;Paged Diagram Files (*.dgp);;Chunked Diagram Files (*.dgc)";
+// Фильтры диалога векторного экспорта
+const char *const kExportFilters = "SVG Files (*.svg);;PDF Files (*.pdf)";
+// В страничном режиме документ сохраняется только в страничный формат
+const char *const kPagedFilter = "Paged Diagram Files (*.dgp)";
+// Задержка подгрузки страниц после последнего изменения вида, мс
+const int kPageSyncDelayMs = 100;
+// Период замера памяти процесса для панели замеров, мс
+const int kMemorySampleMs = 1000;
+// На таком расстоянии от линии связи (в пикселях экрана) щелчок попадает в нее
+const qreal kConnectionPickPixels = 4;
+// Ни одной связи
+const Connection kNoConnection = { -1, -1 };
+// Шаг сетки в единицах сцены
+const int kGridSize = 10;
+// На таком расстоянии (в пикселях экрана) край фигуры притягивается к линии
+const qreal kSnapPixels = 6;
+// При большем числе видимых фигур они слишком мелкие, чтобы выравнивать по ним
+const int kMaxGuideFigures = 100000;
+}
 
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), currentShape(None), movingFigure(nullptr), connecting(false) {
+    : QMainWindow(parent), currentShape(None), selectedConnection(kNoConnection), reroutedConnection(kNoConnection),
+      moving(false), selecting(false), connecting(false), connectionStartId(-1),
+      dragging(false), tiles(diagram), panning(false), documentTask(nullptr), progressDialog(nullptr),
+      layoutTask(nullptr), overlayVisible(false), lastFrameNs(0), lastLatencyNs(0), inputStartNs(-1),
+      residentBytes(-1), undoAction(nullptr), redoAction(nullptr), snapToGrid(true), snapToFigures(true),
+      snapping(false), autosaveEnabled(true) {
     // Создание панели инструментов и добавление действий
     QToolBar *toolBar = addToolBar("Shapes");
 
@@ -38,194 +79,626 @@ MainWindow::MainWindow(QWidget *parent)
     QMenu *fileMenu = menuBar->addMenu("File");
     fileMenu->addAction("Save", this, &MainWindow::saveToFile);
     fileMenu->addAction("Load", this, &MainWindow::loadFromFile);
+    fileMenu->addAction("Export...", this, &MainWindow::exportToFile);
+    fileMenu->addSeparator();
+    QAction *autosaveAction = fileMenu->addAction("Autosave");
+    autosaveAction->setCheckable(true);
+    autosaveAction->setChecked(true);
+    connect(autosaveAction, &QAction::toggled, this, &MainWindow::toggleAutosave);
+
+    // Меню правки: отмена и повтор
+    QMenu *editMenu = menuBar->addMenu("Edit");
+    undoAction = editMenu->addAction("Undo", this, &MainWindow::undo, QKeySequence::Undo);
+    redoAction = editMenu->addAction("Redo", this, &MainWindow::redo, QKeySequence::Redo);
+    editMenu->addAction("History memory budget...", this, &MainWindow::setHistoryBudget);
+    editMenu->addSeparator();
+    editMenu->addAction("Make symbol from selection", this, &MainWindow::makeSymbol);
+    editMenu->addAction("Duplicate", this, &MainWindow::duplicateSelection, QKeySequence("Ctrl+D"));
+
+    // Меню вида: колесо мыши масштабирует, средняя кнопка сдвигает холст
+    QMenu *viewMenu = menuBar->addMenu("View");
+    viewMenu->addAction("Reset view", this, &MainWindow::resetView);
+    // Повторный выбор пункта останавливает идущую укладку
+    viewMenu->addAction("Auto layout", this, &MainWindow::autoLayout);
+    viewMenu->addSeparator();
+    // Привязка при рисовании и перетаскивании; Alt временно отключает ее
+    QAction *gridAction = viewMenu->addAction("Snap to grid");
+    gridAction->setCheckable(true);
+    gridAction->setChecked(true);
+    connect(gridAction, &QAction::toggled, this, &MainWindow::toggleGridSnap);
+    QAction *guidesAction = viewMenu->addAction("Alignment guides");
+    guidesAction->setCheckable(true);
+    guidesAction->setChecked(true);
+    connect(guidesAction, &QAction::toggled, this, &MainWindow::toggleAlignmentGuides);
+    viewMenu->addSeparator();
+    // Замеры производительности: панель на холсте и запись трассы для chrome://tracing
+    QAction *overlayAction = viewMenu->addAction("Performance overlay");
+    overlayAction->setCheckable(true);
+    connect(overlayAction, &QAction::toggled, this, &MainWindow::toggleOverlay);
+    QAction *traceAction = viewMenu->addAction("Record trace");
+    traceAction->setCheckable(true);
+    connect(traceAction, &QAction::toggled, this, &MainWindow::toggleTraceRecording);
+    viewMenu->addAction("Export trace...", this, &MainWindow::exportTrace);
+
+    // Меню запросов к графу связей; результаты подсвечиваются на холсте
+    QMenu *graphMenu = menuBar->addMenu("Graph");
+    graphMenu->addAction("Connected components", this, &MainWindow::highlightComponents);
+    graphMenu->addAction("Reachable from selection", this, &MainWindow::highlightReachable);
+    graphMenu->addAction("Fewest hops between two selected", this, &MainWindow::highlightHopPath);
+    graphMenu->addAction("Shortest path between two selected", this, &MainWindow::highlightShortestPath);
+    graphMenu->addAction("Clear highlight", this, &MainWindow::clearHighlight);
     setMenuBar(menuBar);
 
+    // Таймер кадра: накопленный за кадр сдвиг перетаскивания применяется один раз
+    frameTimer.setSingleShot(true);
+    connect(&frameTimer, &QTimer::timeout, this, &MainWindow::flushPendingMove);
+    // Прокрутка и масштабирование подгружают страницы не на каждом шаге, а после паузы
+    pageTimer.setSingleShot(true);
+    pageTimer.setInterval(kPageSyncDelayMs);
+    connect(&pageTimer, &QTimer::timeout, this, &MainWindow::syncPages);
+    // Память читается из /proc по таймеру, а не в каждом кадре, который панель замеряет
+    memoryTimer.setInterval(kMemorySampleMs);
+    connect(&memoryTimer, &QTimer::timeout, this, &MainWindow::sampleMemory);
+
     resize(800, 600);  // Установка начального размера окна
+
+    // Если прошлый сеанс завершился аварийно, его правки остались в журнале
+    offerRecovery();
+    autosave.start(diagram);
 }
 
-MainWindow::~MainWindow() {}
+MainWindow::~MainWindow() {
+    // Фоновая операция с файлом может пользоваться chunkedDocument: дожидаемся ее до разрушения полей
+    delete documentTask;
+    // Штатный выход: восстанавливать нечего
+    autosave.stop(true);
+}
 
-void MainWindow::paintEvent(QPaintEvent * /*event*/) {
+void MainWindow::paintEvent(QPaintEvent *event) {
+    PROFILE_SCOPE("MainWindow::paintEvent");
+    PROFILE_COUNTER("figures", diagram.figureCount());
+    PROFILE_COUNTER("connections", diagram.connectionCount());
+    const qint64 frameStart = overlayVisible ? Profiler::now() : 0;
     QPainter painter(this);
+    SceneRenderer renderer(diagram);
+    renderer.setScale(viewport.scale());
 
-    // Отрисовка всех фигур
-    for (const Figure &figure : figures) {
-        switch (figure.shape) {
-        case Rectangle:
-            painter.drawRect(figure.rect);
-            break;
-        case Triangle: {
-            QPoint points[3] = {
-                QPoint(figure.rect.left(), figure.rect.bottom()),
-                QPoint(figure.rect.right(), figure.rect.bottom()),
-                QPoint(figure.rect.center().x(), figure.rect.top())
-            };
-            painter.drawPolygon(points, 3);
-            break;
-        }
-        case Ellipse:
-            painter.drawEllipse(figure.rect);
-            break;
-        default:
-            break;
+    if (dragging && !staticLayer.isNull()) {
+        // Неподвижная часть сцены берется из кэша; Qt уже ограничил рисование
+        // поврежденной областью, поэтому копируется только она
+        painter.drawPixmap(0, 0, staticLayer);
+        preparePainter(painter);
+        if (moving) {
+            renderer.renderFiguresWithConnections(painter, selection);
         }
+    } else {
+        // Поврежденная область собирается из тайлов: после сдвига вида
+        // дорисовываются только новые тайлы, недостающие рисуются параллельно
+        tiles.render(painter, viewport, event->rect());
+        preparePainter(painter);
     }
 
-    // Отрисовка всех связей
-    for (const auto &connection : connections) {
-        painter.drawLine(connection.first, connection.second);
+    // Подсветка результатов запросов к графу
+    renderer.renderHighlight(painter, viewport.mapToScene(event->rect()), highlight);
+
+    // Рамки выделенных фигур
+    renderer.renderSelection(painter, viewport.mapToScene(event->rect()), selection);
+    renderer.renderConnectionSelection(painter, selectedConnection);
+
+    // Рамка выделения в процессе растягивания
+    if (selecting) {
+        painter.save();
+        QPen pen(Qt::DashLine);
+        pen.setCosmetic(true);
+        painter.setPen(pen);
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRect(QRect(startPoint, endPoint).normalized());
+        painter.restore();
     }
 
     // Предварительная отрисовка фигуры в процессе рисования
-    if (currentShape == Rectangle || currentShape == Triangle || currentShape == Ellipse) {
-        QRect rect(startPoint, endPoint);
-        switch (currentShape) {
-        case Rectangle:
-            painter.drawRect(rect);
-            break;
-        case Triangle: {
-            QPoint points[3] = {
-                QPoint(rect.left(), rect.bottom()),
-                QPoint(rect.right(), rect.bottom()),
-                QPoint(rect.center().x(), rect.top())
-            };
-            painter.drawPolygon(points, 3);
-            break;
-        }
-        case Ellipse:
-            painter.drawEllipse(rect);
-            break;
-        default:
-            break;
-        }
+    if (dragging && (currentShape == Rectangle || currentShape == Triangle || currentShape == Ellipse)) {
+        SceneRenderer::drawFigure(painter, currentShape, QRect(startPoint, endPoint));
     }
 
     // Отрисовка линии при создании связи
     if (currentShape == Connect && connecting) {
         painter.drawLine(connectionStartPoint, endPoint);
     }
+
+    // Направляющие привязки
+    if (!guideLines.isEmpty()) {
+        painter.save();
+        QPen pen(QColor(230, 0, 120));
+        pen.setCosmetic(true);
+        painter.setPen(pen);
+        painter.drawLines(guideLines);
+        painter.restore();
+    }
+
+    if (overlayVisible) {
+        // Перерисовка одной только панели не считается кадром
+        const qint64 frameEnd = Profiler::now();
+        if (event->rect() != overlayRect()) {
+            lastFrameNs = frameEnd - frameStart;
+        }
+        if (inputStartNs >= 0) {
+            lastLatencyNs = frameEnd - inputStartNs;
+            inputStartNs = -1;
+        }
+        drawOverlay(painter);
+        // Если панель попала в область лишь частично, она дорисуется следующим кадром
+        if (!event->rect().contains(overlayRect())) {
+            update(overlayRect());
+        }
+    }
+}
+
+int MainWindow::frameInterval() const {
+    // Период обновления экрана, на котором сейчас окно
+    const qreal rate = screen() ? screen()->refreshRate() : 60;
+    return qMax(1, qRound(1000 / qMax<qreal>(rate, 1)));
+}
+
+void MainWindow::flushPendingMove() {
+    frameTimer.stop();
+    if (pendingDelta.isNull()) {
+        return;
+    }
+    PROFILE_SCOPE("MainWindow::flushPendingMove");
+    const QPoint delta = pendingDelta;
+    pendingDelta = QPoint();
+    dragShift += delta;
+    moveConnectedFigures(selection, delta);
+}
+
+void MainWindow::noteInput() {
+    // Задержка отсчитывается от первого необработанного события до конца кадра
+    if (overlayVisible && inputStartNs < 0) {
+        inputStartNs = Profiler::now();
+    }
+}
+
+QRect MainWindow::overlayRect() const {
+    return QRect(8, menuBar()->height() + 8, 260, 100);
+}
+
+void MainWindow::drawOverlay(QPainter &painter) {
+    const qint64 memory = residentBytes;
+    const QStringList lines = {
+        QString("Кадр: %1 мс").arg(lastFrameNs / 1e6, 0, 'f', 2),
+        QString("Задержка ввода: %1 мс").arg(lastLatencyNs / 1e6, 0, 'f', 2),
+        QString("Фигур: %1, связей: %2").arg(diagram.figureCount()).arg(diagram.connectionCount()),
+        memory >= 0 ? QString("Память: %1 МБ").arg(memory / (1024.0 * 1024.0), 0, 'f', 1)
+                    : QString("Память: нет данных"),
+        Profiler::isEnabled() ? QString("Запись трассы: %1 событий").arg(Profiler::eventCount())
+                              : QString("Запись трассы выключена")
+    };
+
+    // Панель рисуется в координатах окна, поверх сцены
+    painter.save();
+    painter.resetTransform();
+    const QRect box = overlayRect();
+    painter.fillRect(box, QColor(0, 0, 0, 170));
+    painter.setPen(Qt::white);
+    painter.drawText(box.adjusted(8, 6, -8, -6), Qt::AlignLeft | Qt::AlignTop, lines.join("\n"));
+    painter.restore();
+}
+
+void MainWindow::toggleOverlay(bool visible) {
+    overlayVisible = visible;
+    inputStartNs = -1;
+    if (visible) {
+        sampleMemory();
+        memoryTimer.start();
+    } else {
+        memoryTimer.stop();
+    }
+    update();
+}
+
+void MainWindow::sampleMemory() {
+    residentBytes = Profiler::residentMemory();
+    update(overlayRect());
+}
+
+void MainWindow::toggleTraceRecording(bool on) {
+    Profiler::setEnabled(on);
+    update(overlayRect());
+}
+
+void MainWindow::exportTrace() {
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Trace", "", "Chrome Trace (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    QString error;
+    if (Profiler::writeChromeTrace(fileName, &error)) {
+        qDebug() << "Трасса сохранена:" << Profiler::eventCount() << "событий";
+    } else {
+        qDebug() << error;
+    }
+}
+
+void MainWindow::resizeEvent(QResizeEvent *event) {
+    QMainWindow::resizeEvent(event);
+    // Кэш неподвижного слоя привязан к размеру окна
+    if (dragging) {
+        buildStaticLayer(moving ? selection : QVector<int>());
+    }
+    if (pagedDocument) {
+        pageTimer.start();
+    }
+}
+
+void MainWindow::buildStaticLayer(const QVector<int> &excluded) {
+    PROFILE_SCOPE("MainWindow::buildStaticLayer");
+    // Все, что не меняется во время перетаскивания, рисуется один раз в pixmap
+    const qreal ratio = devicePixelRatioF();
+    staticLayer = QPixmap(size() * ratio);
+    staticLayer.setDevicePixelRatio(ratio);
+    staticLayer.fill(Qt::transparent);
+    QPainter painter(&staticLayer);
+    preparePainter(painter);
+    SceneRenderer renderer(diagram);
+    renderer.setScale(viewport.scale());
+    renderer.render(painter, viewport.mapToScene(rect()), excluded);
+}
+
+void MainWindow::preparePainter(QPainter &painter) const {
+    // Рисование идет в координатах сцены; косметическое перо сохраняет
+    // толщину линий в один пиксель при любом масштабе
+    painter.setTransform(viewport.transform());
+    QPen pen = painter.pen();
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+}
+
+void MainWindow::updateScene(const QRect &sceneRect) {
+    // Перерисовка части окна, занятой областью сцены
+    update(viewport.mapFromScene(sceneRect));
+}
+
+void MainWindow::viewChanged() {
+    // После масштабирования или сдвига кэш неподвижного слоя устаревает,
+    // а привязка должна видеть другие фигуры
+    if (dragging) {
+        buildStaticLayer(moving ? selection : QVector<int>());
+    }
+    if (snapping) {
+        prepareSnapping(moving ? selection : QVector<int>());
+    }
+    if (pagedDocument) {
+        pageTimer.start();
+    }
+    update();
+}
+
+void MainWindow::prepareSnapping(const QVector<int> &excluded) {
+    snapping = snapToGrid || snapToFigures;
+    guides.setGridSize(snapToGrid ? kGridSize : 0);
+    // Опорными служат только видимые фигуры: линия к фигуре за краем окна не видна
+    QVector<int> ids;
+    if (snapToFigures) {
+        for (int id : diagram.figuresIn(viewport.mapToScene(rect()))) {
+            if (!std::binary_search(excluded.constBegin(), excluded.constEnd(), id)) {
+                ids.append(id);
+            }
+        }
+        if (ids.size() > kMaxGuideFigures) {
+            ids.clear();
+        }
+    }
+    guides.build(diagram, ids);
+}
+
+int MainWindow::snapTolerance() const {
+    return qMax(1, qCeil(kSnapPixels / viewport.scale()));
+}
+
+QPoint MainWindow::snapPoint(const QPoint &scenePos, Qt::KeyboardModifiers modifiers) {
+    if (!snapping || (modifiers & Qt::AltModifier)) {
+        setGuideLines(QVector<QLine>());
+        return scenePos;
+    }
+    QVector<QLine> lines;
+    const QPoint snapped = scenePos + guides.snap(scenePos, snapTolerance(), &lines);
+    setGuideLines(lines);
+    return snapped;
+}
+
+QPoint MainWindow::snapMove(const QPoint &shift, Qt::KeyboardModifiers modifiers) {
+    // Привязывается габарит всего выделения, сдвинутый вслед за мышью
+    if (!snapping || (modifiers & Qt::AltModifier)) {
+        setGuideLines(QVector<QLine>());
+        return shift;
+    }
+    QVector<QLine> lines;
+    const QPoint snapped = shift + guides.snap(dragBounds.translated(shift), snapTolerance(), &lines);
+    setGuideLines(lines);
+    return snapped;
+}
+
+void MainWindow::setGuideLines(const QVector<QLine> &lines) {
+    if (lines == guideLines) {
+        return;
+    }
+    // Перерисовываются только старые и новые направляющие
+    for (const QLine &line : guideLines) {
+        updateScene(SceneRenderer::lineBounds(line.p1(), line.p2()));
+    }
+    guideLines = lines;
+    for (const QLine &line : guideLines) {
+        updateScene(SceneRenderer::lineBounds(line.p1(), line.p2()));
+    }
+}
+
+void MainWindow::toggleGridSnap(bool on) {
+    snapToGrid = on;
+}
+
+void MainWindow::toggleAlignmentGuides(bool on) {
+    snapToFigures = on;
+}
+
+void MainWindow::resetView() {
+    viewport.reset();
+    viewChanged();
+}
+
+void MainWindow::wheelEvent(QWheelEvent *event) {
+    PROFILE_SCOPE("MainWindow::wheelEvent");
+    noteInput();
+    // Масштабирование вокруг курсора: один щелчок колеса - примерно 20%
+    const qreal factor = qPow(1.0015, event->angleDelta().y());
+    viewport.zoomAt(event->position().toPoint(), factor);
+    viewChanged();
+    event->accept();
+}
+
+void MainWindow::beginDrag(const QVector<int> &excluded) {
+    dragging = true;
+    buildStaticLayer(excluded);
+}
+
+void MainWindow::endDrag() {
+    // Накопленный сдвиг применяется до того, как кэш сцены будет сброшен
+    flushPendingMove();
+    // Перетаскивание записывается в историю одним шагом с итоговым смещением
+    if (recordsHistory()) {
+        history.recordMove(selection, dragShift);
+    }
+    dragShift = QPoint();
+    dragging = false;
+    staticLayer = QPixmap();
+    snapping = false;
+    guides.clear();
+    setGuideLines(QVector<QLine>());
+}
+
+QRect MainWindow::previewDamage() const {
+    // Область, занятая резиновой рамкой или линией создаваемой связи
+    if (selecting) {
+        return SceneRenderer::paintBounds(QRect(startPoint, endPoint));
+    }
+    if (currentShape == Connect) {
+        return connecting ? SceneRenderer::lineBounds(connectionStartPoint, endPoint) : QRect();
+    }
+    if (currentShape == Rectangle || currentShape == Triangle || currentShape == Ellipse) {
+        return SceneRenderer::paintBounds(QRect(startPoint, endPoint));
+    }
+    return QRect();
 }
 
 void MainWindow::mousePressEvent(QMouseEvent *event) {
+    PROFILE_SCOPE("MainWindow::mousePressEvent");
+    noteInput();
+    // Средняя кнопка сдвигает холст в любом режиме
+    if (event->button() == Qt::MiddleButton) {
+        panning = true;
+        panLastPos = event->pos();
+        return;
+    }
+
     // Если нажата левая кнопка мыши
     if (event->button() == Qt::LeftButton) {
-        // Сохраняем начальную точку нажатия
-        startPoint = event->pos();
+        // Сохраняем начальную точку нажатия в координатах сцены
+        startPoint = viewport.mapToScene(event->pos());
 
         // Проверяем текущий режим
         if (currentShape == Move) {
-            // Поиск фигуры для перемещения
-            movingFigure = nullptr;
-            for (auto &figure : figures) {
-                // Если фигура содержит точку нажатия
-                if (figure.rect.contains(startPoint)) {
-                    // Помечаем эту фигуру как перемещаемую
-                    movingFigure = &figure;
-                    // Сохраняем последнюю позицию мыши
-                    lastMousePos = event->pos();
-                    break;
+            // Поиск самой верхней фигуры под курсором для перемещения
+            const int id = diagram.figureAt(startPoint);
+            const Connection connection = id == -1 ? connectionUnder(startPoint) : kNoConnection;
+            if (id != -1) {
+                // Фигура вне выделения перетаскивается одна, иначе - все выделение
+                if (!isSelected(id)) {
+                    setSelection({ id });
                 }
+                moving = true;
+                dragBounds = QRect();
+                for (int selected : selection) {
+                    dragBounds |= diagram.figure(selected)->rect.normalized();
+                }
+                // Остальная сцена на время перетаскивания кэшируется
+                beginDrag(selection);
+                prepareSnapping(selection);
+            } else if (connection.from != -1) {
+                // Щелчок по линии выделяет связь вместо фигур
+                selection.clear();
+                selectedConnection = connection;
+                update();
+            } else {
+                // Нажатие на пустом месте начинает рамку выделения
+                selecting = true;
+                endPoint = startPoint;
+                beginDrag();
             }
         } else if (currentShape == Connect) {
             // Начало создания связи
-            connecting = false;
-            for (auto &figure : figures) {
-                // Если фигура содержит точку нажатия
-                if (figure.rect.contains(startPoint)) {
-                    // Устанавливаем флаг, что создание связи началось
-                    connecting = true;
-                    // Сохраняем центральную точку фигуры как начало связи
-                    connectionStartPoint = figure.rect.center();
-                    break;
+            connectionStartId = diagram.figureAt(startPoint);
+            if (connectionStartId == -1) {
+                // Нажатие на линию связи переносит ее ближний к курсору конец;
+                // дальний конец остается началом новой линии
+                reroutedConnection = connectionUnder(startPoint);
+                if (reroutedConnection.from != -1) {
+                    const QLine line = diagram.connectionLine(reroutedConnection.from, reroutedConnection.to);
+                    const bool nearFrom = (startPoint - line.p1()).manhattanLength()
+                                          < (startPoint - line.p2()).manhattanLength();
+                    connectionStartId = nearFrom ? reroutedConnection.to : reroutedConnection.from;
                 }
             }
+            connecting = connectionStartId != -1;
+            if (connecting) {
+                // Сохраняем центральную точку фигуры как начало связи
+                connectionStartPoint = diagram.figure(connectionStartId)->rect.center();
+                endPoint = startPoint;
+                beginDrag();
+            }
         } else if (currentShape == Delete) {
-            // Удаление фигуры и ее связей
-            QList<QPair<QPoint, QPoint>> toRemoveConnections;
-            for (auto &figure : figures) {
-                // Если фигура содержит точку нажатия
-                if (figure.rect.contains(startPoint)) {
-                    // Удаление связей, в которых участвует удаляемая фигура
-                    for (auto it = connections.begin(); it != connections.end(); ) {
-                        if (it->first == figure.rect.center() || it->second == figure.rect.center()) {
-                            it = connections.erase(it);
-                        } else {
-                            ++it;
-                        }
-                    }
-                    // Удаление самой фигуры
-                    figures.removeOne(figure);
-                    updateGraph();
-                    update();
-                    break; // Выходим после удаления первой найденной фигуры
-                }
+            // Удаление самой верхней фигуры под курсором (или всего выделения,
+            // если она выделена) вместе со связями
+            const int id = diagram.figureAt(startPoint);
+            const Connection connection = id == -1 ? connectionUnder(startPoint) : kNoConnection;
+            if (id != -1) {
+                deleteFigures(isSelected(id) ? selection : QVector<int>{ id });
+            } else if (connection.from != -1) {
+                // Щелчок по линии удаляет одну связь, фигуры остаются
+                deleteConnection(connection);
+            } else {
+                // Рамка на пустом месте удаляет все фигуры внутри нее
+                selecting = true;
+                endPoint = startPoint;
+                beginDrag();
             }
+        } else if (currentShape == Rectangle || currentShape == Triangle || currentShape == Ellipse) {
+            // Начало рисования фигуры: рамка рисуется поверх кэша сцены,
+            // углы притягиваются к сетке и линиям соседних фигур
+            prepareSnapping(QVector<int>());
+            startPoint = snapPoint(startPoint, event->modifiers());
+            endPoint = startPoint;
+            beginDrag();
         }
     }
 }
 
 void MainWindow::mouseMoveEvent(QMouseEvent *event) {
-    if (currentShape == Move && movingFigure) {
-        // Перемещение фигуры
-        QPoint delta = event->pos() - lastMousePos; //Вычисляет разницу между текущим положением мыши и последним записанным положением мыши ( lastMousePos).
-        int index = figures.indexOf(*movingFigure);//Находит индекс перемещаемой фигуры в figures списке
-        if (index != -1) {
-            moveConnectedFigures(index, delta); //Вызывает moveConnectedFigures() функцию, передавая индекс фигуры и вычисленную дельту, для обновления позиций всех связанных фигур.
-            lastMousePos = event->pos(); //Обновляет lastMousePos переменную с учетом текущего положения мыши.
-            update();  // Перерисовка только после перемещения фигуры
+    PROFILE_SCOPE("MainWindow::mouseMoveEvent");
+    noteInput();
+    if (panning) {
+        // Сдвиг холста вслед за средней кнопкой
+        viewport.panBy(event->pos() - panLastPos);
+        panLastPos = event->pos();
+        viewChanged();
+        return;
+    }
+
+    const QPoint scenePos = viewport.mapToScene(event->pos());
+    if (moving) {
+        // Перемещение выделенных фигур: полный сдвиг от точки нажатия с учетом привязки
+        // минус уже примененный дает то, что осталось сдвинуть
+        pendingDelta = snapMove(scenePos - startPoint, event->modifiers()) - dragShift;
+        if (!pendingDelta.isNull() && !frameTimer.isActive()) {
+            // Смещения копятся до ближайшего кадра: мышь присылает события чаще,
+            // чем обновляется экран, и промежуточные положения все равно не видны
+            frameTimer.start(frameInterval());
         }
-    } else if (currentShape == Connect && connecting) {
-        // Обновление конечной точки связи
-        endPoint = event->pos(); //Обновляет endPoin tпеременную с учетом текущего положения мыши.
-        update();  // Перерисовка для обновления конечной точки
-    } else {
-        // Обновление конечной точки для создания фигуры
-        endPoint = event->pos();
-        update();  // Перерисовка для обновления конечной точки
+    } else if (dragging) {
+        // Обновление конечной точки связи или рамки создаваемой фигуры
+        const QRect oldDamage = previewDamage();
+        endPoint = snapping ? snapPoint(scenePos, event->modifiers()) : scenePos;
+        updateScene(oldDamage | previewDamage());  // Перерисовка только старого и нового положения рамки
     }
 
     // Закрепление начальной точки для создания связи
     if (currentShape == Connect && event->buttons() & Qt::LeftButton && !connecting)
     {
         // Проверяем, что текущая фигура - "Connect" и нажата левая кнопка мыши, но пользователь еще не начал процесс создания связи
-        for (int i = 0; i < figures.size(); ++i)
+        int id = diagram.figureAt(scenePos);
+        if (id != -1)
         {
-            // Итерируемся по списку фигур
-            if (figures.at(i).rect.contains(event->pos()))
-            {
-                // Проверяем, что текущая позиция мыши находится внутри прямоугольника текущей фигуры
-                connectionStartPoint = figures.at(i).rect.center(); // Устанавливаем начальную точку связи в центр прямоугольника фигуры
-                connecting = true; // Устанавливаем флаг connecting в true, показывая, что пользователь начал процесс создания связи
-                break; // Выходим из цикла, так как нашли начальную точку
-            }
+            // Текущая позиция мыши находится внутри прямоугольника фигуры
+            connectionStartId = id;
+            connectionStartPoint = diagram.figure(id)->rect.center(); // Устанавливаем начальную точку связи в центр прямоугольника фигуры
+            connecting = true; // Устанавливаем флаг connecting в true, показывая, что пользователь начал процесс создания связи
+            endPoint = scenePos;
+            beginDrag();
         }
     }
 }
 
 void MainWindow::mouseReleaseEvent(QMouseEvent *event) {
+    PROFILE_SCOPE("MainWindow::mouseReleaseEvent");
+    noteInput();
     //функция сначала проверяет, отпустил ли пользователь левую кнопку мыши, проверяя event->button() значение.
     // Затем функция сохраняет текущее положение мыши ( event->pos())endPoint.
+    if (event->button() == Qt::MiddleButton) {
+        panning = false;
+        return;
+    }
     if (event->button() == Qt::LeftButton) {
-        endPoint = event->pos();
+        const quint64 revisionBefore = diagram.revision();
+        QRect damage = previewDamage();
+        endPoint = viewport.mapToScene(event->pos());
+        if (snapping) {
+            endPoint = snapPoint(endPoint, event->modifiers());
+        }
         QRect rect(startPoint, endPoint);
         //В зависимости от текущего currentShape значения функция выполняет различные действия:
         //addFigure()функция, передающая тип фигуры и прямоугольник, определяемые с помощью startPointи endPoint.
         switch (currentShape) {
+        case Move:
+        case Delete:
+            if (selecting) {
+                // Рамка выделения: все фигуры, целиком попавшие в нее, находятся через сетку
+                selecting = false;
+                if (currentShape == Move) {
+                    setSelection(figuresInBand());
+                } else {
+                    deleteFigures(figuresInBand());
+                }
+            }
+            break;
         case Rectangle:
         case Triangle:
         case Ellipse:
             // Добавление новой фигуры
-            addFigure({ currentShape, rect });
+            if (dragging) {
+                addFigure(currentShape, rect);
+                damage |= SceneRenderer::paintBounds(rect);
+            }
             break;
         case Connect:
-            if (connecting) {
+            if (connecting && reroutedConnection.from != -1) {
+                // Перенос конца связи на фигуру под курсором; мимо фигуры - связь остается как была
+                const int id = diagram.figureAt(endPoint);
+                const Connection before = reroutedConnection;
+                if (id != -1 && id != connectionStartId && !diagram.graph().hasEdge(connectionStartId, id)) {
+                    const QLine oldLine = diagram.connectionLine(before.from, before.to);
+                    damage |= SceneRenderer::lineBounds(oldLine.p1(), oldLine.p2());
+                    diagram.disconnectFigures(before.from, before.to);
+                    diagram.connectFigures(connectionStartId, id);
+                    const Connection after = { qMin(connectionStartId, id), qMax(connectionStartId, id) };
+                    if (recordsHistory()) {
+                        history.recordReconnect(before, after);
+                    }
+                    damage |= SceneRenderer::lineBounds(connectionStartPoint, diagram.figure(id)->rect.center());
+                    if (selectedConnection == before) {
+                        selectedConnection = after;
+                        update();
+                    }
+                }
+                reroutedConnection = kNoConnection;
+                connecting = false;
+            } else if (connecting) {
                 // Завершение создания связи
-                for (auto &figure : figures) {
-                    if (figure.rect.contains(endPoint) && figure.rect.center() != connectionStartPoint) {
-                        connections.append(qMakePair(connectionStartPoint, figure.rect.center()));
-                        updateGraph();
-                        break;
+                int id = diagram.figureAt(endPoint);
+                if (id != -1 && id != connectionStartId) {
+                    // Граф дополняется одним ребром, без перестроения
+                    if (diagram.connectFigures(connectionStartId, id) && recordsHistory()) {
+                        history.recordConnect(connectionStartId, id);
                     }
+                    damage |= SceneRenderer::lineBounds(connectionStartPoint, diagram.figure(id)->rect.center());
                 }
                 connecting = false;
             }
@@ -233,20 +706,37 @@ void MainWindow::mouseReleaseEvent(QMouseEvent *event) {
         default:
             break;
         }
-        //После выполнения необходимых действийupdate()метод инициирования перерисовки главного окна приложения.
-        update();
+        //После выполнения необходимых действий перерисовывается только измененная область окна.
+        endDrag();
+        tiles.invalidate(damage, revisionBefore);
+        updateScene(damage);
     }
-    //функция устанавливаетmovingFigureуказатель на nullptr, указывающий на то, что в данный момент ни одна фигура не перемещается.
-    movingFigure = nullptr;
+    //функция сбрасывает флаг moving, указывая на то, что в данный момент ни одна фигура не перемещается.
+    moving = false;
 }
 
 void MainWindow::keyPressEvent(QKeyEvent *event) {
+    PROFILE_SCOPE("MainWindow::keyPressEvent");
+    noteInput();
     if (event->key() == Qt::Key_Escape) {
-        // Отмена текущего режима
+        // Отмена текущего режима и снятие выделения. Перетаскивание завершается
+        // до снятия выделения: уже сделанный сдвиг записывается в историю
+        endDrag();
         currentShape = None;
-        movingFigure = nullptr;
+        moving = false;
+        selecting = false;
         connecting = false;
+        reroutedConnection = kNoConnection;
+        selection.clear();
+        selectedConnection = kNoConnection;
         update();
+    } else if ((event->key() == Qt::Key_Delete || event->key() == Qt::Key_Backspace) && !dragging) {
+        // Удаление всего выделения одной операцией или выделенной связи
+        if (selection.isEmpty()) {
+            deleteConnection(selectedConnection);
+        } else {
+            deleteFigures(selection);
+        }
     }
 }
 
@@ -275,243 +765,624 @@ void MainWindow::setConnectMode() {
 }
 
 void MainWindow::saveToFile() {
-    // 1. Открытие диалога сохранения файла
-    QString fileName = QFileDialog::getSaveFileName(this, "Save File", "", "Text Files (*.txt)");
-
-    // 2. Проверка, был ли выбран файл для сохранения
-    if (!fileName.isEmpty()) {
-        // 3. Создание объекта файла с выбранным именем
-        QFile file(fileName);
-
-        // 4. Открытие файла в режиме записи
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            // 5. Создание объекта текстового потока для записи данных в файл
-            QTextStream out(&file);
-
-            // 6. Записываем количество фигур и количество связей
-            out << "Figures: " << figures.size() << "\n";
-            out << "Connections: " << connections.size() << "\n";
-
-            // 7. Запись данных фигур в файл
-            for (const auto& figure : figures) {
-                QString shapeType;
-                switch (figure.shape) {
-                case Rectangle: shapeType = "Rectangle"; break;
-                case Triangle: shapeType = "Triangle"; break;
-                case Ellipse: shapeType = "Ellipse"; break;
-                default: shapeType = "Unknown"; break;
-                }
-                out << shapeType << ": " << figure.rect.left() << " " << figure.rect.top() << " "
-                    << figure.rect.width() << " " << figure.rect.height() << "\n";
-            }
-
-            // 8. Запись данных связей в файл
-            for (const auto& connection : connections) {
-                out << "Connection: " << connection.first.x() << " " << connection.first.y() << " "
-                    << connection.second.x() << " " << connection.second.y() << "\n";
-            }
-
-            // 9. Закрытие файла
-            file.close();
+    // Пока идет предыдущая операция с файлом, новая не начинается
+    if (documentTask) {
+        return;
+    }
+    // 1. Открытие диалога сохранения файла; формат выбирается по расширению
+    QString fileName = QFileDialog::getSaveFileName(this, "Save File", "", pagedDocument ? kPagedFilter : kDocumentFilters);
 
+    if (!fileName.isEmpty() && pagedDocument) {
+        // Страничный документ пишется здесь же: невыгруженные страницы копируются
+        // из файла без разбора, а рабочий набор нельзя менять до конца записи
+        if (formatForFile(fileName) != DocumentFormat::Paged) {
+            fileName += ".dgp";
+        }
+        QString error;
+        if (pagedDocument->save(fileName, diagram, &error)) {
             qDebug() << "Файл успешно сохранен и закрыт.";
         } else {
-            qDebug() << "Ошибка: не удалось открыть файл для записи";
+            qDebug() << error;
         }
+        return;
+    }
+
+    // 2. Проверка, был ли выбран файл для сохранения
+    if (!fileName.isEmpty()) {
+        // 3. Запись снимка документа в фоне; редактирование после этого момента
+        // в файл не попадает. Документ из кусков переписывает только измененные куски.
+        startDocumentTask(DocumentTask::save(fileName, diagram, this, &chunkedDocument), "Сохранение документа...");
     } else {
         qDebug() << "Ошибка: не выбран файл для сохранения";
     }
 }
 
 void MainWindow::loadFromFile() {
+    if (documentTask) {
+        return;
+    }
     // 1. Открытие диалога выбора файла для загрузки
-    QString fileName = QFileDialog::getOpenFileName(this, "Load File", "", "Text Files (*.txt)");
+    QString fileName = QFileDialog::getOpenFileName(this, "Load File", "", kDocumentFilters);
 
     // 2. Проверка, был ли выбран файл для загрузки
-    if (!fileName.isEmpty()) {
-        // 3. Создание объекта файла с выбранным именем
-        QFile file(fileName);
-
-        // 4. Открытие файла в режиме чтения
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            // 5. Создание объекта текстового потока для чтения данных из файла
-            QTextStream in(&file);
+    if (!fileName.isEmpty() && formatForFile(fileName) == DocumentFormat::Paged) {
+        // Страничный документ не читается целиком: открываются только каталог и страницы вида
+        openPagedDocument(fileName);
+    } else if (!fileName.isEmpty()) {
+        // 3. Чтение документа в фоне; текущий документ заменяется только после успеха
+        startDocumentTask(DocumentTask::load(fileName, this, &chunkedDocument), "Загрузка документа...");
+    } else {
+        qDebug() << "Ошибка: не выбран файл для загрузки";
+    }
+}
 
-            // 6. Считываем количество фигур и количество связей
-            QString line = in.readLine();
-            int figureCount = 0;
-            int connectionCount = 0;
+void MainWindow::exportToFile() {
+    if (documentTask) {
+        return;
+    }
+    if (pagedDocument) {
+        // В памяти только страницы около вида, а экспорт должен охватить весь документ
+        qDebug() << "Ошибка: страничный документ экспортируется командой export без окна";
+        return;
+    }
+    QString fileName = QFileDialog::getSaveFileName(this, "Export", "", kExportFilters);
+    if (fileName.isEmpty()) {
+        return;
+    }
+    // Экспорт идет в фоне по снимку документа, как и сохранение
+    startDocumentTask(DocumentTask::exportVector(fileName, diagram, this), "Экспорт документа...");
+}
 
-            if (line.startsWith("Figures: ")) {
-                figureCount = line.mid(QString("Figures: ").length()).toInt();
-            }
+void MainWindow::startDocumentTask(DocumentTask *task, const QString &label) {
+    documentTask = task;
 
-            line = in.readLine();
-            if (line.startsWith("Connections: ")) {
-                connectionCount = line.mid(QString("Connections: ").length()).toInt();
-            }
+    // Окно прогресса модально только для этого окна; кнопка отмены прерывает задачу
+    progressDialog = new QProgressDialog(label, "Отмена", 0, 100, this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(300);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+    progressDialog->setValue(0);
 
-            qDebug() << "Загружено фигур: " << figureCount;
-            qDebug() << "Загружено связей: " << connectionCount;
-
-            figures.clear();
-            connections.clear();
-
-            // 7. Чтение данных фигур из файла
-            for (int i = 0; i < figureCount; ++i) {
-                line = in.readLine();
-                QStringList parts = line.split(": ");
-                if (parts.size() == 2) {
-                    QString shapeType = parts[0];
-                    QStringList rectParts = parts[1].split(" ");
-                    if (rectParts.size() == 4) {
-                        QRect rect(rectParts[0].toInt(), rectParts[1].toInt(),
-                                   rectParts[2].toInt(), rectParts[3].toInt());
-                        Shape shape = None;
-                        if (shapeType == "Rectangle") shape = Rectangle;
-                        else if (shapeType == "Triangle") shape = Triangle;
-                        else if (shapeType == "Ellipse") shape = Ellipse;
-
-                        if (shape != None) {
-                            figures.append({ shape, rect });
-                        }
-                    }
-                }
-            }
-
-            // 8. Чтение данных связей из файла
-            for (int i = 0; i < connectionCount; ++i) {
-                line = in.readLine();
-                QStringList parts = line.split(": ");
-                if (parts.size() == 2 && parts[0] == "Connection") {
-                    QStringList pointParts = parts[1].split(" ");
-                    if (pointParts.size() == 4) {
-                        QPoint point1(pointParts[0].toInt(), pointParts[1].toInt());
-                        QPoint point2(pointParts[2].toInt(), pointParts[3].toInt());
-                        connections.append(qMakePair(point1, point2));
-                    }
-                }
-            }
+    connect(task, &DocumentTask::progressChanged, progressDialog, &QProgressDialog::setValue);
+    connect(progressDialog, &QProgressDialog::canceled, task, &DocumentTask::cancel);
+    connect(task, &DocumentTask::finished, this, &MainWindow::documentTaskFinished);
+}
 
-            updateGraph();
-            update();
+void MainWindow::documentTaskFinished() {
+    DocumentTask *task = documentTask;
+    documentTask = nullptr;
+    progressDialog->deleteLater();
+    progressDialog = nullptr;
 
-            // 9. Закрытие файла
-            file.close();
+    if (!task->succeeded()) {
+        qDebug() << task->errorMessage();
+    } else if (task->isLoading()) {
+        // Диаграмма со всеми индексами уже построена в рабочем потоке;
+        // здесь она только подменяет текущую
+        stopLayout();
+        endDrag();
+        const Diagram before = diagram;
+        diagram = task->takeDiagram();
+        if (formatForFile(task->fileName()) == DocumentFormat::Chunked) {
+            // Присваивание начало новую линию версий; правки считаются от прочитанного файла
+            chunkedDocument.rebase(diagram);
+        }
+        if (pagedDocument) {
+            // Рабочий набор страничного документа - не весь документ, вернуть его отменой нельзя
+            leavePagedMode();
         } else {
-            qDebug() << "Ошибка: не удалось открыть файл для чтения";
+            // Загрузку тоже можно отменить: обе копии разделяют данные с документами
+            history.recordReplace(before, diagram);
         }
+        moving = false;
+        selecting = false;
+        connecting = false;
+        reroutedConnection = kNoConnection;
+        selection.clear();
+        selectedConnection = kNoConnection;
+        highlight = Highlight();
+        endDrag();
+        qDebug() << "Загружено фигур: " << diagram.figureCount();
+        qDebug() << "Загружено связей: " << diagram.connectionCount();
+        update();
+    } else if (task->isExporting()) {
+        qDebug() << "Документ экспортирован:" << task->fileName();
     } else {
-        qDebug() << "Ошибка: не выбран файл для загрузки";
+        qDebug() << "Файл успешно сохранен и закрыт.";
     }
+    task->deleteLater();
 }
 
+void MainWindow::openPagedDocument(const QString &fileName) {
+    QScopedPointer<PagedDocument> document(new PagedDocument);
+    QString error;
+    if (!document->open(fileName, &error)) {
+        qDebug() << error;
+        return;
+    }
+    stopLayout();
+    endDrag();
+    // Журнал и история работают с документом целиком, а в памяти только его часть:
+    // журнал приостанавливается, историю до открытия отменить уже нельзя
+    autosave.stop(true);
+    diagram.assign(QVector<Figure>(), QVector<Connection>(), document->symbols());
+    history.clear();
+    pagedDocument.swap(document);
+    undoAction->setEnabled(false);
+    redoAction->setEnabled(false);
+    diagram.reserveIds(pagedDocument->nextId());
+    moving = false;
+    selecting = false;
+    connecting = false;
+    reroutedConnection = kNoConnection;
+    selection.clear();
+    selectedConnection = kNoConnection;
+    highlight = Highlight();
+    qDebug() << "Страниц в документе: " << pagedDocument->pageCount();
+    syncPages();
+}
 
+void MainWindow::leavePagedMode() {
+    pageTimer.stop();
+    pagedDocument.reset();
+    history.clear();
+    undoAction->setEnabled(true);
+    redoAction->setEnabled(true);
+    if (autosaveEnabled) {
+        autosave.start(diagram);
+    }
+}
 
-QDataStream &operator<<(QDataStream &out, const Figure &figure) {
-    // Запись типа фигуры
-    out << static_cast<qint32>(figure.shape);
+void MainWindow::syncPages() {
+    if (!pagedDocument) {
+        return;
+    }
+    // Пока фигуры перетаскиваются или укладываются, набор фигур не меняется
+    if (dragging || layoutTask || documentTask) {
+        pageTimer.start();
+        return;
+    }
+    QString error;
+    if (!pagedDocument->sync(diagram, viewport.mapToScene(rect()), &error)) {
+        qDebug() << error;
+    }
+    // Выгруженные фигуры не остаются выделенными
+    QVector<int> kept;
+    for (int id : selection) {
+        if (diagram.figure(id)) {
+            kept.append(id);
+        }
+    }
+    if (kept.size() != selection.size()) {
+        setSelection(kept);
+    }
+    if (selectedConnection.from != -1 && !diagram.graph().hasEdge(selectedConnection.from, selectedConnection.to)) {
+        selectedConnection = kNoConnection;
+    }
+    update();
+}
 
-    // Запись размера данных фигуры
-    qint32 dataSize = 0;
-    QByteArray data;
-    {
-        QDataStream dataStream(&data, QIODevice::WriteOnly);
-        dataStream << figure.rect;
-        dataSize = data.size();
-    }
-    out << dataSize;
-
-    // Запись данных фигуры
-    out.writeRawData(data.constData(), dataSize);
-
-    return out;
-}
-
-QDataStream &operator>>(QDataStream &in, Figure &figure) {
-    // Чтение фигуры из потока данных
-    int shape;
-    in >> shape;
-    figure.shape = static_cast<Shape>(shape);
-    in >> figure.rect;
-    return in;
-}
-
-
-void MainWindow::updateGraph() {
-    // Обновление графа связей между фигурами
-    graph.clear();
-    //функция проходит по всем существующим связям (connections). Для каждой связи она пытается найти индексы фигуры, соответствующие началу и концу этой связи.
-    /*Для каждой связи в connections функция ищет индексы соответствующих фигур в figures.
-     * Это делается с помощью вложенного цикла, который перебирает все фигуры. Внутри цикла проверяется,
-     * совпадают ли центры прямоугольников фигур (figures[j].rect.center()) с координатами начала и конца
-     * текущей связи (connections[i].first и connections[i].second). Если совпадение найдено, то
-     * соответствующие индексы фигур сохраняются в переменные startIdx и endIdx.*/
-    for (int i = 0; i < connections.size(); ++i) {
-        int startIdx = -1, endIdx = -1;
-        for (int j = 0; j < figures.size(); ++j) {
-            if (figures[j].rect.center() == connections[i].first) {
-                startIdx = j;
+void MainWindow::moveConnectedFigures(const QVector<int> &ids, const QPoint &delta) {
+    // Перемещение выбранных фигур за один проход
+    /*Связи хранятся как пары id и всегда рисуются между центрами фигур,
+     * поэтому после сдвига прямоугольников концы связей следуют за фигурами
+     * автоматически и перебирать список связей не нужно.*/
+    SceneRenderer renderer(diagram);
+    QRect damage = renderer.figuresDamage(ids);
+    const quint64 revisionBefore = diagram.revision();
+    diagram.moveFigures(ids, delta);
+    damage |= renderer.figuresDamage(ids);
+    tiles.invalidate(damage, revisionBefore);
+
+    // Инициация перерисовки окна
+    /*После обновления фигур и связанных с ними соединений функция вызывает метод update()
+         * только для старого и нового места фигур с их связями. Остальная сцена во время
+         * перетаскивания берется из кэша, поэтому цена кадра не зависит от размера документа.*/
+    updateScene(damage);
+}
+
+void MainWindow::addFigure(Shape shape, const QRect &rect) {
+    // Добавление новой фигуры поверх остальных
+    const int id = diagram.addFigure(shape, rect);
+    if (recordsHistory()) {
+        history.recordAdd(*diagram.figure(id));
+    }
+}
+
+void MainWindow::clearAll() {
+    // Очистка всех фигур и связей; прежний документ остается в истории
+    stopLayout();
+    endDrag();
+    const Diagram before = diagram;
+    diagram.clear();
+    if (pagedDocument) {
+        leavePagedMode();
+    } else {
+        history.recordReplace(before, diagram);
+    }
+    moving = false;
+    selecting = false;
+    connecting = false;
+    reroutedConnection = kNoConnection;
+    selection.clear();
+    selectedConnection = kNoConnection;
+    highlight = Highlight();
+    endDrag();
+    update();
+}
+
+void MainWindow::makeSymbol() {
+    if (selection.isEmpty()) {
+        qDebug() << "Ошибка: не выделено ни одной фигуры";
+        return;
+    }
+    if (documentTask) {
+        return;
+    }
+    stopLayout();
+    endDrag();
+    // Выделенные фигуры и связи между ними становятся определением символа,
+    // а на их месте остается один экземпляр; связи с остальными фигурами
+    // переходят на экземпляр
+    const Diagram before = diagram;
+    QVector<Figure> figures;
+    QVector<Connection> inner;
+    QVector<int> outside;
+    QRect bounds;
+    for (int id : selection) {
+        const Figure *figure = diagram.figure(id);
+        figures.append(*figure);
+        bounds |= figure->rect.normalized();
+        for (int other : diagram.graph().neighbors(id)) {
+            if (!isSelected(other)) {
+                outside.append(other);
+            } else if (id < other) {
+                inner.append({ id, other });
             }
-            if (figures[j].rect.center() == connections[i].second) {
-                endIdx = j;
+        }
+    }
+    const int symbol = diagram.defineSymbol(figures, inner);
+    diagram.removeFigures(selection);
+    const int instance = diagram.addInstance(symbol, bounds.topLeft());
+    for (int other : outside) {
+        diagram.connectFigures(instance, other);
+    }
+    if (recordsHistory()) {
+        history.recordReplace(before, diagram);
+    }
+    qDebug() << "Символ" << symbol << "из" << figures.size() << "фигур";
+    setSelection(QVector<int>{ instance });
+}
+
+void MainWindow::duplicateSelection() {
+    if (selection.isEmpty() || documentTask) {
+        return;
+    }
+    stopLayout();
+    endDrag();
+    // Копии ложатся поверх остальных фигур со сдвигом; экземпляр копируется
+    // экземпляром того же символа, поэтому повторяющиеся группы не множат фигуры
+    const QPoint offset(2 * kGridSize, 2 * kGridSize);
+    QHash<int, int> copyOf;
+    QVector<int> copies;
+    for (int id : selection) {
+        const Figure figure = *diagram.figure(id);
+        const int copy = figure.shape == Instance ? diagram.addInstance(figure.symbol, figure.rect.topLeft() + offset)
+                                                  : diagram.addFigure(figure.shape, figure.rect.translated(offset));
+        copyOf.insert(id, copy);
+        copies.append(copy);
+    }
+    QVector<Connection> connections;
+    for (int id : selection) {
+        for (int other : diagram.graph().neighbors(id)) {
+            if (id < other && copyOf.contains(other)) {
+                connections.append({ copyOf.value(id), copyOf.value(other) });
             }
         }
+    }
+    for (const Connection &connection : connections) {
+        diagram.connectFigures(connection.from, connection.to);
+    }
+    if (recordsHistory()) {
+        QVector<Figure> figures;
+        for (int id : copies) {
+            figures.append(*diagram.figure(id));
+        }
+        history.recordInsert(figures, connections);
+    }
+    setSelection(copies);
+}
+
+void MainWindow::autoLayout() {
+    if (layoutTask) {
+        stopLayout();
+        return;
+    }
+    // Укладка идет над снимком документа; положения приходят на холст по мере расчета
+    layoutTask = LayoutTask::start(diagram, this);
+    layoutShifts = QVector<QPoint>(layoutTask->ids().size());
+    connect(layoutTask, &LayoutTask::positionsChanged, this, &MainWindow::applyLayout);
+    connect(layoutTask, &LayoutTask::finished, this, &MainWindow::layoutFinished);
+}
 
-        /*После того, как для текущей связи были найдены индексы начальной и
-         * конечной фигур, эти данные добавляются в граф graph. Это происходит следующим образом:
-         * Индекс конечной фигуры (endIdx) вставляется в множество, связанное с индексом начальной
-         * фигуры (graph[startIdx].insert(endIdx)). Это означает, что начальная фигура связана с конечной.
-         * Индекс начальной фигуры (startIdx) вставляется в множество, связанное с индексом конечной
-         * фигуры (graph[endIdx].insert(startIdx)). Это означает, что конечная фигура связана с начальной.*/
-        if (startIdx != -1 && endIdx != -1) {
-            graph[startIdx].insert(endIdx);
-            graph[endIdx].insert(startIdx);
+void MainWindow::applyLayout() {
+    if (!layoutTask) {
+        return;
+    }
+    const QVector<QPointF> positions = layoutTask->takePositions();
+    if (positions.isEmpty()) {
+        return;
+    }
+    /*Как и в moveConnectedFigures, сдвигается только прямоугольник фигуры:
+     * связи рисуются между центрами, поэтому их концы следуют за фигурами.
+     * Фигуры, удаленные во время укладки, пропускаются. Двигается почти вся
+     * сцена, поэтому перерисовывается окно целиком.*/
+    const QVector<int> &ids = layoutTask->ids();
+    QVector<int> movedIds;
+    QVector<QPoint> deltas;
+    movedIds.reserve(ids.size());
+    deltas.reserve(ids.size());
+    for (int i = 0; i < ids.size(); ++i) {
+        const Figure *figure = diagram.figure(ids[i]);
+        if (figure) {
+            const QPoint delta = positions[i].toPoint() - figure->rect.center();
+            movedIds.append(ids[i]);
+            deltas.append(delta);
+            layoutShifts[i] += delta;
         }
     }
+    // Кадр укладки - одна правка документа, а не тысячи отдельных сдвигов
+    diagram.moveFigures(movedIds, deltas);
+    viewChanged();
+}
+
+void MainWindow::layoutFinished() {
+    applyLayout();
+    // Вся укладка отменяется одним шагом
+    if (recordsHistory()) {
+        history.recordMoves(layoutTask->ids(), layoutShifts);
+    }
+    layoutTask->deleteLater();
+    layoutTask = nullptr;
 }
 
-void MainWindow::moveConnectedFigures(int index, const QPoint &delta) {
-    // Перемещение выбранной фигуры
-    /*ункция принимает indexпараметр, представляющий индекс выбранной фигуры в figures списке.
-     * Затем она обновляет rectсвойство выбранной фигуры, перемещая ее верхний левый угол
-     * на указанное значение delta(величина перемещения).*/
-    figures[index].rect.moveTopLeft(figures[index].rect.topLeft() + delta);
-
-    // Обновление позиций связей, связанных с перемещаемой фигурой
-    /*Затем функция выполняет итерацию по connectionsсписку, содержащему начальные и
-     *  конечные точки соединений между фигурами. Для каждого соединения она проверяет,
-     *  содержится ли начальная или конечная точка соединения в обновленном прямоугольнике
-     *  выбранной фигуры. Если да, она обновляет соответствующую точку соединения, чтобы
-     *  она стала центром прямоугольника выбранной фигуры. Это гарантирует, что при перемещении
-     *  выбранной фигуры присоединенные к ней соединения также обновляются, чтобы сохранить
-     *  визуальное представление соединения.*/
-    for (auto &connection : connections) {
-        // Обновляем только концы линий, привязанные к перемещаемой фигуре
-        if (figures[index].rect.contains(connection.first)) {
-            connection.first = figures[index].rect.center();
-        } else if (figures[index].rect.contains(connection.second)) {
-            connection.second = figures[index].rect.center();
+void MainWindow::stopLayout() {
+    // Положения, еще не забранные окном, отбрасываются; деструктор дожидается рабочего потока
+    if (layoutTask) {
+        if (recordsHistory()) {
+            history.recordMoves(layoutTask->ids(), layoutShifts);
         }
+        delete layoutTask;
+        layoutTask = nullptr;
     }
+}
 
-    // Инициация перерисовки окна
-    /*После обновления фигуры и связанных с ней соединений функция вызывает метод update()
-         * для инициирования перерисовки главного окна приложения. Это гарантирует, что изменения,
-         * внесенные в фигуру и соединения, немедленно отразятся в визуальном представлении приложения.*/
+bool MainWindow::isSelected(int id) const {
+    return std::binary_search(selection.constBegin(), selection.constEnd(), id);
+}
+
+void MainWindow::setSelection(const QVector<int> &ids) {
+    selection = ids;
+    selectedConnection = kNoConnection;
+    std::sort(selection.begin(), selection.end());
     update();
 }
 
-void MainWindow::addFigure(const Figure &figure) {
-    // Добавление новой фигуры в список фигур
-    figures.append(figure);
-    updateGraph();
+QVector<int> MainWindow::figuresInBand() const {
+    // Рамка, протянутая справа налево, выделяет все фигуры, которые она задевает
+    // (с учетом формы); слева направо - только лежащие в ней целиком
+    const QRect band = QRect(startPoint, endPoint).normalized();
+    if (endPoint.x() < startPoint.x()) {
+        return diagram.figuresTouching(band);
+    }
+    QVector<int> ids;
+    for (int id : diagram.figuresIn(band)) {
+        if (band.contains(diagram.figure(id)->rect.normalized())) {
+            ids.append(id);
+        }
+    }
+    return ids;
 }
 
-void MainWindow::clearAll() {
-    // Очистка всех фигур и связей
-    figures.clear();
-    connections.clear();
-    graph.clear();
+void MainWindow::deleteFigures(const QVector<int> &ids) {
+    if (ids.isEmpty()) {
+        return;
+    }
+    // Перерисовывается только место, где были фигуры и их связи
+    const QRect damage = SceneRenderer(diagram).figuresDamage(ids);
+    if (recordsHistory()) {
+        history.recordRemove(diagram, ids);
+    }
+    const quint64 revisionBefore = diagram.revision();
+    diagram.removeFigures(ids);
+
+    // Удаленные фигуры покидают выделение
+    QVector<int> removed = ids;
+    std::sort(removed.begin(), removed.end());
+    QVector<int> remaining;
+    std::set_difference(selection.constBegin(), selection.constEnd(), removed.constBegin(), removed.constEnd(),
+                        std::back_inserter(remaining));
+    selection = remaining;
+    tiles.invalidate(damage, revisionBefore);
+    updateScene(damage);
+}
+
+void MainWindow::deleteConnection(const Connection &connection) {
+    if (!diagram.graph().hasEdge(connection.from, connection.to)) {
+        return;
+    }
+    const QLine line = diagram.connectionLine(connection.from, connection.to);
+    const quint64 revisionBefore = diagram.revision();
+    diagram.disconnectFigures(connection.from, connection.to);
+    if (recordsHistory()) {
+        history.recordDisconnect(connection.from, connection.to);
+    }
+    if (selectedConnection == connection) {
+        selectedConnection = kNoConnection;
+    }
+    tiles.invalidate(SceneRenderer::lineBounds(line.p1(), line.p2()), revisionBefore);
+    // Линия выделения толще линии связи в пикселях экрана, поэтому окно обновляется целиком
+    update();
+}
+
+Connection MainWindow::connectionUnder(const QPoint &scenePos) const {
+    // Допуск задан в пикселях экрана, поэтому в единицах сцены он растет при отдалении
+    const int tolerance = qMax(1, qCeil(kConnectionPickPixels / viewport.scale()));
+    return diagram.connectionAt(scenePos, tolerance);
+}
+
+const GraphSnapshot &MainWindow::snapshot() {
+    // Снимок строится заново только после правок документа
+    if (!graphSnapshot || graphSnapshot->revision() != diagram.revision()) {
+        QElapsedTimer timer;
+        timer.start();
+        graphSnapshot.reset(new GraphSnapshot(diagram));
+        qDebug() << "Снимок графа построен за" << timer.elapsed() << "мс";
+    }
+    return *graphSnapshot;
+}
+
+void MainWindow::highlightComponents() {
+    QElapsedTimer timer;
+    timer.start();
+    int count = 0;
+    const QVector<int> labels = snapshot().components(&count);
+    qDebug() << "Компонент связности:" << count << "за" << timer.elapsed() << "мс";
+
+    // Фигуры снимка идут в порядке figures(), то есть по возрастанию id
+    highlight = Highlight();
+    highlight.groups = labels;
+    for (const Figure &figure : diagram.figures()) {
+        highlight.figures.append(figure.id);
+    }
+    update();
+}
+
+void MainWindow::highlightReachable() {
+    if (selection.isEmpty()) {
+        qDebug() << "Ошибка: не выделено ни одной фигуры";
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    highlight = Highlight();
+    highlight.figures = snapshot().reachableFrom(selection);
+    qDebug() << "Достижимо фигур:" << highlight.figures.size() << "за" << timer.elapsed() << "мс";
+    update();
+}
+
+void MainWindow::highlightHopPath() {
+    highlightPath(false);
+}
+
+void MainWindow::highlightShortestPath() {
+    highlightPath(true);
+}
+
+void MainWindow::highlightPath(bool weighted) {
+    if (selection.size() != 2) {
+        qDebug() << "Ошибка: для поиска пути нужно выделить ровно две фигуры";
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const GraphSnapshot &graph = snapshot();
+    const QVector<int> path = weighted ? graph.shortestPath(selection[0], selection[1])
+                                       : graph.shortestHops(selection[0], selection[1]);
+    qDebug() << "Путь из" << path.size() << "фигур найден за" << timer.elapsed() << "мс";
+
+    highlight = Highlight();
+    for (int i = 0; i < path.size(); ++i) {
+        highlight.figures.append(path[i]);
+        if (i > 0) {
+            highlight.connections.append({ path[i - 1], path[i] });
+        }
+    }
+    std::sort(highlight.figures.begin(), highlight.figures.end());
+    update();
+}
+
+void MainWindow::clearHighlight() {
+    highlight = Highlight();
+    update();
+}
+
+void MainWindow::undo() {
+    stepHistory(false);
+}
+
+void MainWindow::redo() {
+    stepHistory(true);
+}
+
+void MainWindow::stepHistory(bool forward) {
+    // Незавершенные действия сначала завершаются и попадают в историю сами
+    if (documentTask || !recordsHistory()) {
+        return;
+    }
+    stopLayout();
+    endDrag();
+    moving = false;
+    selecting = false;
+    connecting = false;
+    reroutedConnection = kNoConnection;
+
+    if (!(forward ? history.redo(diagram) : history.undo(diagram))) {
+        return;
+    }
+    // Из выделения убираются фигуры, которых больше нет
+    QVector<int> remaining;
+    for (int id : selection) {
+        if (diagram.figure(id)) {
+            remaining.append(id);
+        }
+    }
+    selection = remaining;
+    if (!diagram.graph().hasEdge(selectedConnection.from, selectedConnection.to)) {
+        selectedConnection = kNoConnection;
+    }
     update();
 }
+
+void MainWindow::offerRecovery() {
+    if (!AutosaveJournal::hasRecovery(autosave.directory())) {
+        return;
+    }
+    const QMessageBox::StandardButton answer = QMessageBox::question(
+        this, "Автосохранение", "Предыдущий сеанс завершился аварийно. Восстановить несохраненные правки?",
+        QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+    if (answer != QMessageBox::Yes) {
+        return;
+    }
+    QString error;
+    if (AutosaveJournal::recover(autosave.directory(), diagram, &error)) {
+        qDebug() << "Восстановлено фигур:" << diagram.figureCount() << "связей:" << diagram.connectionCount();
+    } else {
+        qDebug() << error;
+    }
+}
+
+void MainWindow::toggleAutosave(bool on) {
+    autosaveEnabled = on;
+    if (pagedDocument) {
+        // Журнал возобновится при выходе из страничного режима
+        return;
+    }
+    if (on) {
+        autosave.start(diagram);
+    } else {
+        // Без журнала восстанавливать нечего, поэтому файлы удаляются
+        autosave.stop(true);
+    }
+}
+
+void MainWindow::setHistoryBudget() {
+    bool ok = false;
+    const int megabytes = QInputDialog::getInt(this, "History", "Memory budget for undo history, MB:",
+                                               int(history.budget() / (1024 * 1024)), 1, 65536, 1, &ok);
+    if (ok) {
+        history.setBudget(qint64(megabytes) * 1024 * 1024);
+        qDebug() << "История:" << history.undoCount() << "шагов," << history.memoryUsage() / 1024 << "КБ";
+    }
+}
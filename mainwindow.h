@@ -11,33 +11,31 @@
 #include <QAction>
 #include <QMenuBar>
 #include <QPainter>
+#include <QPixmap>
 #include <QMouseEvent>
 #include <QKeyEvent>
+#include <QWheelEvent>
 #include <QVector>
 #include <QMap>
 #include <QSet>
 #include <QList>
 #include <QVBoxLayout>
-
-
-// Перечисление форм
-enum Shape { None, Rectangle, Triangle, Ellipse, Line, Move, Delete, Connect };
-
-// Структура, представляющая фигуру
-struct Figure {
-    Shape shape;
-    QRect rect;
-
-    // Оператор сравнения
-    bool operator==(const Figure &other) const {
-        return shape == other.shape && rect == other.rect;
-    }
-};
-
-
-// Перегрузка операторов потокового ввода/вывода для структуры Figure
-QDataStream &operator<<(QDataStream &out, const Figure &figure);
-QDataStream &operator>>(QDataStream &in, Figure &figure);
+#include <QProgressDialog>
+#include <QScopedPointer>
+#include <QTimer>
+
+#include "alignmentguides.h"
+#include "autosavejournal.h"
+#include "chunkeddocument.h"
+#include "diagram.h"
+#include "documenttask.h"
+#include "graphsnapshot.h"
+#include "layouttask.h"
+#include "pageddocument.h"
+#include "scenerenderer.h"
+#include "tilerenderer.h"
+#include "undohistory.h"
+#include "viewport.h"
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -52,6 +50,8 @@ protected:
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
 
 private slots:
     void setRectangleMode();
@@ -62,24 +62,120 @@ private slots:
     void setConnectMode();
     void saveToFile();
     void loadFromFile();
+    void exportToFile();
     void clearAll(); // Новый слот для очистки всех фигур
+    void resetView();
+    void documentTaskFinished();
+    void autoLayout();
+    void applyLayout();
+    void layoutFinished();
+    void highlightComponents();
+    void highlightReachable();
+    void highlightHopPath();
+    void highlightShortestPath();
+    void clearHighlight();
+    void toggleOverlay(bool visible);
+    void toggleTraceRecording(bool on);
+    void exportTrace();
+    void flushPendingMove();
+    void sampleMemory();
+    void undo();
+    void redo();
+    void setHistoryBudget();
+    void makeSymbol();
+    void duplicateSelection();
+    void toggleAutosave(bool on);
+    void toggleGridSnap(bool on);
+    void toggleAlignmentGuides(bool on);
+    void syncPages();
 
 private:
     Shape currentShape;
     QPoint startPoint, endPoint;
-    QVector<Figure> figures;
-    QVector<QPair<QPoint, QPoint>> connections;
-    Figure *movingFigure;
-    QPoint lastMousePos;
+    Diagram diagram;  // Фигуры, граф связей между ними и сетка для поиска
+    QVector<int> selection;  // Id выделенных фигур по возрастанию
+    Connection selectedConnection;   // Выделенная связь или { -1, -1 }
+    Connection reroutedConnection;   // Связь, конец которой сейчас переносится, или { -1, -1 }
+    bool moving;      // Перетаскивается выделение
+    bool selecting;   // Растягивается рамка выделения
     bool connecting;
+    int connectionStartId;
     QPoint connectionStartPoint;
-
-    void moveConnectedFigures(int index, const QPoint &delta);
-    void updateGraph();
-    void addFigure(const Figure &figure);
-
-
-     QMap<int, QSet<int>> graph;  // Граф связей между фигурами
+    bool dragging;        // Идет перетаскивание: фигура, рамка или линия связи
+    QPixmap staticLayer;  // Неподвижная часть сцены на время перетаскивания
+    Viewport viewport;    // Масштаб и сдвиг холста; фигуры хранятся в координатах сцены
+    TileRenderer tiles;   // Кэш сцены тайлами для перерисовки вне перетаскивания
+    bool panning;
+    QPoint panLastPos;
+    DocumentTask *documentTask;       // Идущая загрузка или сохранение, иначе nullptr
+    QProgressDialog *progressDialog;
+    LayoutTask *layoutTask;           // Идущая автоукладка, иначе nullptr
+    QScopedPointer<GraphSnapshot> graphSnapshot;  // Кэш графа для запросов
+    Highlight highlight;              // Результат последнего запроса к графу
+    bool overlayVisible;              // Панель замеров поверх холста
+    qint64 lastFrameNs;
+    qint64 lastLatencyNs;
+    qint64 inputStartNs;              // Время первого еще не нарисованного события или -1
+    qint64 residentBytes;             // Последний замер памяти процесса или -1
+    QTimer memoryTimer;               // Замер памяти для панели, пока она показана
+    QPoint pendingDelta;              // Сдвиг перетаскивания, еще не примененный к фигурам
+    QTimer frameTimer;
+    QPoint dragShift;                 // Полное смещение текущего перетаскивания
+    QVector<QPoint> layoutShifts;     // Смещения фигур от автоукладки, параллельно layoutTask->ids()
+    UndoHistory history;              // В страничном режиме не ведется
+    QAction *undoAction;
+    QAction *redoAction;
+    AutosaveJournal autosave;         // Журнал правок для восстановления после сбоя
+    bool snapToGrid;                  // Привязка к сетке включена
+    bool snapToFigures;               // Привязка к краям и центрам соседних фигур включена
+    bool snapping;                    // Идет рисование или перетаскивание с привязкой
+    AlignmentGuides guides;           // Линии привязки видимых фигур на время перетаскивания
+    QVector<QLine> guideLines;        // Показанные сейчас направляющие, в координатах сцены
+    QRect dragBounds;                 // Габарит выделения в начале перетаскивания
+    QScopedPointer<PagedDocument> pagedDocument;  // Открытый страничный документ, иначе null
+    ChunkedDocument chunkedDocument;  // Оглавление последнего прочитанного или записанного *.dgc
+    QTimer pageTimer;                 // Подгрузка страниц после того, как вид перестал меняться
+    bool autosaveEnabled;             // Выбор пользователя; в страничном режиме журнал не ведется
+
+    void startDocumentTask(DocumentTask *task, const QString &label);
+    // Страничный режим: в diagram только фигуры страниц около вида
+    void openPagedDocument(const QString &fileName);
+    void leavePagedMode();
+    void stopLayout();
+    bool isSelected(int id) const;
+    void setSelection(const QVector<int> &ids);
+    void deleteFigures(const QVector<int> &ids);
+    void deleteConnection(const Connection &connection);
+    // Связь под точкой сцены с запасом в несколько пикселей экрана
+    Connection connectionUnder(const QPoint &scenePos) const;
+    QVector<int> figuresInBand() const;
+    const GraphSnapshot &snapshot();
+    void highlightPath(bool weighted);
+    void noteInput();
+    int frameInterval() const;
+    void stepHistory(bool forward);
+    // История видит только выгруженный рабочий набор, поэтому в страничном режиме не ведется
+    bool recordsHistory() const { return !pagedDocument; }
+    void offerRecovery();
+    QRect overlayRect() const;
+    void drawOverlay(QPainter &painter);
+
+    // Привязка: опорные линии строятся по видимым фигурам, кроме excluded (отсортированных)
+    void prepareSnapping(const QVector<int> &excluded);
+    QPoint snapPoint(const QPoint &scenePos, Qt::KeyboardModifiers modifiers);
+    QPoint snapMove(const QPoint &shift, Qt::KeyboardModifiers modifiers);
+    void setGuideLines(const QVector<QLine> &lines);
+    int snapTolerance() const;
+
+    void moveConnectedFigures(const QVector<int> &ids, const QPoint &delta);
+    void addFigure(Shape shape, const QRect &rect);
+    void buildStaticLayer(const QVector<int> &excluded);
+    void beginDrag(const QVector<int> &excluded = QVector<int>());
+    void endDrag();
+    QRect previewDamage() const;
+    void preparePainter(QPainter &painter) const;
+    void updateScene(const QRect &sceneRect);
+    void viewChanged();
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,619 @@
+#include "pageddocument.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtMath>
+
+#include <algorithm>
+
+#include "profiler.h"
+
+namespace {
+
+const quint32 kPagedMagic = 0x44475047;   // "DGPG"
+// Версия 2 - файлы с символами; документы без символов пишутся версией 1,
+// и их по-прежнему читают старые версии программы
+const quint16 kPagedVersion = 2;
+const quint16 kPlainVersion = 1;
+// Флаг заголовка: после каталога записаны определения символов
+const quint16 kHasSymbolsFlag = 0x1;
+
+// Заголовок: магическое число, версия, флаги, сторона страницы, первый
+// свободный id, число страниц и положение каталога
+const qint64 kHeaderSize = 4 + 2 + 2 + 4 + 4 + 4 + 8;
+// Запись каталога: номер страницы на сетке, габарит, положение и длина
+const qint64 kDirectoryEntrySize = 2 * 4 + 4 * 4 + 8 + 4;
+// Размеры записей внутри страницы: фигура, связь, номер символа экземпляра
+const qint64 kFigureRecordSize = 6 * 4;
+const qint64 kEdgeRecordSize = 3 * 4;
+const qint64 kInstanceRecordSize = 2 * 4;
+
+// Сколько страниц держать загруженными сверх нужных виду
+const int kDefaultCacheLimit = 32;
+
+void setError(QString *errorMessage, const QString &message) {
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+}
+
+bool isFigureShape(qint32 shape) {
+    return shape == Rectangle || shape == Triangle || shape == Ellipse || shape == Instance;
+}
+
+int floorDiv(int value, int divisor) {
+    return value >= 0 ? value / divisor : -((-(value + 1)) / divisor) - 1;
+}
+
+} // namespace
+
+PagedDocument::PagedDocument()
+    : mapped(nullptr), pageSide(kPageSize), firstFreeId(1), cacheLimit(kDefaultCacheLimit) {}
+
+PagedDocument::~PagedDocument() {
+    reset();
+}
+
+quint64 PagedDocument::tileKey(const QPoint &tile) {
+    return (quint64(quint32(tile.x())) << 32) | quint32(tile.y());
+}
+
+QPoint PagedDocument::tileOf(const QRect &rect, int side) {
+    const QPoint center = rect.center();
+    return QPoint(floorDiv(center.x(), side), floorDiv(center.y(), side));
+}
+
+QByteArray PagedDocument::encode(const PageData &data) {
+    QByteArray bytes;
+    bytes.reserve(int(8 + data.figures.size() * kFigureRecordSize + data.edges.size() * kEdgeRecordSize));
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(data.figures.size());
+    for (const Figure &figure : data.figures) {
+        out << figure;
+    }
+    out << quint32(data.edges.size());
+    for (const PageEdge &edge : data.edges) {
+        out << edge.own << edge.other << edge.otherPage;
+    }
+    // Номера символов экземпляров: пары id - символ
+    int instances = 0;
+    for (const Figure &figure : data.figures) {
+        instances += figure.shape == Instance;
+    }
+    if (instances > 0) {
+        out << quint32(instances);
+        for (const Figure &figure : data.figures) {
+            if (figure.shape == Instance) {
+                out << qint32(figure.id) << qint32(figure.symbol);
+            }
+        }
+    }
+    return bytes;
+}
+
+bool PagedDocument::decode(const QByteArray &bytes, PageData &data) {
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 figureCount = 0;
+    in >> figureCount;
+    // Число записей проверяется по длине страницы до выделения памяти
+    if (in.status() != QDataStream::Ok || qint64(figureCount) * kFigureRecordSize > bytes.size()) {
+        return false;
+    }
+    data.figures.clear();
+    data.figures.reserve(int(figureCount));
+    for (quint32 i = 0; i < figureCount; ++i) {
+        Figure figure;
+        in >> figure;
+        if (isFigureShape(figure.shape)) {
+            data.figures.append(figure);
+        }
+    }
+    quint32 edgeCount = 0;
+    in >> edgeCount;
+    if (in.status() != QDataStream::Ok || qint64(edgeCount) * kEdgeRecordSize > bytes.size()) {
+        return false;
+    }
+    data.edges.clear();
+    data.edges.reserve(int(edgeCount));
+    for (quint32 i = 0; i < edgeCount; ++i) {
+        PageEdge edge;
+        in >> edge.own >> edge.other >> edge.otherPage;
+        data.edges.append(edge);
+    }
+    if (!in.atEnd()) {
+        quint32 instanceCount = 0;
+        in >> instanceCount;
+        if (in.status() != QDataStream::Ok || qint64(instanceCount) * kInstanceRecordSize > bytes.size()) {
+            return false;
+        }
+        // Пары идут по возрастанию id, как и фигуры
+        int next = 0;
+        for (quint32 i = 0; i < instanceCount; ++i) {
+            qint32 id = 0;
+            qint32 symbol = -1;
+            in >> id >> symbol;
+            while (next < data.figures.size() && data.figures[next].id < id) {
+                ++next;
+            }
+            if (next < data.figures.size() && data.figures[next].id == id) {
+                data.figures[next].symbol = symbol;
+            }
+        }
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool PagedDocument::writeFile(const QString &fileName, int pageSide, int nextId, const QVector<Page> &layout,
+                              const std::function<QByteArray(int)> &pageBytes, const SymbolLibrary &symbols,
+                              QVector<Page> *written, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::writeFile");
+    // Файл пишется рядом и подменяет прежний только целиком
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для записи");
+        return false;
+    }
+    QDataStream stream(&out);
+    stream.setVersion(QDataStream::Qt_5_0);
+    const bool hasSymbols = !symbols.isEmpty();
+    auto writeHeader = [&](quint64 directoryOffset) {
+        stream << kPagedMagic << (hasSymbols ? kPagedVersion : kPlainVersion)
+               << (hasSymbols ? kHasSymbolsFlag : quint16(0)) << qint32(pageSide) << qint32(nextId)
+               << quint32(layout.size()) << directoryOffset;
+    };
+    writeHeader(0);
+
+    // Страницы пишутся по одной: в памяти одновременно только одна закодированная страница
+    QVector<Page> result = layout;
+    for (int i = 0; i < layout.size(); ++i) {
+        const QByteArray bytes = pageBytes(i);
+        if (bytes.isEmpty()) {
+            out.cancelWriting();
+            setError(errorMessage, QString("Ошибка: не удалось прочитать страницу %1").arg(i));
+            return false;
+        }
+        result[i].offset = out.pos();
+        result[i].size = bytes.size();
+        result[i].inSwap = false;
+        stream.writeRawData(bytes.constData(), bytes.size());
+    }
+
+    const quint64 directoryOffset = quint64(out.pos());
+    for (const Page &page : result) {
+        stream << qint32(page.tile.x()) << qint32(page.tile.y()) << page.bounds << quint64(page.offset)
+               << quint32(page.size);
+    }
+    if (hasSymbols) {
+        stream << symbols;
+    }
+    out.seek(0);
+    writeHeader(directoryOffset);
+
+    if (stream.status() != QDataStream::Ok || !out.commit()) {
+        setError(errorMessage, "Ошибка записи файла");
+        return false;
+    }
+    if (written) {
+        *written = result;
+    }
+    return true;
+}
+
+bool PagedDocument::write(const QString &fileName, const Diagram &diagram, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::write");
+    // Фигуры раскладываются по страницам по своему центру
+    QVector<Page> layout;
+    QVector<PageData> data;
+    QHash<quint64, int> byTile;
+    QHash<int, int> pageOf;
+    pageOf.reserve(diagram.figureCount());
+    for (const Figure &figure : diagram.figures()) {
+        const QPoint tile = tileOf(figure.rect, kPageSize);
+        auto it = byTile.constFind(tileKey(tile));
+        int index = it != byTile.constEnd() ? it.value() : -1;
+        if (index == -1) {
+            index = layout.size();
+            byTile.insert(tileKey(tile), index);
+            layout.append(Page{ tile, QRect(), 0, 0, false, false, {}, {}, {} });
+            data.append(PageData());
+        }
+        data[index].figures.append(figure);
+        layout[index].bounds |= figure.rect.normalized();
+        pageOf.insert(figure.id, index);
+    }
+    // Связь внутри страницы пишется один раз, между страницами - на обеих
+    diagram.graph().forEachEdge([&](int a, int b) {
+        const int pageA = pageOf.value(a);
+        const int pageB = pageOf.value(b);
+        data[pageA].edges.append({ a, b, pageB });
+        if (pageA != pageB) {
+            data[pageB].edges.append({ b, a, pageA });
+        }
+    });
+    for (PageData &page : data) {
+        std::sort(page.edges.begin(), page.edges.end());
+    }
+    const int nextId = diagram.figures().isEmpty() ? 1 : diagram.figures().last().id + 1;
+    return writeFile(fileName, kPageSize, nextId, layout, [&](int index) { return encode(data[index]); },
+                     diagram.symbols(), nullptr, errorMessage);
+}
+
+bool PagedDocument::readAll(const QString &fileName, Diagram &diagram, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::readAll");
+    PagedDocument document;
+    if (!document.open(fileName, errorMessage)) {
+        return false;
+    }
+    QVector<Figure> figures;
+    QVector<Connection> connections;
+    for (int i = 0; i < document.pageCount(); ++i) {
+        PageData data;
+        if (!document.readPage(i, data)) {
+            setError(errorMessage, QString("Ошибка: страница %1 повреждена").arg(i));
+            return false;
+        }
+        document.symbols().resolve(data.figures);
+        figures += data.figures;
+        for (const PageEdge &edge : data.edges) {
+            // Связь между страницами записана дважды; берется копия с меньшим id в начале
+            if (edge.own < edge.other) {
+                connections.append({ edge.own, edge.other });
+            }
+        }
+    }
+    std::sort(figures.begin(), figures.end(), [](const Figure &a, const Figure &b) { return a.id < b.id; });
+    diagram.assign(figures, connections, document.symbols());
+    return true;
+}
+
+void PagedDocument::reset() {
+    if (mapped) {
+        file.unmap(mapped);
+        mapped = nullptr;
+    }
+    file.close();
+    swap.reset();
+    pages.clear();
+    pageByTile.clear();
+    owner.clear();
+    lru.clear();
+    library.clear();
+    firstFreeId = 1;
+    pageSide = kPageSize;
+}
+
+bool PagedDocument::open(const QString &fileName, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::open");
+    reset();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для чтения");
+        return false;
+    }
+    const qint64 size = file.size();
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint16 flags = 0;
+    qint32 side = 0;
+    qint32 nextId = 0;
+    quint32 pageCount = 0;
+    quint64 directoryOffset = 0;
+    in >> magic >> version >> flags >> side >> nextId >> pageCount >> directoryOffset;
+    if (in.status() != QDataStream::Ok || magic != kPagedMagic) {
+        setError(errorMessage, "Ошибка: файл не является страничным документом");
+        reset();
+        return false;
+    }
+    if (version > kPagedVersion) {
+        setError(errorMessage, QString("Ошибка: версия файла %1 новее поддерживаемой").arg(version));
+        reset();
+        return false;
+    }
+    if (side <= 0 || directoryOffset < quint64(kHeaderSize)
+        || directoryOffset + quint64(pageCount) * kDirectoryEntrySize > quint64(size)) {
+        setError(errorMessage, "Ошибка: каталог страниц поврежден");
+        reset();
+        return false;
+    }
+    pageSide = side;
+    firstFreeId = qMax(1, int(nextId));
+
+    // Читается только каталог; сами страницы - по мере надобности
+    file.seek(qint64(directoryOffset));
+    pages.reserve(int(pageCount));
+    for (quint32 i = 0; i < pageCount; ++i) {
+        qint32 x = 0;
+        qint32 y = 0;
+        QRect bounds;
+        quint64 offset = 0;
+        quint32 length = 0;
+        in >> x >> y >> bounds >> offset >> length;
+        if (in.status() != QDataStream::Ok || offset + length > directoryOffset) {
+            setError(errorMessage, "Ошибка: каталог страниц поврежден");
+            reset();
+            return false;
+        }
+        pageByTile.insert(tileKey(QPoint(x, y)), pages.size());
+        pages.append(Page{ QPoint(x, y), bounds, qint64(offset), qint64(length), false, false, {}, {}, {} });
+    }
+    if (flags & kHasSymbolsFlag) {
+        in >> library;
+        if (in.status() != QDataStream::Ok) {
+            setError(errorMessage, "Ошибка: определения символов повреждены");
+            reset();
+            return false;
+        }
+    }
+
+    // Отображение не читает файл: в память попадут только затронутые страницы.
+    // Если отобразить нельзя, страницы читаются обычным чтением.
+    mapped = file.map(0, size);
+    swap.reset(new QTemporaryFile);
+    if (!swap->open()) {
+        setError(errorMessage, "Ошибка: не удалось создать файл подкачки");
+        reset();
+        return false;
+    }
+    return true;
+}
+
+QByteArray PagedDocument::pageBytes(int index) {
+    const Page &page = pages[index];
+    QByteArray bytes;
+    if (page.inSwap) {
+        swap->seek(page.offset);
+        bytes = swap->read(page.size);
+    } else if (mapped) {
+        // Данные не копируются: массив смотрит прямо в отображенный файл
+        bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped + page.offset), int(page.size));
+    } else {
+        file.seek(page.offset);
+        bytes = file.read(page.size);
+    }
+    return bytes.size() == page.size ? bytes : QByteArray();
+}
+
+bool PagedDocument::readPage(int index, PageData &data) {
+    const QByteArray bytes = pageBytes(index);
+    return !bytes.isEmpty() && decode(bytes, data);
+}
+
+void PagedDocument::touch(int index) {
+    lru.removeOne(index);
+    lru.append(index);
+}
+
+bool PagedDocument::loadPage(Diagram &diagram, int index, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::loadPage");
+    PageData data;
+    if (!readPage(index, data)) {
+        setError(errorMessage, QString("Ошибка: страница %1 повреждена").arg(index));
+        return false;
+    }
+    // Экземпляры сверяются с символами рабочего набора: там и символы, созданные после открытия
+    diagram.symbols().resolve(data.figures);
+    Page &page = pages[index];
+    page.loaded = true;
+    page.ids.clear();
+    page.external.clear();
+    for (const Figure &figure : data.figures) {
+        owner.insert(figure.id, index);
+        page.ids.append(figure.id);
+    }
+
+    // Связи внутри страницы и с загруженными страницами сразу попадают в граф,
+    // остальные ждут вторую страницу
+    QVector<Connection> connections;
+    for (const PageEdge &edge : data.edges) {
+        if (edge.otherPage < 0 || edge.otherPage >= pages.size()) {
+            continue;
+        }
+        if (edge.otherPage == index || pages[edge.otherPage].loaded) {
+            connections.append({ edge.own, edge.other });
+        } else {
+            page.external.append(edge);
+        }
+    }
+    for (int other : lru) {
+        QVector<PageEdge> &waiting = pages[other].external;
+        for (int i = waiting.size() - 1; i >= 0; --i) {
+            if (waiting[i].otherPage == index) {
+                connections.append({ waiting[i].own, waiting[i].other });
+                waiting.remove(i);
+            }
+        }
+    }
+    page.original = data;
+    diagram.insertFigures(data.figures, connections);
+    touch(index);
+    return true;
+}
+
+PagedDocument::PageData PagedDocument::currentData(const Diagram &diagram, int index) const {
+    const Page &page = pages[index];
+    PageData data;
+    for (int id : page.ids) {
+        if (const Figure *figure = diagram.figure(id)) {
+            data.figures.append(*figure);
+        }
+    }
+    std::sort(data.figures.begin(), data.figures.end(), [](const Figure &a, const Figure &b) { return a.id < b.id; });
+    for (const Figure &figure : data.figures) {
+        for (int other : diagram.graph().neighbors(figure.id)) {
+            const int otherPage = owner.value(other, -1);
+            if (otherPage != -1 && (otherPage != index || figure.id < other)) {
+                data.edges.append({ figure.id, other, otherPage });
+            }
+        }
+    }
+    for (const PageEdge &edge : page.external) {
+        if (diagram.figure(edge.own)) {
+            data.edges.append(edge);
+        }
+    }
+    std::sort(data.edges.begin(), data.edges.end());
+    data.edges.erase(std::unique(data.edges.begin(), data.edges.end()), data.edges.end());
+    return data;
+}
+
+QRect PagedDocument::currentBounds(const Diagram &diagram, int index) const {
+    QRect bounds;
+    for (int id : pages[index].ids) {
+        if (const Figure *figure = diagram.figure(id)) {
+            bounds |= figure->rect.normalized();
+        }
+    }
+    return bounds;
+}
+
+bool PagedDocument::unloadPage(Diagram &diagram, int index, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::unloadPage");
+    Page &page = pages[index];
+    const PageData data = currentData(diagram, index);
+    if (data != page.original || page.size == 0) {
+        // Измененная или новая страница дописывается в конец файла подкачки
+        const QByteArray bytes = encode(data);
+        const qint64 offset = swap->size();
+        if (!swap->seek(offset) || swap->write(bytes) != bytes.size()) {
+            setError(errorMessage, "Ошибка: не удалось записать страницу в файл подкачки");
+            return false;
+        }
+        page.offset = offset;
+        page.size = bytes.size();
+        page.inSwap = true;
+    }
+    page.bounds = QRect();
+    QVector<int> live;
+    live.reserve(data.figures.size());
+    for (const Figure &figure : data.figures) {
+        page.bounds |= figure.rect.normalized();
+        live.append(figure.id);
+    }
+    // Связи с остающимися страницами теперь ждут эту страницу на них
+    for (const PageEdge &edge : data.edges) {
+        if (edge.otherPage != index && pages[edge.otherPage].loaded) {
+            pages[edge.otherPage].external.append({ edge.other, edge.own, index });
+        }
+    }
+    for (int id : page.ids) {
+        owner.remove(id);
+    }
+    diagram.removeFigures(live);
+    page.ids.clear();
+    page.original = PageData();
+    page.external.clear();
+    page.loaded = false;
+    lru.removeOne(index);
+    return true;
+}
+
+bool PagedDocument::adoptNewFigures(Diagram &diagram, QString *errorMessage) {
+    // Новые фигуры (и возвращенные отменой) собираются заранее:
+    // подгрузка страницы меняет список фигур
+    QVector<Figure> orphans;
+    for (const Figure &figure : diagram.figures()) {
+        if (!owner.contains(figure.id)) {
+            orphans.append(figure);
+        }
+    }
+    for (const Figure &figure : orphans) {
+        const QPoint tile = tileOf(figure.rect, pageSide);
+        int index = pageByTile.value(tileKey(tile), -1);
+        if (index == -1) {
+            // Пустая страница: на диске ее еще нет, при выгрузке она запишется в подкачку
+            index = pages.size();
+            pageByTile.insert(tileKey(tile), index);
+            pages.append(Page{ tile, QRect(), 0, 0, false, true, {}, {}, {} });
+            touch(index);
+        } else if (!pages[index].loaded && !loadPage(diagram, index, errorMessage)) {
+            return false;
+        }
+        owner.insert(figure.id, index);
+        pages[index].ids.append(figure.id);
+        firstFreeId = qMax(firstFreeId, figure.id + 1);
+    }
+    return true;
+}
+
+bool PagedDocument::sync(Diagram &diagram, const QRect &area, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::sync");
+    if (!adoptNewFigures(diagram, errorMessage)) {
+        return false;
+    }
+    // Каталог - пространственный индекс страниц: габарит загруженной страницы
+    // считается по ее фигурам, незагруженной - берется из каталога
+    QVector<int> wanted;
+    for (int i = 0; i < pages.size(); ++i) {
+        const QRect bounds = pages[i].loaded ? currentBounds(diagram, i) : pages[i].bounds;
+        if (bounds.intersects(area)) {
+            wanted.append(i);
+        }
+    }
+    for (int index : wanted) {
+        if (!pages[index].loaded && !loadPage(diagram, index, errorMessage)) {
+            return false;
+        }
+        touch(index);
+    }
+    // Нужные виду страницы теперь в конце списка, выгружаются самые старые из остальных
+    while (lru.size() > wanted.size() + cacheLimit) {
+        if (!unloadPage(diagram, lru.first(), errorMessage)) {
+            return false;
+        }
+    }
+    PROFILE_COUNTER("loaded pages", lru.size());
+    return true;
+}
+
+bool PagedDocument::save(const QString &fileName, Diagram &diagram, QString *errorMessage) {
+    PROFILE_SCOPE("PagedDocument::save");
+    // Фигуры, добавленные после последней подгрузки, тоже попадают в файл
+    if (!adoptNewFigures(diagram, errorMessage)) {
+        return false;
+    }
+    QHash<int, PageData> current;
+    QVector<Page> layout = pages;
+    for (int index : lru) {
+        current.insert(index, currentData(diagram, index));
+        layout[index].bounds = QRect();
+        for (const Figure &figure : current[index].figures) {
+            layout[index].bounds |= figure.rect.normalized();
+        }
+    }
+    QVector<Page> written;
+    const bool ok = writeFile(fileName, pageSide, firstFreeId, layout, [&](int index) {
+        return pages[index].loaded ? encode(current.value(index)) : pageBytes(index);
+    }, diagram.symbols(), &written, errorMessage);
+    if (!ok) {
+        return false;
+    }
+
+    // Дальше документ работает с новым файлом; подкачка больше не нужна
+    if (mapped) {
+        file.unmap(mapped);
+        mapped = nullptr;
+    }
+    file.close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть сохраненный файл");
+        return false;
+    }
+    mapped = file.map(0, file.size());
+    swap->resize(0);
+    library = diagram.symbols();
+    for (int i = 0; i < pages.size(); ++i) {
+        pages[i].bounds = written[i].bounds;
+        pages[i].offset = written[i].offset;
+        pages[i].size = written[i].size;
+        pages[i].inSwap = false;
+        if (pages[i].loaded) {
+            pages[i].original = current.value(i);
+        }
+    }
+    return true;
+}
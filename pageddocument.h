@@ -0,0 +1,133 @@
+// pageddocument.h
+
+#ifndef PAGEDDOCUMENT_H
+#define PAGEDDOCUMENT_H
+
+#include <QFile>
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QScopedPointer>
+#include <QString>
+#include <QTemporaryFile>
+#include <QVector>
+
+#include <functional>
+
+#include "diagram.h"
+
+// Страничный документ (*.dgp) для диаграмм, которые не помещаются в память.
+// Сцена разбита на квадратные страницы фиксированного размера; фигура лежит
+// на странице, в которую попал ее центр при записи, и остается на ней при сдвиге.
+// В конце файла - каталог страниц с их габаритами: по нему находятся страницы,
+// задевающие вид, без чтения самих страниц. Файл отображается в память, и
+// разбираются только нужные страницы.
+//
+// В редакторе Diagram держит фигуры только загруженных страниц. sync() подгружает
+// страницы вида и выгружает давно не нужные (LRU); измененная страница при
+// выгрузке дописывается во временный файл подкачки, исходный файл до сохранения
+// не меняется. Связь между страницами хранится на обеих; пока вторая страница
+// не загружена, связь ждет ее в списке внешних связей первой.
+// Определения символов невелики и лежат после каталога целиком; экземпляры
+// хранятся на страницах как обычные фигуры с номером символа.
+class PagedDocument {
+public:
+    // Сторона страницы в единицах сцены
+    static const int kPageSize = 2048;
+
+    // Запись всего документа в страничном формате
+    static bool write(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr);
+    // Чтение всех страниц сразу (пакетный режим и обычная загрузка); при ошибке diagram не меняется
+    static bool readAll(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr);
+
+    PagedDocument();
+    ~PagedDocument();
+
+    // Открытие файла: читаются только заголовок и каталог страниц
+    bool open(const QString &fileName, QString *errorMessage = nullptr);
+    QString fileName() const { return file.fileName(); }
+    // Первый свободный id во всем документе, включая невыгруженные страницы
+    int nextId() const { return firstFreeId; }
+    // Символы файла; рабочий набор получает их при открытии
+    const SymbolLibrary &symbols() const { return library; }
+    int pageCount() const { return pages.size(); }
+    int loadedPageCount() const { return lru.size(); }
+    // Сколько страниц держать загруженными сверх нужных виду
+    void setCacheLimit(int pageCount) { cacheLimit = qMax(1, pageCount); }
+
+    // Подгрузка страниц, задевающих область сцены, и выгрузка лишних.
+    // diagram - рабочий набор: фигуры загруженных страниц и новые фигуры.
+    bool sync(Diagram &diagram, const QRect &area, QString *errorMessage = nullptr);
+    // Запись всех страниц в новый файл; после успеха документ работает с ним.
+    // Новые фигуры перед записью приписываются к страницам, как в sync().
+    bool save(const QString &fileName, Diagram &diagram, QString *errorMessage = nullptr);
+
+private:
+    // Связь фигуры own этой страницы с фигурой other страницы otherPage
+    struct PageEdge {
+        qint32 own;
+        qint32 other;
+        qint32 otherPage;
+
+        bool operator==(const PageEdge &o) const { return own == o.own && other == o.other && otherPage == o.otherPage; }
+        bool operator<(const PageEdge &o) const {
+            return own != o.own ? own < o.own : (other != o.other ? other < o.other : otherPage < o.otherPage);
+        }
+    };
+
+    // Содержимое страницы: фигуры по возрастанию id и связи (внутренние - один раз, own < other)
+    struct PageData {
+        QVector<Figure> figures;
+        QVector<PageEdge> edges;
+
+        bool operator==(const PageData &o) const { return figures == o.figures && edges == o.edges; }
+        bool operator!=(const PageData &o) const { return !(*this == o); }
+    };
+
+    struct Page {
+        QPoint tile;            // Номер страницы на сетке сцены
+        QRect bounds;           // Габарит фигур страницы; пустой у пустой страницы
+        qint64 offset;          // Положение закодированной страницы в файле или в подкачке
+        qint64 size;
+        bool inSwap;            // Страница лежит в файле подкачки
+        bool loaded;
+        QVector<int> ids;       // Id фигур загруженной страницы, включая удаленные
+        PageData original;      // Содержимое на момент загрузки, для проверки изменений
+        QVector<PageEdge> external;  // Связи загруженной страницы с незагруженными
+    };
+
+    QFile file;
+    uchar *mapped;              // Весь файл в памяти или nullptr, если отобразить не удалось
+    int pageSide;               // Сторона страницы этого файла
+    QScopedPointer<QTemporaryFile> swap;
+    QVector<Page> pages;
+    QHash<quint64, int> pageByTile;
+    QHash<int, int> owner;      // Страница каждой загруженной фигуры
+    QVector<int> lru;           // Загруженные страницы, последняя - самая свежая
+    SymbolLibrary library;
+    int firstFreeId;
+    int cacheLimit;
+
+    static quint64 tileKey(const QPoint &tile);
+    static QPoint tileOf(const QRect &rect, int side);
+    static QByteArray encode(const PageData &data);
+    static bool decode(const QByteArray &bytes, PageData &data);
+    // Запись файла: страницы layout по порядку, их байты дает pageBytes (пустой
+    // результат - ошибка чтения), после каталога - символы; в written - каталог записанного файла
+    static bool writeFile(const QString &fileName, int pageSide, int nextId, const QVector<Page> &layout,
+                          const std::function<QByteArray(int)> &pageBytes, const SymbolLibrary &symbols,
+                          QVector<Page> *written, QString *errorMessage);
+
+    void reset();
+    QByteArray pageBytes(int index);
+    bool readPage(int index, PageData &data);
+    bool loadPage(Diagram &diagram, int index, QString *errorMessage);
+    bool unloadPage(Diagram &diagram, int index, QString *errorMessage);
+    void touch(int index);
+    // Новые фигуры рабочего набора приписываются к страницам по центру
+    bool adoptNewFigures(Diagram &diagram, QString *errorMessage);
+    PageData currentData(const Diagram &diagram, int index) const;
+    QRect currentBounds(const Diagram &diagram, int index) const;
+};
+
+#endif // PAGEDDOCUMENT_H
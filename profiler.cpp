@@ -0,0 +1,129 @@
+#include "profiler.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+std::atomic<bool> Profiler::enabled(false);
+
+namespace {
+// Запись останавливается на этом числе событий, чтобы долгая сессия не съела память
+const int kMaxEvents = 1 << 20;
+
+struct TraceEvent {
+    const char *name;
+    qint64 start;     // нс
+    qint64 duration;  // нс; -1 у счетчиков
+    qint64 value;     // Значение счетчика
+    quintptr thread;
+};
+
+QMutex eventsMutex;
+QVector<TraceEvent> events;
+int droppedEvents = 0;
+
+// Общие часы сессии: запускаются при первом обращении
+const QElapsedTimer &sessionClock() {
+    static const QElapsedTimer timer = [] {
+        QElapsedTimer started;
+        started.start();
+        return started;
+    }();
+    return timer;
+}
+
+void append(const TraceEvent &event) {
+    QMutexLocker locker(&eventsMutex);
+    if (events.size() >= kMaxEvents) {
+        ++droppedEvents;
+        return;
+    }
+    events.append(event);
+}
+}
+
+void Profiler::setEnabled(bool on) {
+    sessionClock();
+    enabled = on;
+}
+
+qint64 Profiler::now() {
+    return sessionClock().nsecsElapsed();
+}
+
+void Profiler::record(const char *name, qint64 start, qint64 duration) {
+    append({ name, start, duration, 0, quintptr(QThread::currentThreadId()) });
+}
+
+void Profiler::counter(const char *name, qint64 value) {
+    append({ name, now(), -1, value, quintptr(QThread::currentThreadId()) });
+}
+
+int Profiler::eventCount() {
+    QMutexLocker locker(&eventsMutex);
+    return events.size();
+}
+
+void Profiler::clear() {
+    QMutexLocker locker(&eventsMutex);
+    events.clear();
+    droppedEvents = 0;
+}
+
+bool Profiler::writeChromeTrace(const QString &fileName, QString *errorMessage) {
+    QVector<TraceEvent> snapshot;
+    int dropped = 0;
+    {
+        QMutexLocker locker(&eventsMutex);
+        snapshot = events;
+        dropped = droppedEvents;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (errorMessage) {
+            *errorMessage = "Ошибка: не удалось открыть файл для записи";
+        }
+        return false;
+    }
+    // Имена событий - строковые литералы из кода, экранировать их не нужно.
+    // Время в формате Chrome Trace задается в микросекундах.
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << dropped << "},\"traceEvents\":[\n";
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const TraceEvent &event = snapshot[i];
+        out << "{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << QString::number(event.start / 1000.0, 'f', 3);
+        if (event.duration >= 0) {
+            out << ",\"ph\":\"X\",\"dur\":" << QString::number(event.duration / 1000.0, 'f', 3) << "}";
+        } else {
+            out << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+        }
+        out << (i + 1 < snapshot.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+qint64 Profiler::residentMemory() {
+#ifdef Q_OS_LINUX
+    // Второе поле statm - число страниц в физической памяти
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return -1;
+}
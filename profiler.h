@@ -0,0 +1,67 @@
+// profiler.h
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+
+#include <atomic>
+
+// Легкие замеры времени горячих путей и запись их в формате Chrome Trace.
+// Пока запись выключена, замер стоит одной проверки атомарного флага.
+// Сборка с DEFINES += DIAGRAM_NO_PROFILING убирает замеры полностью.
+class Profiler {
+public:
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on);
+
+    // Наносекунды от запуска программы
+    static qint64 now();
+    // Завершенный интервал; name должен жить до конца программы (строковый литерал)
+    static void record(const char *name, qint64 start, qint64 duration);
+    // Значение счетчика в текущий момент
+    static void counter(const char *name, qint64 value);
+
+    static int eventCount();
+    static void clear();
+    // Все записанные события в формате JSON для chrome://tracing и Perfetto
+    static bool writeChromeTrace(const QString &fileName, QString *errorMessage = nullptr);
+
+    // Занятая процессом физическая память в байтах или -1, если неизвестно
+    static qint64 residentMemory();
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// Замер времени до конца области видимости
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name)
+        : name(name), start(Profiler::isEnabled() ? Profiler::now() : -1) {}
+    ~ProfileScope() {
+        if (start >= 0) {
+            Profiler::record(name, start, Profiler::now() - start);
+        }
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name;
+    qint64 start;
+};
+
+#ifdef DIAGRAM_NO_PROFILING
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNTER(name, value)
+#else
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) \
+    do { if (Profiler::isEnabled()) Profiler::counter(name, value); } while (false)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,417 @@
+#include "scenerenderer.h"
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.h"
+
+namespace {
+// Запас на перо и сглаживание вокруг изменившейся области
+const int kPaintMargin = 2;
+// Ниже этого масштаба фигуры рисуются упрощенно, залитыми прямоугольниками
+const qreal kCoarseScale = 0.35;
+// Фигуры и связи меньше этого размера в пикселях окна не рисуются
+const qreal kMinPixelSize = 1.0;
+
+// Картинки символов: поле вокруг под перо, предельный размер стороны
+// и объем кэша в КиБ
+const int kSymbolImageMargin = 2;
+const int kMaxSymbolImageSide = 2048;
+const int kSymbolCacheKiB = 64 * 1024;
+
+// Картинка символа зависит от символа, ступени масштаба и цвета пера
+struct SymbolImageKey {
+    quint64 symbol;
+    int step;
+    uint color;
+
+    bool operator==(const SymbolImageKey &other) const {
+        return symbol == other.symbol && step == other.step && color == other.color;
+    }
+};
+
+uint qHash(const SymbolImageKey &key, uint seed = 0) {
+    return ::qHash(key.symbol, seed) ^ (uint(key.step) * 31u) ^ key.color;
+}
+
+// Общий для всех документов и потоков отрисовки тайлов. Хранятся QImage:
+// QPixmap нельзя создавать вне главного потока
+QMutex symbolCacheMutex;
+QCache<SymbolImageKey, QImage> symbolCache(kSymbolCacheKiB);
+}
+
+SceneRenderer::SceneRenderer(const Diagram &diagram) : diagram(diagram), viewScale(1.0) {}
+
+void SceneRenderer::drawFigure(QPainter &painter, Shape shape, const QRect &rect) {
+    switch (shape) {
+    case Rectangle:
+        painter.drawRect(rect);
+        break;
+    case Triangle: {
+        QPoint points[3] = {
+            QPoint(rect.left(), rect.bottom()),
+            QPoint(rect.right(), rect.bottom()),
+            QPoint(rect.center().x(), rect.top())
+        };
+        painter.drawPolygon(points, 3);
+        break;
+    }
+    case Ellipse:
+        painter.drawEllipse(rect);
+        break;
+    default:
+        break;
+    }
+}
+
+void SceneRenderer::drawSymbol(QPainter &painter, const SymbolLibrary &symbols, int symbol, const QPoint &topLeft) {
+    const Symbol *definition = symbols.symbol(symbol);
+    if (!definition) {
+        return;
+    }
+    for (const Figure &figure : definition->figures) {
+        if (figure.shape == Instance) {
+            drawSymbol(painter, symbols, figure.symbol, topLeft + figure.rect.topLeft());
+        } else {
+            drawFigure(painter, figure.shape, figure.rect.translated(topLeft));
+        }
+    }
+    QVector<QLine> lines;
+    lines.reserve(definition->connections.size());
+    for (const Connection &connection : definition->connections) {
+        lines.append(QLine(definition->figures[connection.from].rect.center() + topLeft,
+                           definition->figures[connection.to].rect.center() + topLeft));
+    }
+    painter.drawLines(lines);
+}
+
+void SceneRenderer::drawInstance(QPainter &painter, int symbol, const QRect &rect) const {
+    const Symbol *definition = diagram.symbols().symbol(symbol);
+    if (!definition) {
+        return;
+    }
+    // Масштаб округляется до ступеней в четверть октавы: одна картинка
+    // служит для близких масштабов и растягивается не больше чем на 9%
+    const qreal ratio = painter.device() ? painter.device()->devicePixelRatioF() : 1.0;
+    const int step = qRound(std::log2(viewScale * ratio) * 4);
+    const qreal scale = std::exp2(step / 4.0);
+    const QSize size(qCeil(definition->bounds.width() * scale) + 2 * kSymbolImageMargin,
+                     qCeil(definition->bounds.height() * scale) + 2 * kSymbolImageMargin);
+    if (qMax(size.width(), size.height()) > kMaxSymbolImageSide) {
+        drawSymbol(painter, diagram.symbols(), symbol, rect.topLeft());
+        return;
+    }
+
+    const SymbolImageKey key = { definition->key, step, painter.pen().color().rgba() };
+    QImage image;
+    {
+        QMutexLocker locker(&symbolCacheMutex);
+        if (const QImage *cached = symbolCache.object(key)) {
+            image = *cached;
+        }
+    }
+    if (image.isNull()) {
+        // Картинка рисуется без блокировки; если два потока нарисуют ее
+        // одновременно, в кэше останется одна из одинаковых копий
+        image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter imagePainter(&image);
+        imagePainter.setTransform(QTransform(scale, 0, 0, scale, kSymbolImageMargin, kSymbolImageMargin));
+        QPen pen(painter.pen().color());
+        pen.setCosmetic(true);
+        imagePainter.setPen(pen);
+        drawSymbol(imagePainter, diagram.symbols(), symbol, QPoint(0, 0));
+        imagePainter.end();
+        QMutexLocker locker(&symbolCacheMutex);
+        symbolCache.insert(key, new QImage(image), qMax(1, int(image.sizeInBytes() / 1024)));
+    }
+    const qreal margin = kSymbolImageMargin / scale;
+    painter.drawImage(QRectF(rect.left() - margin, rect.top() - margin, size.width() / scale, size.height() / scale),
+                      image);
+}
+
+void SceneRenderer::drawFigureOf(QPainter &painter, const Figure &figure) const {
+    if (figure.shape == Instance) {
+        drawInstance(painter, figure.symbol, figure.rect);
+    } else {
+        drawFigure(painter, figure.shape, figure.rect);
+    }
+}
+
+QRect SceneRenderer::paintBounds(const QRect &rect) {
+    return rect.normalized().adjusted(-kPaintMargin, -kPaintMargin, kPaintMargin, kPaintMargin);
+}
+
+QRect SceneRenderer::lineBounds(const QPoint &from, const QPoint &to) {
+    return paintBounds(QRect(from, to));
+}
+
+void SceneRenderer::collect(Batches &batches, Shape shape, const QRect &rect, const QLine *outline, int symbol) const {
+    // Минимальный размер в единицах сцены, различимый на экране
+    const QRect bounds = rect.normalized();
+    if (qMax(bounds.width(), bounds.height()) < kMinPixelSize / viewScale) {
+        return;
+    }
+    if (viewScale < kCoarseScale) {
+        batches.boxes.append(bounds);
+        return;
+    }
+    switch (shape) {
+    case Rectangle:
+        batches.rects.append(rect);
+        break;
+    case Triangle:
+        if (outline) {
+            batches.triangles.append(outline[0]);
+            batches.triangles.append(outline[1]);
+            batches.triangles.append(outline[2]);
+        } else {
+            FigureStore::appendTriangleOutline(batches.triangles, rect);
+        }
+        break;
+    case Ellipse:
+        batches.ellipses.append(rect);
+        break;
+    case Instance:
+        batches.instances.append(rect);
+        batches.instanceSymbols.append(symbol);
+        break;
+    default:
+        break;
+    }
+}
+
+void SceneRenderer::drawBatches(QPainter &painter, const Batches &batches) const {
+    if (!batches.boxes.isEmpty()) {
+        // Упрощенная отрисовка: одна пакетная заливка вместо контуров каждой фигуры
+        const QColor color = painter.pen().color();
+        painter.save();
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(color);
+        painter.drawRects(batches.boxes);
+        painter.restore();
+    }
+    painter.drawRects(batches.rects);
+    painter.drawLines(batches.triangles);
+    // Пакетного вызова для эллипсов у QPainter нет, но цикл идет по
+    // непрерывному массиву без разбора типа каждой фигуры
+    for (const QRect &rect : batches.ellipses) {
+        painter.drawEllipse(rect);
+    }
+    for (int i = 0; i < batches.instances.size(); ++i) {
+        drawInstance(painter, batches.instanceSymbols[i], batches.instances[i]);
+    }
+}
+
+void SceneRenderer::render(QPainter &painter, const QRect &area, const QVector<int> &excluded) const {
+    PROFILE_SCOPE("SceneRenderer::render");
+    const bool coarse = viewScale < kCoarseScale;
+    const qreal minSceneSize = kMinPixelSize / viewScale;
+    const FigureStore &store = diagram.store();
+
+    // Видимые фигуры собираются в буферы по типам, и каждый тип рисуется одним
+    // пакетом. Фигуры рисуются контуром без заливки, поэтому порядок пакетов
+    // не меняет картинку, а внутри пакета сохраняется порядок по оси Z.
+    Batches batches;
+    auto isExcluded = [&](int id) {
+        return !excluded.isEmpty() && std::binary_search(excluded.constBegin(), excluded.constEnd(), id);
+    };
+
+    const QVector<int> ids = diagram.figuresIn(area.adjusted(-kPaintMargin, -kPaintMargin, kPaintMargin, kPaintMargin));
+    if (ids.size() == diagram.figureCount()) {
+        // Видна вся сцена: массивы хранилища обходятся подряд, без поиска
+        // фигур по id; контуры треугольников берутся готовыми
+        const Shape shapes[] = { Rectangle, Triangle, Ellipse, Instance };
+        for (Shape shape : shapes) {
+            const QVector<int> &shapeIds = store.ids(shape);
+            const QVector<QRect> &shapeRects = store.rects(shape);
+            const QLine *outlines = shape == Triangle ? store.triangleOutlines().constData() : nullptr;
+            const int *symbols = shape == Instance ? store.instanceSymbols().constData() : nullptr;
+            for (int i = 0; i < shapeIds.size(); ++i) {
+                if (!isExcluded(shapeIds[i])) {
+                    collect(batches, shape, shapeRects[i], outlines ? outlines + 3 * i : nullptr,
+                            symbols ? symbols[i] : -1);
+                }
+            }
+        }
+    } else {
+        // Фигуры из области берутся из сетки в порядке id (порядке по оси Z)
+        QVector<int> sorted = ids;
+        std::sort(sorted.begin(), sorted.end());
+        for (int id : sorted) {
+            if (!isExcluded(id)) {
+                const Figure *figure = diagram.figure(id);
+                collect(batches, figure->shape, figure->rect, nullptr, figure->symbol);
+            }
+        }
+    }
+    drawBatches(painter, batches);
+
+    // Связи области берутся из сетки отрезков, поэтому цена зависит от числа
+    // видимых связей, а не от всех ребер графа; видимые собираются в один
+    // массив и рисуются одним вызовом
+    QVector<QLine> lines;
+    for (const Connection &connection : diagram.connectionsIn(paintBounds(area))) {
+        if (isExcluded(connection.from) || isExcluded(connection.to)) {
+            continue;
+        }
+        const QPoint a = diagram.figure(connection.from)->rect.center();
+        const QPoint b = diagram.figure(connection.to)->rect.center();
+        if (!lineBounds(a, b).intersects(area)) {
+            continue;
+        }
+        if (coarse && (b - a).manhattanLength() < minSceneSize) {
+            continue;
+        }
+        lines.append(QLine(a, b));
+    }
+    painter.drawLines(lines);
+}
+
+void SceneRenderer::renderBinned(QPainter &painter, const QVector<int> &ids, const QVector<QLine> &lines) const {
+    Batches batches;
+    for (int id : ids) {
+        const Figure *figure = diagram.figure(id);
+        if (figure) {
+            collect(batches, figure->shape, figure->rect, nullptr, figure->symbol);
+        }
+    }
+    drawBatches(painter, batches);
+    if (viewScale >= kCoarseScale) {
+        painter.drawLines(lines);
+        return;
+    }
+    // При мелком масштабе связи короче пикселя пропускаются, как в render()
+    const qreal minSceneSize = kMinPixelSize / viewScale;
+    QVector<QLine> visible;
+    visible.reserve(lines.size());
+    for (const QLine &line : lines) {
+        if ((line.p2() - line.p1()).manhattanLength() >= minSceneSize) {
+            visible.append(line);
+        }
+    }
+    painter.drawLines(visible);
+}
+
+void SceneRenderer::renderFiguresWithConnections(QPainter &painter, const QVector<int> &ids) const {
+    QVector<QLine> lines;
+    for (int id : ids) {
+        const Figure *figure = diagram.figure(id);
+        if (!figure) {
+            continue;
+        }
+        drawFigureOf(painter, *figure);
+        const QPoint center = figure->rect.center();
+        for (int other : diagram.graph().neighbors(id)) {
+            lines.append(QLine(center, diagram.figure(other)->rect.center()));
+        }
+    }
+    painter.drawLines(lines);
+}
+
+void SceneRenderer::renderSelection(QPainter &painter, const QRect &area, const QVector<int> &ids) const {
+    QVector<QRect> frames;
+    for (int id : ids) {
+        const Figure *figure = diagram.figure(id);
+        if (figure && figure->rect.intersects(area)) {
+            // Рамка лежит внутри запаса paintBounds, поэтому область перерисовки фигуры ее покрывает
+            frames.append(figure->rect.normalized().adjusted(-1, -1, 1, 1));
+        }
+    }
+    if (frames.isEmpty()) {
+        return;
+    }
+    painter.save();
+    QPen pen(QColor(0, 120, 215), 0, Qt::DashLine);
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+    painter.setBrush(Qt::NoBrush);
+    painter.drawRects(frames);
+    painter.restore();
+}
+
+void SceneRenderer::renderConnectionSelection(QPainter &painter, const Connection &connection) const {
+    if (!diagram.graph().hasEdge(connection.from, connection.to)) {
+        return;
+    }
+    painter.save();
+    QPen pen(QColor(0, 120, 215), 3);
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+    painter.drawLine(diagram.connectionLine(connection.from, connection.to));
+    painter.restore();
+}
+
+void SceneRenderer::renderHighlight(QPainter &painter, const QRect &area, const Highlight &highlight) const {
+    if (highlight.isEmpty()) {
+        return;
+    }
+    static const QColor palette[] = {
+        QColor(230, 25, 75), QColor(60, 180, 75), QColor(0, 130, 200), QColor(245, 130, 48),
+        QColor(145, 30, 180), QColor(70, 240, 240), QColor(240, 50, 230), QColor(128, 128, 0)
+    };
+    const int paletteSize = int(sizeof(palette) / sizeof(palette[0]));
+
+    painter.save();
+    QPen pen(palette[0], 2);
+    pen.setCosmetic(true);
+    painter.setBrush(Qt::NoBrush);
+
+    // Подсвеченные фигуры ищутся среди видимых, а не наоборот: подсветка
+    // может охватывать весь документ, а видна обычно малая его часть
+    const QVector<int> visible = diagram.figuresIn(area);
+    int color = -1;
+    for (int id : visible) {
+        auto it = std::lower_bound(highlight.figures.constBegin(), highlight.figures.constEnd(), id);
+        if (it == highlight.figures.constEnd() || *it != id) {
+            continue;
+        }
+        const int group = highlight.groups.isEmpty() ? 0 : highlight.groups[int(it - highlight.figures.constBegin())];
+        if (group % paletteSize != color) {
+            color = group % paletteSize;
+            pen.setColor(palette[color]);
+            painter.setPen(pen);
+        }
+        drawFigureOf(painter, *diagram.figure(id));
+    }
+
+    QVector<QLine> lines;
+    for (const Connection &connection : highlight.connections) {
+        const Figure *from = diagram.figure(connection.from);
+        const Figure *to = diagram.figure(connection.to);
+        if (from && to && lineBounds(from->rect.center(), to->rect.center()).intersects(area)) {
+            lines.append(QLine(from->rect.center(), to->rect.center()));
+        }
+    }
+    pen.setColor(palette[0]);
+    painter.setPen(pen);
+    painter.drawLines(lines);
+    painter.restore();
+}
+
+QRect SceneRenderer::figureDamage(int id) const {
+    const Figure *figure = diagram.figure(id);
+    if (!figure) {
+        return QRect();
+    }
+    QRect damage = paintBounds(figure->rect);
+    const QPoint center = figure->rect.center();
+    for (int other : diagram.graph().neighbors(id)) {
+        damage |= lineBounds(center, diagram.figure(other)->rect.center());
+    }
+    return damage;
+}
+
+QRect SceneRenderer::figuresDamage(const QVector<int> &ids) const {
+    QRect damage;
+    for (int id : ids) {
+        damage |= figureDamage(id);
+    }
+    return damage;
+}
@@ -0,0 +1,83 @@
+// scenerenderer.h
+
+#ifndef SCENERENDERER_H
+#define SCENERENDERER_H
+
+#include <QPainter>
+#include <QRect>
+
+#include "diagram.h"
+
+// Подсветка результатов запросов к графу
+struct Highlight {
+    QVector<int> figures;          // Id по возрастанию
+    QVector<int> groups;           // Номер группы (цвета) для каждой фигуры; пусто - один цвет
+    QVector<Connection> connections;
+
+    bool isEmpty() const { return figures.isEmpty() && connections.isEmpty(); }
+};
+
+// Отрисовка документа. Вынесена из MainWindow, чтобы рисовать
+// только нужную область и собирать кэшированные слои сцены.
+class SceneRenderer {
+public:
+    explicit SceneRenderer(const Diagram &diagram);
+
+    // Масштаб вида: от него зависит уровень детализации
+    void setScale(qreal scale) { viewScale = scale; }
+
+    // Отрисовка фигур и связей, пересекающих область сцены; фигуры excluded
+    // (отсортированные id) и их связи пропускаются (их рисует вызывающий код поверх кэша).
+    // При мелком масштабе фигуры рисуются залитыми прямоугольниками,
+    // а фигуры и связи меньше пикселя пропускаются.
+    void render(QPainter &painter, const QRect &area, const QVector<int> &excluded = QVector<int>()) const;
+    // Отрисовка уже отобранных фигур (id по возрастанию) и отрезков связей теми же
+    // пакетами и с той же детализацией, что и render(); так рисуются тайлы
+    void renderBinned(QPainter &painter, const QVector<int> &ids, const QVector<QLine> &lines) const;
+    // Отрисовка группы фигур вместе с их связями
+    void renderFiguresWithConnections(QPainter &painter, const QVector<int> &ids) const;
+    // Рамки выделения вокруг фигур ids, попавших в область
+    void renderSelection(QPainter &painter, const QRect &area, const QVector<int> &ids) const;
+    // Выделенная связь поверх сцены; { -1, -1 } - ничего не рисуется
+    void renderConnectionSelection(QPainter &painter, const Connection &connection) const;
+
+    // Подсветка поверх сцены; рисуются только фигуры и связи из области
+    void renderHighlight(QPainter &painter, const QRect &area, const Highlight &highlight) const;
+
+    // Область, которую фигура и ее связи занимают на экране
+    QRect figureDamage(int id) const;
+    QRect figuresDamage(const QVector<int> &ids) const;
+
+    static void drawFigure(QPainter &painter, Shape shape, const QRect &rect);
+    // Векторная отрисовка фигур и связей символа с левым верхним углом в topLeft
+    static void drawSymbol(QPainter &painter, const SymbolLibrary &symbols, int symbol, const QPoint &topLeft);
+    // Прямоугольник с запасом на толщину пера
+    static QRect paintBounds(const QRect &rect);
+    static QRect lineBounds(const QPoint &from, const QPoint &to);
+
+private:
+    // Буферы отрисовки по типам фигур
+    struct Batches {
+        QVector<QRect> rects;
+        QVector<QLine> triangles;
+        QVector<QRect> ellipses;
+        QVector<QRect> instances;
+        QVector<int> instanceSymbols;  // Параллельно instances
+        QVector<QRect> boxes;      // Упрощенные фигуры при мелком масштабе
+    };
+
+    const Diagram &diagram;
+    qreal viewScale;
+
+    // outline - готовый контур треугольника из хранилища или nullptr;
+    // symbol - номер символа экземпляра
+    void collect(Batches &batches, Shape shape, const QRect &rect, const QLine *outline, int symbol = -1) const;
+    void drawBatches(QPainter &painter, const Batches &batches) const;
+    // Отрисовка одной фигуры; экземпляр рисуется картинкой символа
+    void drawFigureOf(QPainter &painter, const Figure &figure) const;
+    // Экземпляр рисуется готовой картинкой символа для текущего масштаба и цвета пера;
+    // слишком крупные символы рисуются векторно
+    void drawInstance(QPainter &painter, int symbol, const QRect &rect) const;
+};
+
+#endif // SCENERENDERER_H
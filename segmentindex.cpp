@@ -0,0 +1,206 @@
+#include "segmentindex.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace {
+// Отрезок, проходящий через большее число ячеек, попадает в список длинных отрезков
+const int kMaxCellsPerEntry = 512;
+
+// Квадрат расстояния от точки до отрезка
+double distanceSquared(const QPoint &point, const QLine &line) {
+    const double ax = line.x1();
+    const double ay = line.y1();
+    const double dx = line.x2() - ax;
+    const double dy = line.y2() - ay;
+    const double length = dx * dx + dy * dy;
+    double t = 0;
+    if (length > 0) {
+        t = qBound(0.0, ((point.x() - ax) * dx + (point.y() - ay) * dy) / length, 1.0);
+    }
+    const double ex = ax + t * dx - point.x();
+    const double ey = ay + t * dy - point.y();
+    return ex * ex + ey * ey;
+}
+}
+
+SegmentIndex::SegmentIndex(int cellSize)
+    : cellSize(qMax(1, cellSize)), count(0) {}
+
+int SegmentIndex::cellCoord(int v) const {
+    // Деление с округлением вниз, как в SpatialIndex
+    return v >= 0 ? v / cellSize : -((-(v + 1)) / cellSize) - 1;
+}
+
+quint64 SegmentIndex::cellKey(int cx, int cy) {
+    return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+bool SegmentIndex::removeEntry(QVector<Entry> &list, const Connection &edge) {
+    for (int i = 0; i < list.size(); ++i) {
+        if (list[i].edge == edge) {
+            list[i] = list.last();
+            list.removeLast();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SegmentIndex::isOversized(const QLine &line) const {
+    // Отрезок проходит не больше чем через (ширина + высота) ячеек своего габарита
+    const qint64 columns = qAbs(qint64(cellCoord(line.x2())) - cellCoord(line.x1())) + 1;
+    const qint64 rows = qAbs(qint64(cellCoord(line.y2())) - cellCoord(line.y1())) + 1;
+    return columns + rows > kMaxCellsPerEntry;
+}
+
+template <typename Func>
+void SegmentIndex::forEachCell(const QLine &line, Func func) const {
+    // Отрезок обходится по столбцам ячеек; в каждом столбце он занимает
+    // непрерывный диапазон строк между его высотами на краях столбца.
+    // Правый край берется по началу следующего столбца: точки отрезка
+    // с дробной x между ними тоже лежат в этом столбце.
+    QPoint a = line.p1();
+    QPoint b = line.p2();
+    if (a.x() > b.x()) {
+        std::swap(a, b);
+    }
+    const qint64 width = qint64(b.x()) - a.x();
+    const qint64 height = qint64(b.y()) - a.y();
+    auto yAt = [&](int x) { return int(a.y() + height * (qint64(x) - a.x()) / width); };
+    const int firstColumn = cellCoord(a.x());
+    const int lastColumn = cellCoord(b.x());
+    for (int cx = firstColumn; cx <= lastColumn; ++cx) {
+        const int x0 = qMax(a.x(), cx * cellSize);
+        const int x1 = qMin(b.x(), cx * cellSize + cellSize);
+        const int y0 = width == 0 ? a.y() : yAt(x0);
+        const int y1 = width == 0 ? b.y() : yAt(x1);
+        // Запас в единицу покрывает округление при делении
+        const int firstRow = cellCoord(qMin(y0, y1) - 1);
+        const int lastRow = cellCoord(qMax(y0, y1) + 1);
+        for (int cy = firstRow; cy <= lastRow; ++cy) {
+            func(cellKey(cx, cy));
+        }
+    }
+}
+
+void SegmentIndex::insert(const Connection &edge, const QLine &line) {
+    ++count;
+    if (isOversized(line)) {
+        oversized.append({ edge, line });
+        return;
+    }
+    forEachCell(line, [&](quint64 key) { cells[key].append({ edge, line }); });
+}
+
+void SegmentIndex::remove(const Connection &edge, const QLine &line) {
+    --count;
+    if (isOversized(line)) {
+        removeEntry(oversized, edge);
+        return;
+    }
+    forEachCell(line, [&](quint64 key) {
+        auto it = cells.find(key);
+        if (it == cells.end()) {
+            return;
+        }
+        removeEntry(it.value(), edge);
+        if (it.value().isEmpty()) {
+            cells.erase(it);
+        }
+    });
+}
+
+void SegmentIndex::move(const Connection &edge, const QLine &oldLine, const QLine &newLine) {
+    remove(edge, oldLine);
+    insert(edge, newLine);
+}
+
+void SegmentIndex::clear() {
+    cells.clear();
+    oversized.clear();
+    count = 0;
+}
+
+Connection SegmentIndex::nearest(const QPoint &point, int tolerance) const {
+    Connection best = { -1, -1 };
+    double bestDistance = std::numeric_limits<double>::max();
+    const double limit = double(tolerance) * tolerance;
+    auto check = [&](const Entry &entry) {
+        const double distance = distanceSquared(point, entry.line);
+        if (distance <= limit && distance < bestDistance) {
+            bestDistance = distance;
+            best = entry.edge;
+        }
+    };
+    // Отрезок в пределах tolerance обязательно проходит через одну из ячеек квадрата вокруг точки
+    const int tol = qMax(0, tolerance);
+    for (int cy = cellCoord(point.y() - tol); cy <= cellCoord(point.y() + tol); ++cy) {
+        for (int cx = cellCoord(point.x() - tol); cx <= cellCoord(point.x() + tol); ++cx) {
+            auto it = cells.constFind(cellKey(cx, cy));
+            if (it == cells.constEnd()) {
+                continue;
+            }
+            for (const Entry &entry : it.value()) {
+                check(entry);
+            }
+        }
+    }
+    for (const Entry &entry : oversized) {
+        check(entry);
+    }
+    return best;
+}
+
+QVector<Connection> SegmentIndex::query(const QRect &area) const {
+    QVector<Connection> result;
+    const QRect r = area.normalized();
+    if (r.isEmpty()) {
+        return result;
+    }
+    auto check = [&](const Entry &entry) {
+        if (QRect(entry.line.p1(), entry.line.p2()).normalized().intersects(r.adjusted(-1, -1, 1, 1))) {
+            result.append(entry.edge);
+        }
+    };
+    const int firstColumn = cellCoord(r.left());
+    const int lastColumn = cellCoord(r.right());
+    const int firstRow = cellCoord(r.top());
+    const int lastRow = cellCoord(r.bottom());
+    const qint64 areaCells = (qint64(lastColumn) - firstColumn + 1) * (qint64(lastRow) - firstRow + 1);
+    if (areaCells <= cells.size()) {
+        for (int cy = firstRow; cy <= lastRow; ++cy) {
+            for (int cx = firstColumn; cx <= lastColumn; ++cx) {
+                auto it = cells.constFind(cellKey(cx, cy));
+                if (it == cells.constEnd()) {
+                    continue;
+                }
+                for (const Entry &entry : it.value()) {
+                    check(entry);
+                }
+            }
+        }
+    } else {
+        // Область больше занятой части сетки: дешевле обойти непустые ячейки
+        for (auto it = cells.constBegin(); it != cells.constEnd(); ++it) {
+            const int cx = int(qint32(it.key() >> 32));
+            const int cy = int(qint32(it.key()));
+            if (cx >= firstColumn && cx <= lastColumn && cy >= firstRow && cy <= lastRow) {
+                for (const Entry &entry : it.value()) {
+                    check(entry);
+                }
+            }
+        }
+    }
+    for (const Entry &entry : oversized) {
+        check(entry);
+    }
+    // Отрезок лежит в нескольких ячейках: повторы убираются
+    auto less = [](const Connection &a, const Connection &b) {
+        return a.from != b.from ? a.from < b.from : a.to < b.to;
+    };
+    std::sort(result.begin(), result.end(), less);
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
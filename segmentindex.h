@@ -0,0 +1,59 @@
+// segmentindex.h
+
+#ifndef SEGMENTINDEX_H
+#define SEGMENTINDEX_H
+
+#include <QHash>
+#include <QLine>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+#include "connectiongraph.h"
+
+// Равномерная сетка над отрезками связей.
+// Отрезок регистрируется только в ячейках, через которые он проходит,
+// а не во всех ячейках своего габарита, поэтому длинная диагональ стоит
+// порядка своей длины в ячейках. Поиск по точке смотрит несколько ячеек
+// вокруг нее и считает расстояние только до лежащих там отрезков.
+class SegmentIndex {
+public:
+    explicit SegmentIndex(int cellSize = 64);
+
+    // Связь задается парой from < to, как в ConnectionGraph::connections()
+    void insert(const Connection &edge, const QLine &line);
+    void remove(const Connection &edge, const QLine &line);
+    void move(const Connection &edge, const QLine &oldLine, const QLine &newLine);
+    void clear();
+
+    // Ближайшая к точке связь не дальше tolerance или { -1, -1 }
+    Connection nearest(const QPoint &point, int tolerance) const;
+    // Связи, чьи отрезки проходят через ячейки области и чьи габариты ее задевают,
+    // по одному разу, по возрастанию (from, to). Смотрятся только ячейки области,
+    // поэтому цена зависит от числа видимых отрезков, а не от всех связей.
+    QVector<Connection> query(const QRect &area) const;
+
+    int size() const { return count; }
+
+private:
+    struct Entry {
+        Connection edge;
+        QLine line;
+    };
+
+    int cellSize;
+    int count;
+    QHash<quint64, QVector<Entry>> cells;
+    // Отрезки, проходящие через слишком много ячеек, хранятся отдельным списком
+    QVector<Entry> oversized;
+
+    int cellCoord(int v) const;
+    static quint64 cellKey(int cx, int cy);
+    static bool removeEntry(QVector<Entry> &list, const Connection &edge);
+    bool isOversized(const QLine &line) const;
+    // Обход ячеек, через которые проходит отрезок
+    template <typename Func>
+    void forEachCell(const QLine &line, Func func) const;
+};
+
+#endif // SEGMENTINDEX_H
@@ -0,0 +1,152 @@
+#include "spatialindex.h"
+
+#include <algorithm>
+
+namespace {
+// Фигура, занимающая больше ячеек, попадает в список крупных фигур
+const qint64 kMaxCellsPerEntry = 256;
+}
+
+SpatialIndex::SpatialIndex(int cellSize)
+    : cellSize(qMax(1, cellSize)), count(0) {}
+
+int SpatialIndex::cellCoord(int v) const {
+    // Деление с округлением вниз, чтобы отрицательные координаты не склеивались с нулевой ячейкой
+    return v >= 0 ? v / cellSize : -((-(v + 1)) / cellSize) - 1;
+}
+
+QRect SpatialIndex::cellSpan(const QRect &rect) const {
+    return QRect(QPoint(cellCoord(rect.left()), cellCoord(rect.top())),
+                 QPoint(cellCoord(rect.right()), cellCoord(rect.bottom())));
+}
+
+quint64 SpatialIndex::cellKey(int cx, int cy) {
+    return (quint64(quint32(cx)) << 32) | quint32(cy);
+}
+
+bool SpatialIndex::removeEntry(QVector<Entry> &list, int key) {
+    for (int i = 0; i < list.size(); ++i) {
+        if (list[i].key == key) {
+            // Порядок внутри ячейки не важен, поэтому удаляем перестановкой с последним
+            list[i] = list.last();
+            list.removeLast();
+            return true;
+        }
+    }
+    return false;
+}
+
+void SpatialIndex::insert(int key, const QRect &rect) {
+    const QRect r = rect.normalized();
+    const QRect span = cellSpan(r);
+    ++count;
+
+    if (qint64(span.width()) * span.height() > kMaxCellsPerEntry) {
+        oversized.append({ key, r });
+        return;
+    }
+    for (int cy = span.top(); cy <= span.bottom(); ++cy) {
+        for (int cx = span.left(); cx <= span.right(); ++cx) {
+            cells[cellKey(cx, cy)].append({ key, r });
+        }
+    }
+}
+
+void SpatialIndex::remove(int key, const QRect &rect) {
+    const QRect r = rect.normalized();
+    const QRect span = cellSpan(r);
+    --count;
+
+    if (qint64(span.width()) * span.height() > kMaxCellsPerEntry) {
+        removeEntry(oversized, key);
+        return;
+    }
+    for (int cy = span.top(); cy <= span.bottom(); ++cy) {
+        for (int cx = span.left(); cx <= span.right(); ++cx) {
+            auto it = cells.find(cellKey(cx, cy));
+            if (it == cells.end()) {
+                continue;
+            }
+            removeEntry(it.value(), key);
+            if (it.value().isEmpty()) {
+                cells.erase(it);
+            }
+        }
+    }
+}
+
+void SpatialIndex::move(int key, const QRect &oldRect, const QRect &newRect) {
+    remove(key, oldRect);
+    insert(key, newRect);
+}
+
+void SpatialIndex::clear() {
+    cells.clear();
+    oversized.clear();
+    count = 0;
+}
+
+QVector<int> SpatialIndex::keysAt(const QPoint &point) const {
+    QVector<int> result;
+    auto it = cells.constFind(cellKey(cellCoord(point.x()), cellCoord(point.y())));
+    if (it != cells.constEnd()) {
+        for (const Entry &entry : it.value()) {
+            if (entry.rect.contains(point)) {
+                result.append(entry.key);
+            }
+        }
+    }
+    for (const Entry &entry : oversized) {
+        if (entry.rect.contains(point)) {
+            result.append(entry.key);
+        }
+    }
+    return result;
+}
+
+QVector<int> SpatialIndex::query(const QRect &area) const {
+    QVector<int> result;
+    const QRect a = area.normalized();
+    const QRect span = cellSpan(a);
+
+    // Фигура лежит в нескольких ячейках; сообщаем о ней только из той ячейки,
+    // в которую попадает левый верхний угол пересечения, чтобы избежать повторов
+    auto collect = [&](int cx, int cy, const QVector<Entry> &list) {
+        for (const Entry &entry : list) {
+            if (!entry.rect.intersects(a)) {
+                continue;
+            }
+            if (cellCoord(qMax(entry.rect.left(), a.left())) == cx
+                && cellCoord(qMax(entry.rect.top(), a.top())) == cy) {
+                result.append(entry.key);
+            }
+        }
+    };
+
+    if (qint64(span.width()) * span.height() > cells.size()) {
+        // Область больше, чем занятых ячеек: дешевле обойти сами ячейки
+        for (auto it = cells.constBegin(); it != cells.constEnd(); ++it) {
+            const int cx = int(qint32(it.key() >> 32));
+            const int cy = int(qint32(it.key() & 0xffffffffu));
+            if (span.contains(cx, cy)) {
+                collect(cx, cy, it.value());
+            }
+        }
+    } else {
+        for (int cy = span.top(); cy <= span.bottom(); ++cy) {
+            for (int cx = span.left(); cx <= span.right(); ++cx) {
+                auto it = cells.constFind(cellKey(cx, cy));
+                if (it != cells.constEnd()) {
+                    collect(cx, cy, it.value());
+                }
+            }
+        }
+    }
+
+    for (const Entry &entry : oversized) {
+        if (entry.rect.intersects(a)) {
+            result.append(entry.key);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,50 @@
+// spatialindex.h
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QRect>
+#include <QPoint>
+#include <QHash>
+#include <QVector>
+
+// Равномерная сетка над прямоугольниками фигур.
+// Каждая фигура регистрируется во всех ячейках, которые она перекрывает,
+// поэтому поиск по точке затрагивает только одну ячейку, а не все фигуры.
+// Ключ фигуры одновременно задает ее порядок по оси Z: чем больше ключ,
+// тем выше фигура лежит на холсте.
+class SpatialIndex {
+public:
+    explicit SpatialIndex(int cellSize = 64);
+
+    void insert(int key, const QRect &rect);
+    void remove(int key, const QRect &rect);
+    void move(int key, const QRect &oldRect, const QRect &newRect);
+    void clear();
+
+    // Ключи всех фигур, чьи прямоугольники содержат точку
+    QVector<int> keysAt(const QPoint &point) const;
+    // Ключи всех фигур, чьи прямоугольники пересекают область (без повторов)
+    QVector<int> query(const QRect &area) const;
+
+    int size() const { return count; }
+
+private:
+    struct Entry {
+        int key;
+        QRect rect;
+    };
+
+    int cellSize;
+    int count;
+    QHash<quint64, QVector<Entry>> cells;
+    // Фигуры, перекрывающие слишком много ячеек, хранятся отдельным списком
+    QVector<Entry> oversized;
+
+    int cellCoord(int v) const;
+    QRect cellSpan(const QRect &rect) const;
+    static quint64 cellKey(int cx, int cy);
+    static bool removeEntry(QVector<Entry> &list, int key);
+};
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,183 @@
+#include "symbollibrary.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <atomic>
+
+#include "hittest.h"
+
+namespace {
+std::atomic<quint64> lastSymbolKey(0);
+
+// Экземпляр внутри символа может ссылаться только на ранее определенный символ
+// (library еще не содержит этот), поэтому вложенность всегда конечна.
+// Прочие ссылки превращаются в прямоугольники.
+void checkNested(const SymbolLibrary &library, Symbol &symbol) {
+    for (Figure &figure : symbol.figures) {
+        if (figure.shape != Instance) {
+            figure.symbol = -1;
+        }
+    }
+    library.resolve(symbol.figures);
+}
+
+QRect boundsOf(const QVector<Figure> &figures) {
+    QRect result;
+    for (const Figure &figure : figures) {
+        result |= figure.rect.normalized();
+    }
+    return result;
+}
+}
+
+int SymbolLibrary::define(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    Symbol symbol;
+    symbol.key = ++lastSymbolKey;
+    symbol.figures = figures;
+    std::sort(symbol.figures.begin(), symbol.figures.end(),
+              [](const Figure &a, const Figure &b) { return a.id < b.id; });
+    checkNested(*this, symbol);
+
+    // Координаты от угла габарита, id - номера фигур внутри символа
+    const QRect bounds = boundsOf(symbol.figures);
+    const QPoint origin = bounds.topLeft();
+    QHash<int, int> localIds;
+    for (int i = 0; i < symbol.figures.size(); ++i) {
+        Figure &figure = symbol.figures[i];
+        localIds.insert(figure.id, i);
+        figure.id = i;
+        figure.rect.translate(-origin);
+    }
+    symbol.bounds = bounds.translated(-origin);
+    for (const Connection &connection : connections) {
+        const int from = localIds.value(connection.from, -1);
+        const int to = localIds.value(connection.to, -1);
+        if (from != -1 && to != -1 && from != to) {
+            symbol.connections.append({ qMin(from, to), qMax(from, to) });
+        }
+    }
+    definitions.append(symbol);
+    return definitions.size() - 1;
+}
+
+const Symbol *SymbolLibrary::symbol(int id) const {
+    return id >= 0 && id < definitions.size() ? &definitions.at(id) : nullptr;
+}
+
+QVector<Figure> SymbolLibrary::expand(int id, const QPoint &topLeft) const {
+    QVector<Figure> result;
+    const Symbol *s = symbol(id);
+    if (!s) {
+        return result;
+    }
+    for (const Figure &figure : s->figures) {
+        if (figure.shape == Instance) {
+            result += expand(figure.symbol, topLeft + figure.rect.topLeft());
+        } else {
+            result.append({ figure.id, figure.shape, figure.rect.translated(topLeft) });
+        }
+    }
+    return result;
+}
+
+void SymbolLibrary::resolve(QVector<Figure> &figures) const {
+    for (Figure &figure : figures) {
+        if (figure.shape != Instance) {
+            continue;
+        }
+        if (const Symbol *s = symbol(figure.symbol)) {
+            figure.rect = s->bounds.translated(figure.rect.topLeft());
+        } else {
+            figure.shape = Rectangle;
+            figure.symbol = -1;
+        }
+    }
+}
+
+bool SymbolLibrary::contains(int id, const QPoint &point) const {
+    const Symbol *s = symbol(id);
+    if (!s || !s->bounds.contains(point)) {
+        return false;
+    }
+    for (const Figure &figure : s->figures) {
+        const bool hit = figure.shape == Instance
+                             ? contains(figure.symbol, point - figure.rect.topLeft())
+                             : shapeContains(figure.shape, figure.rect, point);
+        if (hit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SymbolLibrary::intersects(int id, const QRect &area) const {
+    const Symbol *s = symbol(id);
+    if (!s || !s->bounds.intersects(area)) {
+        return false;
+    }
+    for (const Figure &figure : s->figures) {
+        const bool hit = figure.shape == Instance
+                             ? intersects(figure.symbol, area.translated(-figure.rect.topLeft()))
+                             : shapeIntersects(figure.shape, figure.rect, area);
+        if (hit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QDataStream &operator<<(QDataStream &out, const SymbolLibrary &library) {
+    // Символы по порядку номеров: фигуры (с номером символа) и связи
+    out << qint32(library.definitions.size());
+    for (const Symbol &symbol : library.definitions) {
+        out << qint32(symbol.figures.size());
+        for (const Figure &figure : symbol.figures) {
+            out << figure << qint32(figure.symbol);
+        }
+        out << qint32(symbol.connections.size());
+        for (const Connection &connection : symbol.connections) {
+            out << connection;
+        }
+    }
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, SymbolLibrary &library) {
+    library.definitions.clear();
+    qint32 count = 0;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Symbol symbol;
+        symbol.key = ++lastSymbolKey;
+        qint32 figureCount = 0;
+        in >> figureCount;
+        for (qint32 f = 0; f < figureCount && in.status() == QDataStream::Ok; ++f) {
+            Figure figure;
+            qint32 nested = -1;
+            in >> figure >> nested;
+            // Номера фигур восстанавливаются по порядку, неизвестные формы - прямоугольники
+            figure.id = f;
+            if (figure.shape != Rectangle && figure.shape != Triangle && figure.shape != Ellipse
+                && figure.shape != Instance) {
+                figure.shape = Rectangle;
+            }
+            figure.symbol = nested;
+            symbol.figures.append(figure);
+        }
+        qint32 connectionCount = 0;
+        in >> connectionCount;
+        for (qint32 c = 0; c < connectionCount && in.status() == QDataStream::Ok; ++c) {
+            Connection connection;
+            in >> connection;
+            if (connection.from >= 0 && connection.to >= 0 && connection.from < symbol.figures.size()
+                && connection.to < symbol.figures.size() && connection.from != connection.to) {
+                symbol.connections.append(connection);
+            }
+        }
+        checkNested(library, symbol);
+        symbol.bounds = boundsOf(symbol.figures);
+        library.definitions.append(symbol);
+    }
+    return in;
+}
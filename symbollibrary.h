@@ -0,0 +1,62 @@
+// symbollibrary.h
+
+#ifndef SYMBOLLIBRARY_H
+#define SYMBOLLIBRARY_H
+
+#include <QDataStream>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+#include "connectiongraph.h"
+#include "figure.h"
+
+// Определение символа: повторяющаяся группа фигур со связями между ними.
+// Координаты фигур отсчитываются от левого верхнего угла габарита группы,
+// id фигур - их номера внутри символа (0, 1, ...) в прежнем порядке по оси Z.
+struct Symbol {
+    QVector<Figure> figures;
+    QVector<Connection> connections;  // Связи между фигурами символа по их номерам
+    QRect bounds;                     // Габарит фигур; левый верхний угол в (0, 0)
+    quint64 key;                      // Уникален среди символов всех документов (ключ кэша картинок)
+};
+
+// Символы документа. На сцене символ вставляется экземплярами: одна фигура
+// формы Instance с номером символа, чей прямоугольник - габарит символа в месте
+// вставки. Фигуры экземпляра нигде не хранятся по отдельности: проверка попадания
+// и отрисовка разворачивают их из определения по мере надобности.
+// Определения не меняются и не удаляются, поэтому копии библиотеки
+// (снимки истории, фоновые задачи) разделяют данные и ключи кэша.
+class SymbolLibrary {
+public:
+    // Новый символ из фигур в координатах сцены и связей между ними по id фигур.
+    // Вложенные экземпляры не разворачиваются, а остаются ссылками на ранее
+    // определенные символы. Возвращает номер символа.
+    int define(const QVector<Figure> &figures, const QVector<Connection> &connections);
+    void clear() { definitions.clear(); }
+
+    int count() const { return definitions.size(); }
+    bool isEmpty() const { return definitions.isEmpty(); }
+    // Определение по номеру или nullptr
+    const Symbol *symbol(int id) const;
+
+    // Фигуры экземпляра с левым верхним углом topLeft в координатах сцены
+    QVector<Figure> expand(int id, const QPoint &topLeft) const;
+    // Прямоугольники прочитанных экземпляров - по габаритам их символов;
+    // экземпляры неизвестных символов становятся прямоугольниками
+    void resolve(QVector<Figure> &figures) const;
+    // Проверка попадания в фигуры символа; точка и область в координатах символа
+    bool contains(int id, const QPoint &point) const;
+    bool intersects(int id, const QRect &area) const;
+
+    friend QDataStream &operator<<(QDataStream &out, const SymbolLibrary &library);
+    friend QDataStream &operator>>(QDataStream &in, SymbolLibrary &library);
+
+private:
+    QVector<Symbol> definitions;   // Номер символа - позиция в массиве
+};
+
+QDataStream &operator<<(QDataStream &out, const SymbolLibrary &library);
+QDataStream &operator>>(QDataStream &in, SymbolLibrary &library);
+
+#endif // SYMBOLLIBRARY_H
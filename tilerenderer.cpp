@@ -0,0 +1,245 @@
+#include "tilerenderer.h"
+
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <algorithm>
+
+#include "profiler.h"
+#include "scenerenderer.h"
+
+namespace {
+// Больше стольких тайлов кэш не держит: 256 полных тайлов - 64 МБ
+const int kMaxCachedTiles = 256;
+// Столько тайлов экспорта рисуется за одну пачку, чтобы не держать в памяти все сразу
+const int kExportBatchTiles = 256;
+
+// Тайл вместе с фигурами и связями, которые его задевают
+struct TileJob {
+    QPoint position;
+    QVector<int> figures;   // Id по возрастанию, то есть в порядке по оси Z
+    QVector<QLine> lines;
+    QImage image;           // Пустой, если в тайле ничего нет
+};
+
+int floorDiv(qreal value, int divisor) {
+    return qFloor(value / divisor);
+}
+}
+
+TileRenderer::TileRenderer(const Diagram &diagram)
+    : diagram(diagram), tileZoom(0), tileRatio(1), tileRevision(0) {}
+
+quint64 TileRenderer::tileKey(int x, int y) {
+    return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+QRect TileRenderer::tileRange(const QRectF &sceneRect, qreal zoom, const QPointF &phase) {
+    // Тайл (x, y) покрывает точки сцены, у которых scene * zoom + phase
+    // попадает в [x * kTileSize, (x + 1) * kTileSize)
+    return QRect(QPoint(floorDiv(sceneRect.left() * zoom + phase.x(), kTileSize),
+                        floorDiv(sceneRect.top() * zoom + phase.y(), kTileSize)),
+                 QPoint(floorDiv(sceneRect.right() * zoom + phase.x(), kTileSize),
+                        floorDiv(sceneRect.bottom() * zoom + phase.y(), kTileSize)));
+}
+
+QVector<QImage> TileRenderer::renderTiles(const Diagram &diagram, qreal zoom, const QPointF &phase,
+                                          qreal ratio, const QVector<QPoint> &positions) {
+    PROFILE_SCOPE("TileRenderer::renderTiles");
+    QVector<TileJob> jobs(positions.size());
+    QHash<quint64, int> jobByKey;
+    jobByKey.reserve(positions.size());
+    QRect range;
+    for (int i = 0; i < positions.size(); ++i) {
+        jobs[i].position = positions[i];
+        jobByKey.insert(tileKey(positions[i].x(), positions[i].y()), i);
+        range |= QRect(positions[i], QSize(1, 1));
+    }
+    // Область сцены, покрытая всеми тайлами пачки
+    const QRect area = QRectF(QPointF((range.left() * kTileSize - phase.x()) / zoom,
+                                      (range.top() * kTileSize - phase.y()) / zoom),
+                              QPointF(((range.right() + 1) * kTileSize - phase.x()) / zoom,
+                                      ((range.bottom() + 1) * kTileSize - phase.y()) / zoom)).toAlignedRect();
+
+    // Раскладка по тайлам: один проход по фигурам и связям пачки на главном
+    // потоке, после чего каждый тайл рисуется независимо от остальных
+    auto bin = [&](const QRect &bounds, auto add) {
+        const QRect tilesHit = tileRange(QRectF(bounds), zoom, phase) & range;
+        for (int y = tilesHit.top(); y <= tilesHit.bottom(); ++y) {
+            for (int x = tilesHit.left(); x <= tilesHit.right(); ++x) {
+                const int index = jobByKey.value(tileKey(x, y), -1);
+                if (index != -1) {
+                    add(jobs[index]);
+                }
+            }
+        }
+    };
+    QVector<int> ids = diagram.figuresIn(area);
+    std::sort(ids.begin(), ids.end());
+    for (int id : ids) {
+        bin(SceneRenderer::paintBounds(diagram.figure(id)->rect), [id](TileJob &job) { job.figures.append(id); });
+    }
+    // Связи пачки берутся из сетки отрезков, без обхода всех ребер графа
+    // (область расширяется на тот же запас под перо, что и габарит линии)
+    for (const Connection &connection : diagram.connectionsIn(SceneRenderer::paintBounds(area))) {
+        const QPoint a = diagram.figure(connection.from)->rect.center();
+        const QPoint b = diagram.figure(connection.to)->rect.center();
+        const QRect bounds = SceneRenderer::lineBounds(a, b);
+        if (!bounds.intersects(area)) {
+            continue;
+        }
+        const QLine line(a, b);
+        bin(bounds, [&line](TileJob &job) { job.lines.append(line); });
+    }
+
+    // Тайлы рисуются в пуле потоков, каждый своим QPainter в свой QImage;
+    // документ в это время только читается
+    QtConcurrent::blockingMap(jobs, [&](TileJob &job) {
+        if (job.figures.isEmpty() && job.lines.isEmpty()) {
+            return;
+        }
+        // На экранах высокой плотности тайл рисуется в физических пикселях
+        job.image = QImage(QSize(kTileSize, kTileSize) * ratio, QImage::Format_ARGB32_Premultiplied);
+        job.image.setDevicePixelRatio(ratio);
+        job.image.fill(Qt::transparent);
+        QPainter painter(&job.image);
+        painter.setTransform(QTransform(zoom, 0, 0, zoom, phase.x() - job.position.x() * kTileSize,
+                                        phase.y() - job.position.y() * kTileSize));
+        QPen pen = painter.pen();
+        pen.setCosmetic(true);
+        painter.setPen(pen);
+        SceneRenderer renderer(diagram);
+        renderer.setScale(zoom);
+        renderer.renderBinned(painter, job.figures, job.lines);
+    });
+
+    QVector<QImage> images;
+    images.reserve(jobs.size());
+    for (const TileJob &job : jobs) {
+        images.append(job.image);
+    }
+    return images;
+}
+
+void TileRenderer::render(QPainter &painter, const Viewport &viewport, const QRect &widgetRect) {
+    PROFILE_SCOPE("TileRenderer::render");
+    // Сдвиг вида делится на целую часть, на которую смещаются готовые тайлы,
+    // и дробную, с которой тайлы нарисованы
+    const qreal zoom = viewport.scale();
+    const QPoint origin(qFloor(viewport.offset().x()), qFloor(viewport.offset().y()));
+    const QPointF phase = viewport.offset() - QPointF(origin);
+    const qreal ratio = painter.device()->devicePixelRatioF();
+    if (zoom != tileZoom || phase != tilePhase || ratio != tileRatio || diagram.revision() != tileRevision) {
+        tiles.clear();
+        tileZoom = zoom;
+        tilePhase = phase;
+        tileRatio = ratio;
+        tileRevision = diagram.revision();
+    }
+
+    const QRect r = widgetRect.normalized();
+    const QRect visible(QPoint(floorDiv(r.left() - origin.x(), kTileSize), floorDiv(r.top() - origin.y(), kTileSize)),
+                        QPoint(floorDiv(r.right() - origin.x(), kTileSize), floorDiv(r.bottom() - origin.y(), kTileSize)));
+    QVector<QPoint> missing;
+    for (int y = visible.top(); y <= visible.bottom(); ++y) {
+        for (int x = visible.left(); x <= visible.right(); ++x) {
+            if (!tiles.contains(tileKey(x, y))) {
+                missing.append(QPoint(x, y));
+            }
+        }
+    }
+    if (!missing.isEmpty()) {
+        const QVector<QImage> images = renderTiles(diagram, zoom, phase, ratio, missing);
+        for (int i = 0; i < missing.size(); ++i) {
+            tiles.insert(tileKey(missing[i].x(), missing[i].y()), images[i]);
+        }
+    }
+    PROFILE_COUNTER("tiles rendered", missing.size());
+
+    for (int y = visible.top(); y <= visible.bottom(); ++y) {
+        for (int x = visible.left(); x <= visible.right(); ++x) {
+            const QImage image = tiles.value(tileKey(x, y));
+            if (!image.isNull()) {
+                painter.drawImage(origin + QPoint(x * kTileSize, y * kTileSize), image);
+            }
+        }
+    }
+    evict(visible);
+}
+
+void TileRenderer::invalidate(const QRect &sceneRect, quint64 previousRevision) {
+    // Кэш уже согласован с текущей версией, если об этой правке сообщили раньше
+    // (например, при применении отложенного сдвига внутри той же правки)
+    if (tileRevision != previousRevision && tileRevision != diagram.revision()) {
+        tiles.clear();
+    }
+    if (!tiles.isEmpty() && !sceneRect.isNull()) {
+        const QRect hit = tileRange(QRectF(sceneRect.normalized()), tileZoom, tilePhase);
+        for (auto it = tiles.begin(); it != tiles.end(); ) {
+            const QPoint position(int(qint32(it.key() >> 32)), int(qint32(it.key())));
+            if (hit.contains(position)) {
+                it = tiles.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    tileRevision = diagram.revision();
+}
+
+void TileRenderer::clear() {
+    tiles.clear();
+}
+
+void TileRenderer::evict(const QRect &visible) {
+    if (tiles.size() <= kMaxCachedTiles) {
+        return;
+    }
+    // Первыми забываются тайлы, дальше всего ушедшие от видимой области
+    const QPoint center = visible.center();
+    QVector<QPair<int, quint64>> candidates;
+    for (auto it = tiles.constBegin(); it != tiles.constEnd(); ++it) {
+        const QPoint position(int(qint32(it.key() >> 32)), int(qint32(it.key())));
+        if (!visible.contains(position)) {
+            candidates.append(qMakePair((position - center).manhattanLength(), it.key()));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    while (tiles.size() > kMaxCachedTiles && !candidates.isEmpty()) {
+        tiles.remove(candidates.takeLast().second);
+    }
+}
+
+QImage TileRenderer::renderImage(const Diagram &diagram, const Viewport &viewport, const QSize &size,
+                                 const QColor &background) {
+    PROFILE_SCOPE("TileRenderer::renderImage");
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull()) {
+        return image;
+    }
+    image.fill(background);
+    const QPoint origin(qFloor(viewport.offset().x()), qFloor(viewport.offset().y()));
+    const QPointF phase = viewport.offset() - QPointF(origin);
+    const QRect range(QPoint(floorDiv(-origin.x(), kTileSize), floorDiv(-origin.y(), kTileSize)),
+                      QPoint(floorDiv(size.width() - 1 - origin.x(), kTileSize),
+                             floorDiv(size.height() - 1 - origin.y(), kTileSize)));
+
+    // Тайлы рисуются пачками по нескольку рядов и сразу переносятся в картинку
+    QPainter painter(&image);
+    const int rowsPerBatch = qMax(1, kExportBatchTiles / range.width());
+    for (int top = range.top(); top <= range.bottom(); top += rowsPerBatch) {
+        QVector<QPoint> positions;
+        for (int y = top; y <= qMin(range.bottom(), top + rowsPerBatch - 1); ++y) {
+            for (int x = range.left(); x <= range.right(); ++x) {
+                positions.append(QPoint(x, y));
+            }
+        }
+        const QVector<QImage> images = renderTiles(diagram, viewport.scale(), phase, 1.0, positions);
+        for (int i = 0; i < positions.size(); ++i) {
+            if (!images[i].isNull()) {
+                painter.drawImage(origin + positions[i] * kTileSize, images[i]);
+            }
+        }
+    }
+    return image;
+}
@@ -0,0 +1,64 @@
+// tilerenderer.h
+
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <QColor>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+#include "diagram.h"
+#include "viewport.h"
+
+// Отрисовка сцены квадратными тайлами фиксированного размера.
+// Сетка тайлов привязана к сцене в текущем масштабе, а не к окну, поэтому
+// при сдвиге вида готовые тайлы переиспользуются, а рисуются только новые.
+// Недостающие тайлы рисуются пачкой: фигуры и связи один раз раскладываются
+// по тайлам, которые они задевают, и каждый тайл рисуется в свой QImage
+// в пуле потоков. Готовые тайлы хранятся в кэше, пока их не заденет правка
+// или не изменится масштаб.
+class TileRenderer {
+public:
+    static const int kTileSize = 256;
+
+    explicit TileRenderer(const Diagram &diagram);
+
+    // Отрисовка части окна widgetRect. Рисующий painter должен быть в
+    // координатах окна, без преобразования. Документ во время вызова не меняется.
+    void render(QPainter &painter, const Viewport &viewport, const QRect &widgetRect);
+    // Сброс тайлов, задевающих область сцены; вызывается после правки.
+    // previousRevision - версия документа до правки: если кэш согласован с другой
+    // версией, между ними были правки, о которых не сообщили, и сбрасывается весь кэш.
+    void invalidate(const QRect &sceneRect, quint64 previousRevision);
+    void clear();
+    int cachedTileCount() const { return tiles.size(); }
+
+    // Картинка размера size с документом в данном виде, собранная из тайлов,
+    // нарисованных параллельно (экспорт больших документов)
+    static QImage renderImage(const Diagram &diagram, const Viewport &viewport, const QSize &size,
+                              const QColor &background);
+
+private:
+    const Diagram &diagram;
+    QHash<quint64, QImage> tiles;   // Ключ - номер тайла по x и y
+    qreal tileZoom;                 // Масштаб и дробная часть сдвига, при которых нарисованы тайлы
+    QPointF tilePhase;
+    qreal tileRatio;                // Плотность пикселей устройства
+    quint64 tileRevision;           // Версия документа, с которой согласован кэш
+
+    static quint64 tileKey(int x, int y);
+    // Диапазон тайлов, задевающих область сцены
+    static QRect tileRange(const QRectF &sceneRect, qreal zoom, const QPointF &phase);
+    // Параллельная отрисовка тайлов с номерами positions
+    static QVector<QImage> renderTiles(const Diagram &diagram, qreal zoom, const QPointF &phase, qreal ratio,
+                                       const QVector<QPoint> &positions);
+    void evict(const QRect &visible);
+};
+
+#endif // TILERENDERER_H
@@ -0,0 +1,246 @@
+#include "undohistory.h"
+
+#include <algorithm>
+
+namespace {
+// Примерная цена фигуры и связи в полной копии документа: сама запись,
+// раскладка по типам, ячейки сетки и два элемента списков смежности
+const qint64 kFigureCopyBytes = sizeof(Figure) + 64;
+const qint64 kConnectionCopyBytes = 48;
+// Служебные данные одной команды
+const qint64 kCommandOverhead = sizeof(void *) * 16;
+}
+
+UndoHistory::UndoHistory(qint64 budgetBytes)
+    : position(0), budgetBytes(qMax<qint64>(0, budgetBytes)), usedBytes(0) {}
+
+void UndoHistory::setBudget(qint64 bytes) {
+    budgetBytes = qMax<qint64>(0, bytes);
+    enforceBudget();
+}
+
+void UndoHistory::clear() {
+    commands.clear();
+    position = 0;
+    usedBytes = 0;
+}
+
+qint64 UndoHistory::estimate(const Command &command) {
+    qint64 bytes = kCommandOverhead
+        + command.figures.size() * qint64(sizeof(Figure))
+        + command.connections.size() * qint64(sizeof(Connection))
+        + command.ids.size() * qint64(sizeof(int))
+        + command.deltas.size() * qint64(sizeof(QPoint));
+    // Копии документа считаются целиком: как только документ изменится,
+    // они перестанут разделять с ним данные
+    for (const QSharedPointer<const Diagram> &copy : { command.before, command.after }) {
+        if (copy) {
+            bytes += copy->figureCount() * kFigureCopyBytes + copy->connectionCount() * kConnectionCopyBytes;
+        }
+    }
+    return bytes;
+}
+
+void UndoHistory::push(Command command) {
+    // Новая правка отменяет возможность повтора
+    for (int i = position; i < commands.size(); ++i) {
+        usedBytes -= commands[i].bytes;
+    }
+    commands.resize(position);
+
+    command.bytes = estimate(command);
+    usedBytes += command.bytes;
+    commands.append(command);
+    position = commands.size();
+    enforceBudget();
+}
+
+void UndoHistory::enforceBudget() {
+    // Самые старые шаги забываются пачкой, чтобы не сдвигать вектор на каждом
+    int dropped = 0;
+    while (dropped < position && usedBytes > budgetBytes) {
+        usedBytes -= commands[dropped].bytes;
+        ++dropped;
+    }
+    if (dropped > 0) {
+        commands.remove(0, dropped);
+        position -= dropped;
+    }
+}
+
+void UndoHistory::recordAdd(const Figure &figure) {
+    Command command = { Command::Add, { figure }, {}, {}, {}, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordMove(const QVector<int> &ids, const QPoint &delta) {
+    if (ids.isEmpty() || delta.isNull()) {
+        return;
+    }
+    Command command = { Command::Move, {}, {}, ids, {}, delta, {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordMoves(const QVector<int> &ids, const QVector<QPoint> &deltas) {
+    // Фигуры, которые не сдвинулись, не записываются
+    QVector<int> movedIds;
+    QVector<QPoint> movedDeltas;
+    for (int i = 0; i < ids.size(); ++i) {
+        if (!deltas[i].isNull()) {
+            movedIds.append(ids[i]);
+            movedDeltas.append(deltas[i]);
+        }
+    }
+    if (movedIds.isEmpty()) {
+        return;
+    }
+    Command command = { Command::Moves, {}, {}, movedIds, movedDeltas, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordConnect(int from, int to) {
+    Command command = { Command::Connect, {}, { { from, to } }, {}, {}, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordDisconnect(int from, int to) {
+    Command command = { Command::Disconnect, {}, { { from, to } }, {}, {}, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordReconnect(const Connection &before, const Connection &after) {
+    Command command = { Command::Reconnect, {}, { before, after }, {}, {}, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordRemove(const Diagram &diagram, const QVector<int> &ids) {
+    QVector<int> sorted = ids;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    // Запоминаются сами фигуры и только инцидентные им связи; связь между
+    // двумя удаляемыми фигурами записывается один раз
+    Command command = { Command::Remove, {}, {}, {}, {}, QPoint(), {}, {}, 0 };
+    for (int id : sorted) {
+        const Figure *figure = diagram.figure(id);
+        if (!figure) {
+            continue;
+        }
+        command.figures.append(*figure);
+        for (int other : diagram.graph().neighbors(id)) {
+            if (other > id || !std::binary_search(sorted.constBegin(), sorted.constEnd(), other)) {
+                command.connections.append({ id, other });
+            }
+        }
+    }
+    if (!command.figures.isEmpty()) {
+        push(command);
+    }
+}
+
+void UndoHistory::recordInsert(const QVector<Figure> &figures, const QVector<Connection> &connections) {
+    if (figures.isEmpty()) {
+        return;
+    }
+    Command command = { Command::Insert, figures, connections, {}, {}, QPoint(), {}, {}, 0 };
+    push(command);
+}
+
+void UndoHistory::recordReplace(const Diagram &before, const Diagram &after) {
+    Command command = { Command::Replace, {}, {}, {}, {}, QPoint(), QSharedPointer<const Diagram>(new Diagram(before)),
+                        QSharedPointer<const Diagram>(new Diagram(after)), 0 };
+    push(command);
+}
+
+void UndoHistory::apply(Diagram &diagram, const Command &command, bool forward) {
+    switch (command.type) {
+    case Command::Add:
+        if (forward) {
+            diagram.insertFigures(command.figures, {});
+        } else {
+            diagram.removeFigure(command.figures.first().id);
+        }
+        break;
+    case Command::Move:
+        diagram.moveFigures(command.ids, forward ? command.delta : -command.delta);
+        break;
+    case Command::Moves:
+        if (forward) {
+            diagram.moveFigures(command.ids, command.deltas);
+        } else {
+            QVector<QPoint> deltas;
+            deltas.reserve(command.deltas.size());
+            for (const QPoint &delta : command.deltas) {
+                deltas.append(-delta);
+            }
+            diagram.moveFigures(command.ids, deltas);
+        }
+        break;
+    case Command::Connect:
+        if (forward) {
+            diagram.connectFigures(command.connections.first().from, command.connections.first().to);
+        } else {
+            diagram.disconnectFigures(command.connections.first().from, command.connections.first().to);
+        }
+        break;
+    case Command::Disconnect:
+        if (forward) {
+            diagram.disconnectFigures(command.connections.first().from, command.connections.first().to);
+        } else {
+            diagram.connectFigures(command.connections.first().from, command.connections.first().to);
+        }
+        break;
+    case Command::Reconnect: {
+        const Connection &removed = command.connections[forward ? 0 : 1];
+        const Connection &added = command.connections[forward ? 1 : 0];
+        diagram.disconnectFigures(removed.from, removed.to);
+        diagram.connectFigures(added.from, added.to);
+        break;
+    }
+    case Command::Remove:
+        if (forward) {
+            QVector<int> ids;
+            ids.reserve(command.figures.size());
+            for (const Figure &figure : command.figures) {
+                ids.append(figure.id);
+            }
+            diagram.removeFigures(ids);
+        } else {
+            diagram.insertFigures(command.figures, command.connections);
+        }
+        break;
+    case Command::Insert:
+        if (forward) {
+            diagram.insertFigures(command.figures, command.connections);
+        } else {
+            QVector<int> ids;
+            ids.reserve(command.figures.size());
+            for (const Figure &figure : command.figures) {
+                ids.append(figure.id);
+            }
+            diagram.removeFigures(ids);
+        }
+        break;
+    case Command::Replace:
+        diagram = forward ? *command.after : *command.before;
+        break;
+    }
+}
+
+bool UndoHistory::undo(Diagram &diagram) {
+    if (!canUndo()) {
+        return false;
+    }
+    --position;
+    apply(diagram, commands[position], false);
+    return true;
+}
+
+bool UndoHistory::redo(Diagram &diagram) {
+    if (!canRedo()) {
+        return false;
+    }
+    apply(diagram, commands[position], true);
+    ++position;
+    return true;
+}
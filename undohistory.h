@@ -0,0 +1,76 @@
+// undohistory.h
+
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QPoint>
+#include <QVector>
+#include <QSharedPointer>
+
+#include "diagram.h"
+
+// История правок для отмены и повтора.
+// Каждая правка хранится как компактная разница, а не снимок документа:
+// сдвиг - это id фигур и смещение, удаление - удаленные фигуры и их связи.
+// Полные копии нужны только очистке и загрузке, и те дешевы: контейнеры Qt
+// разделяются с документом, пока он не изменится.
+// Когда история превышает бюджет памяти, самые старые шаги забываются.
+class UndoHistory {
+public:
+    explicit UndoHistory(qint64 budgetBytes = 64 * 1024 * 1024);
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return budgetBytes; }
+    qint64 memoryUsage() const { return usedBytes; }
+    void clear();
+
+    bool canUndo() const { return position > 0; }
+    bool canRedo() const { return position < commands.size(); }
+    int undoCount() const { return position; }
+
+    // Запись правок; вызываются после того, как правка сделана,
+    // кроме recordRemove, которая должна увидеть фигуры до удаления
+    void recordAdd(const Figure &figure);
+    void recordMove(const QVector<int> &ids, const QPoint &delta);
+    // Сдвиг каждой фигуры на свое смещение (например, после автоукладки)
+    void recordMoves(const QVector<int> &ids, const QVector<QPoint> &deltas);
+    void recordConnect(int from, int to);
+    void recordDisconnect(int from, int to);
+    // Перенос конца связи: связь before заменена связью after
+    void recordReconnect(const Connection &before, const Connection &after);
+    void recordRemove(const Diagram &diagram, const QVector<int> &ids);
+    // Вставка группы новых фигур со связями (например, дублирование выделения)
+    void recordInsert(const QVector<Figure> &figures, const QVector<Connection> &connections);
+    // Замена документа целиком: очистка, загрузка
+    void recordReplace(const Diagram &before, const Diagram &after);
+
+    bool undo(Diagram &diagram);
+    bool redo(Diagram &diagram);
+
+private:
+    struct Command {
+        enum Type { Add, Move, Moves, Connect, Disconnect, Reconnect, Remove, Insert, Replace };
+
+        Type type;
+        QVector<Figure> figures;          // Add, Remove, Insert
+        QVector<Connection> connections;  // Connect, Disconnect, Reconnect (прежняя и новая), Remove, Insert
+        QVector<int> ids;                 // Move, Moves
+        QVector<QPoint> deltas;           // Moves
+        QPoint delta;                     // Move
+        QSharedPointer<const Diagram> before;  // Replace
+        QSharedPointer<const Diagram> after;
+        qint64 bytes;                     // Оценка занимаемой памяти
+    };
+
+    QVector<Command> commands;
+    int position;         // Команды до этой позиции можно отменить, после - повторить
+    qint64 budgetBytes;
+    qint64 usedBytes;
+
+    void push(Command command);
+    void enforceBudget();
+    static qint64 estimate(const Command &command);
+    static void apply(Diagram &diagram, const Command &command, bool forward);
+};
+
+#endif // UNDOHISTORY_H
@@ -0,0 +1,417 @@
+#include "vectorexport.h"
+
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "profiler.h"
+
+namespace {
+
+// Размер буфера записи: по его заполнении данные уходят в файл
+const int kChunkSize = 1 << 18;
+// Столько фигур или связей в одном элементе path SVG и одном контуре PDF:
+// просмотрщикам не приходится разбирать атрибут на весь документ
+const int kShapesPerPath = 4096;
+// Шаг отчета о ходе экспорта (фигуры и связи)
+const int kProgressStep = 1 << 16;
+// Поля вокруг документа, в единицах сцены
+const int kExportMargin = 10;
+// Размер пустого документа
+const int kEmptyExportSize = 64;
+// Наибольшая сторона страницы PDF в пунктах, которую открывают все просмотрщики;
+// большие документы уменьшаются до нее
+const qreal kMaxPdfPageSize = 14400;
+// Доля радиуса для контрольных точек кривой Безье, приближающей четверть эллипса
+const qreal kBezierArc = 0.5522847498;
+const char *const kCancelledMessage = "Операция отменена";
+
+void setError(QString *errorMessage, const QString &message) {
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+}
+
+// Область экспорта: документ с полями, как у пакетной отрисовки
+QRect exportBounds(const Diagram &diagram) {
+    const QRect bounds = diagram.bounds();
+    return bounds.isEmpty() ? QRect(0, 0, kEmptyExportSize, kEmptyExportSize)
+                            : bounds.adjusted(-kExportMargin, -kExportMargin, kExportMargin, kExportMargin);
+}
+
+// Буферизованная запись текста в устройство кусками по kChunkSize.
+// Числа форматируются вручную: QString::number на миллионах фигур заметно медленнее записи.
+class ChunkWriter {
+public:
+    explicit ChunkWriter(QIODevice *device) : device(device), flushed(0), failed(false) {
+        // Емкость задается заранее и не освобождается между кусками
+        buffer.reserve(kChunkSize + 256);
+    }
+
+    ChunkWriter &operator<<(const char *text) {
+        buffer.append(text);
+        return maybeFlush();
+    }
+    ChunkWriter &operator<<(char c) {
+        buffer.append(c);
+        return maybeFlush();
+    }
+    ChunkWriter &operator<<(const QByteArray &text) {
+        buffer.append(text);
+        return maybeFlush();
+    }
+    ChunkWriter &operator<<(qint64 value) {
+        appendInteger(value);
+        return maybeFlush();
+    }
+    ChunkWriter &operator<<(int value) { return *this << qint64(value); }
+    // Дробное число с точностью до сотых, без лишних нулей: 12, 12.5, -0.25
+    ChunkWriter &operator<<(qreal value) {
+        const qint64 hundredths = qRound64(value * 100);
+        const qint64 magnitude = qAbs(hundredths);
+        if (hundredths < 0) {
+            buffer.append('-');
+        }
+        appendInteger(magnitude / 100);
+        const int fraction = int(magnitude % 100);
+        if (fraction != 0) {
+            buffer.append('.');
+            buffer.append(char('0' + fraction / 10));
+            if (fraction % 10 != 0) {
+                buffer.append(char('0' + fraction % 10));
+            }
+        }
+        return maybeFlush();
+    }
+
+    // Смещение следующего байта от начала файла (для таблицы ссылок PDF)
+    qint64 pos() const { return flushed + buffer.size(); }
+
+    bool flush() {
+        if (!failed && !buffer.isEmpty()) {
+            failed = device->write(buffer.constData(), buffer.size()) != buffer.size();
+            flushed += buffer.size();
+            buffer.resize(0);
+        }
+        return !failed;
+    }
+    bool ok() const { return !failed; }
+
+private:
+    QIODevice *device;
+    QByteArray buffer;
+    qint64 flushed;
+    bool failed;
+
+    void appendInteger(qint64 value) {
+        char digits[24];
+        int length = 0;
+        quint64 magnitude = value < 0 ? quint64(-(value + 1)) + 1 : quint64(value);
+        do {
+            digits[length++] = char('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) {
+            buffer.append('-');
+        }
+        while (length > 0) {
+            buffer.append(digits[--length]);
+        }
+    }
+    ChunkWriter &maybeFlush() {
+        if (buffer.size() >= kChunkSize) {
+            flush();
+        }
+        return *this;
+    }
+};
+
+// Фигуры SVG: контуры одного элемента path
+class SvgSink {
+public:
+    explicit SvgSink(ChunkWriter &out) : out(out) {}
+
+    void beginPath() { out << "<path vector-effect=\"non-scaling-stroke\" d=\""; }
+    void endPath() { out << "\"/>\n"; }
+    void rect(const QRect &rect) {
+        const QRect r = rect.normalized();
+        out << 'M' << r.x() << ' ' << r.y() << 'h' << r.width() << 'v' << r.height() << 'h' << -r.width() << 'z';
+    }
+    void triangle(const QLine *outline) {
+        out << 'M' << outline[0].x1() << ' ' << outline[0].y1() << 'L' << outline[1].x1() << ' ' << outline[1].y1()
+            << 'L' << outline[2].x1() << ' ' << outline[2].y1() << 'z';
+    }
+    void ellipse(const QRect &rect) {
+        // Две полуокружности дугами: от левой точки к правой и обратно
+        const QRect r = rect.normalized();
+        const qreal rx = r.width() / 2.0;
+        const qreal ry = r.height() / 2.0;
+        out << 'M' << r.x() << ' ' << (r.y() + ry) << 'a' << rx << ' ' << ry << " 0 1 0 " << r.width() << " 0"
+            << 'a' << rx << ' ' << ry << " 0 1 0 " << -r.width() << " 0z";
+    }
+    void line(const QPoint &from, const QPoint &to) {
+        out << 'M' << from.x() << ' ' << from.y() << 'L' << to.x() << ' ' << to.y();
+    }
+
+private:
+    ChunkWriter &out;
+};
+
+// Фигуры PDF: операторы контура в потоке содержимого страницы
+class PdfSink {
+public:
+    explicit PdfSink(ChunkWriter &out) : out(out) {}
+
+    void beginPath() {}
+    void endPath() { out << "S\n"; }
+    void rect(const QRect &rect) {
+        const QRect r = rect.normalized();
+        out << r.x() << ' ' << r.y() << ' ' << r.width() << ' ' << r.height() << " re\n";
+    }
+    void triangle(const QLine *outline) {
+        out << outline[0].x1() << ' ' << outline[0].y1() << " m " << outline[1].x1() << ' ' << outline[1].y1()
+            << " l " << outline[2].x1() << ' ' << outline[2].y1() << " l h\n";
+    }
+    void ellipse(const QRect &rect) {
+        // Эллипса в PDF нет: четыре кривые Безье по четвертям
+        const QRect r = rect.normalized();
+        const qreal rx = r.width() / 2.0;
+        const qreal ry = r.height() / 2.0;
+        const qreal cx = r.x() + rx;
+        const qreal cy = r.y() + ry;
+        const qreal kx = rx * kBezierArc;
+        const qreal ky = ry * kBezierArc;
+        out << (cx + rx) << ' ' << cy << " m\n";
+        curve(cx + rx, cy + ky, cx + kx, cy + ry, cx, cy + ry);
+        curve(cx - kx, cy + ry, cx - rx, cy + ky, cx - rx, cy);
+        curve(cx - rx, cy - ky, cx - kx, cy - ry, cx, cy - ry);
+        curve(cx + kx, cy - ry, cx + rx, cy - ky, cx + rx, cy);
+        out << "h\n";
+    }
+    void line(const QPoint &from, const QPoint &to) {
+        out << from.x() << ' ' << from.y() << " m " << to.x() << ' ' << to.y() << " l\n";
+    }
+
+private:
+    ChunkWriter &out;
+
+    void curve(qreal x1, qreal y1, qreal x2, qreal y2, qreal x3, qreal y3) {
+        out << x1 << ' ' << y1 << ' ' << x2 << ' ' << y2 << ' ' << x3 << ' ' << y3 << " c\n";
+    }
+};
+
+// Обход сцены в порядке отрисовки SceneRenderer::render: фигуры по типам из
+// массивов хранилища (контуры треугольников готовые), затем связи.
+// Контур закрывается каждые kShapesPerPath элементов.
+template <typename Sink>
+bool streamScene(const Diagram &diagram, Sink &sink, ChunkWriter &out, const ProgressCallback &progress) {
+    const qint64 total = qMax<qint64>(1, qint64(diagram.figureCount()) + diagram.connectionCount());
+    qint64 done = 0;
+    int inPath = 0;
+    bool cancelled = false;
+    // Вызывается после каждого элемента; false - прервать обход
+    auto next = [&]() {
+        if (++inPath == kShapesPerPath) {
+            sink.endPath();
+            inPath = 0;
+        }
+        if (++done % kProgressStep == 0) {
+            cancelled = !out.ok() || (progress && !progress(int(qMin<qint64>(99, done * 100 / total))));
+        }
+        return !cancelled;
+    };
+    auto begin = [&]() {
+        if (inPath == 0) {
+            sink.beginPath();
+        }
+    };
+
+    const FigureStore &store = diagram.store();
+    const Shape shapes[] = { Rectangle, Triangle, Ellipse };
+    for (Shape shape : shapes) {
+        const QVector<QRect> &rects = store.rects(shape);
+        const QLine *outlines = store.triangleOutlines().constData();
+        for (int i = 0; i < rects.size(); ++i) {
+            begin();
+            switch (shape) {
+            case Rectangle:
+                sink.rect(rects[i]);
+                break;
+            case Triangle:
+                sink.triangle(outlines + 3 * i);
+                break;
+            default:
+                sink.ellipse(rects[i]);
+                break;
+            }
+            if (!next()) {
+                return false;
+            }
+        }
+    }
+
+    // Экземпляры разворачиваются в фигуры и внутренние связи своих символов
+    const SymbolLibrary &symbols = diagram.symbols();
+    std::function<bool(int, const QPoint &)> streamSymbol = [&](int id, const QPoint &topLeft) {
+        const Symbol *symbol = symbols.symbol(id);
+        if (!symbol) {
+            return true;
+        }
+        for (const Figure &figure : symbol->figures) {
+            if (figure.shape == Instance) {
+                if (!streamSymbol(figure.symbol, topLeft + figure.rect.topLeft())) {
+                    return false;
+                }
+                continue;
+            }
+            const QRect rect = figure.rect.translated(topLeft);
+            begin();
+            switch (figure.shape) {
+            case Rectangle:
+                sink.rect(rect);
+                break;
+            case Triangle: {
+                QVector<QLine> outline;
+                FigureStore::appendTriangleOutline(outline, rect);
+                sink.triangle(outline.constData());
+                break;
+            }
+            default:
+                sink.ellipse(rect);
+                break;
+            }
+            if (!next()) {
+                return false;
+            }
+        }
+        for (const Connection &connection : symbol->connections) {
+            begin();
+            sink.line(symbol->figures[connection.from].rect.center() + topLeft,
+                      symbol->figures[connection.to].rect.center() + topLeft);
+            if (!next()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const QVector<QRect> &instances = store.rects(Instance);
+    for (int i = 0; i < instances.size(); ++i) {
+        if (!streamSymbol(store.instanceSymbols()[i], instances[i].topLeft())) {
+            return false;
+        }
+    }
+
+    diagram.graph().forEachEdge([&](int from, int to) {
+        if (cancelled) {
+            return;
+        }
+        begin();
+        sink.line(diagram.figure(from)->rect.center(), diagram.figure(to)->rect.center());
+        next();
+    });
+    if (cancelled) {
+        return false;
+    }
+    if (inPath != 0) {
+        sink.endPath();
+    }
+    return true;
+}
+
+// Общая часть экспорта: файл пишется рядом и подменяет прежний только целиком
+bool writeExport(const QString &fileName, QString *errorMessage,
+                 const std::function<bool(ChunkWriter &out)> &write) {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        setError(errorMessage, "Ошибка: не удалось открыть файл для записи");
+        return false;
+    }
+    ChunkWriter out(&file);
+    if (!write(out)) {
+        file.cancelWriting();
+        setError(errorMessage, out.ok() ? kCancelledMessage : "Ошибка записи файла");
+        return false;
+    }
+    if (!out.flush() || !file.commit()) {
+        setError(errorMessage, "Ошибка записи файла");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+VectorFormat vectorFormatForFile(const QString &fileName) {
+    return QFileInfo(fileName).suffix().toLower() == "pdf" ? VectorFormat::Pdf : VectorFormat::Svg;
+}
+
+bool exportVector(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+                  const ProgressCallback &progress) {
+    return vectorFormatForFile(fileName) == VectorFormat::Pdf ? exportPdf(fileName, diagram, errorMessage, progress)
+                                                              : exportSvg(fileName, diagram, errorMessage, progress);
+}
+
+bool exportSvg(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+               const ProgressCallback &progress) {
+    PROFILE_SCOPE("exportSvg");
+    const QRect bounds = exportBounds(diagram);
+    return writeExport(fileName, errorMessage, [&](ChunkWriter &out) {
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" width=\"" << bounds.width()
+            << "\" height=\"" << bounds.height() << "\" viewBox=\"" << bounds.x() << ' ' << bounds.y() << ' '
+            << bounds.width() << ' ' << bounds.height() << "\">\n"
+            << "<rect x=\"" << bounds.x() << "\" y=\"" << bounds.y() << "\" width=\"" << bounds.width()
+            << "\" height=\"" << bounds.height() << "\" fill=\"white\"/>\n"
+            << "<g fill=\"none\" stroke=\"black\" stroke-width=\"1\">\n";
+        SvgSink sink(out);
+        if (!streamScene(diagram, sink, out, progress)) {
+            return false;
+        }
+        out << "</g>\n</svg>\n";
+        return out.ok();
+    });
+}
+
+bool exportPdf(const QString &fileName, const Diagram &diagram, QString *errorMessage,
+               const ProgressCallback &progress) {
+    PROFILE_SCOPE("exportPdf");
+    const QRect bounds = exportBounds(diagram);
+    // Одна единица сцены - один пункт, если страница не выходит за предел просмотрщиков
+    const qreal scale = qMin<qreal>(1.0, kMaxPdfPageSize / qMax(bounds.width(), bounds.height()));
+    return writeExport(fileName, errorMessage, [&](ChunkWriter &out) {
+        // Объекты: 1 - каталог, 2 - дерево страниц, 3 - страница, 4 - поток
+        // содержимого, 5 - его длина (известна только после записи потока)
+        qint64 offsets[6] = {};
+        out << "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+        offsets[1] = out.pos();
+        out << "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+        offsets[2] = out.pos();
+        out << "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n";
+        offsets[3] = out.pos();
+        out << "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << bounds.width() * scale << ' '
+            << bounds.height() * scale << "] /Contents 4 0 R >>\nendobj\n";
+        offsets[4] = out.pos();
+        out << "4 0 obj\n<< /Length 5 0 R >>\nstream\n";
+        const qint64 streamStart = out.pos();
+
+        // Ось y в PDF направлена вверх: сцена отражается и сдвигается на страницу.
+        // Нулевая толщина пера - самая тонкая линия устройства, как косметическое перо.
+        out << scale << " 0 0 " << -scale << ' ' << -bounds.x() * scale << ' '
+            << (bounds.y() + bounds.height()) * scale << " cm\n0 w\n";
+        PdfSink sink(out);
+        if (!streamScene(diagram, sink, out, progress)) {
+            return false;
+        }
+        const qint64 streamLength = out.pos() - streamStart;
+        out << "\nendstream\nendobj\n";
+        offsets[5] = out.pos();
+        out << "5 0 obj\n" << streamLength << "\nendobj\n";
+
+        const qint64 xref = out.pos();
+        out << "xref\n0 6\n0000000000 65535 f \n";
+        for (int i = 1; i < 6; ++i) {
+            out << QByteArray::number(offsets[i]).rightJustified(10, '0') << " 00000 n \n";
+        }
+        out << "trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n" << xref << "\n%%EOF\n";
+        return out.ok();
+    });
+}
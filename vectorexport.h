@@ -0,0 +1,34 @@
+// vectorexport.h
+
+#ifndef VECTOREXPORT_H
+#define VECTOREXPORT_H
+
+#include <QString>
+
+#include "diagram.h"
+#include "documentio.h"
+
+// Форматы векторного экспорта
+enum class VectorFormat {
+    Svg,   // *.svg
+    Pdf    // *.pdf, одна страница
+};
+
+// Формат определяется по расширению; все, кроме pdf, пишется в SVG
+VectorFormat vectorFormatForFile(const QString &fileName);
+
+// Векторный экспорт документа. Фигуры и связи пишутся потоком прямо из массивов
+// FigureStore и графа связей через буфер фиксированного размера: ни дерево SVG,
+// ни QPicture, ни страница QPdfWriter в памяти не строятся, поэтому расход памяти
+// не зависит от размера документа. Экземпляры символов разворачиваются
+// в фигуры по ходу записи. Геометрия та же, что в SceneRenderer::drawFigure;
+// линии, как и на экране, тонкие при любом масштабе.
+// При ошибке или отмене файл не создается и возвращается false.
+bool exportVector(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+                  const ProgressCallback &progress = ProgressCallback());
+bool exportSvg(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+               const ProgressCallback &progress = ProgressCallback());
+bool exportPdf(const QString &fileName, const Diagram &diagram, QString *errorMessage = nullptr,
+               const ProgressCallback &progress = ProgressCallback());
+
+#endif // VECTOREXPORT_H
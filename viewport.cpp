@@ -0,0 +1,68 @@
+#include "viewport.h"
+
+#include <QtMath>
+
+namespace {
+const qreal kMinZoom = 0.005;
+const qreal kMaxZoom = 32.0;
+// Запас в пикселях окна на косметическое перо и сглаживание
+const int kWidgetMargin = 2;
+}
+
+Viewport::Viewport() : zoom(1.0) {}
+
+QTransform Viewport::transform() const {
+    return QTransform(zoom, 0, 0, zoom, pan.x(), pan.y());
+}
+
+QPoint Viewport::mapToScene(const QPoint &widgetPos) const {
+    return QPoint(qFloor((widgetPos.x() - pan.x()) / zoom),
+                  qFloor((widgetPos.y() - pan.y()) / zoom));
+}
+
+QRect Viewport::mapToScene(const QRect &widgetRect) const {
+    const QRect r = widgetRect.normalized();
+    const qreal left = (r.left() - pan.x()) / zoom;
+    const qreal top = (r.top() - pan.y()) / zoom;
+    const qreal right = (r.right() + 1 - pan.x()) / zoom;
+    const qreal bottom = (r.bottom() + 1 - pan.y()) / zoom;
+    return QRect(QPoint(qFloor(left), qFloor(top)), QPoint(qCeil(right), qCeil(bottom)));
+}
+
+QRect Viewport::mapFromScene(const QRect &sceneRect) const {
+    if (sceneRect.isNull()) {
+        return QRect();
+    }
+    const QRect r = sceneRect.normalized();
+    const qreal left = r.left() * zoom + pan.x();
+    const qreal top = r.top() * zoom + pan.y();
+    const qreal right = (r.right() + 1) * zoom + pan.x();
+    const qreal bottom = (r.bottom() + 1) * zoom + pan.y();
+    return QRect(QPoint(qFloor(left), qFloor(top)), QPoint(qCeil(right), qCeil(bottom)))
+        .adjusted(-kWidgetMargin, -kWidgetMargin, kWidgetMargin, kWidgetMargin);
+}
+
+void Viewport::zoomAt(const QPoint &widgetPos, qreal factor) {
+    const QPointF anchor = (QPointF(widgetPos) - pan) / zoom;
+    zoom = qBound(kMinZoom, zoom * factor, kMaxZoom);
+    pan = QPointF(widgetPos) - anchor * zoom;
+}
+
+void Viewport::panBy(const QPoint &widgetDelta) {
+    pan += QPointF(widgetDelta);
+}
+
+void Viewport::fit(const QRect &sceneRect, const QSize &size) {
+    const QRectF r = QRectF(sceneRect.normalized());
+    if (r.isEmpty() || size.isEmpty()) {
+        reset();
+        return;
+    }
+    zoom = qBound(kMinZoom, qMin(size.width() / r.width(), size.height() / r.height()), kMaxZoom);
+    pan = QPointF(size.width() / 2.0, size.height() / 2.0) - r.center() * zoom;
+}
+
+void Viewport::reset() {
+    zoom = 1.0;
+    pan = QPointF();
+}
@@ -0,0 +1,39 @@
+// viewport.h
+
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QSize>
+#include <QTransform>
+
+// Преобразование между координатами сцены и окна: окно = сцена * масштаб + сдвиг
+class Viewport {
+public:
+    Viewport();
+
+    qreal scale() const { return zoom; }
+    QPointF offset() const { return pan; }
+    QTransform transform() const;
+
+    QPoint mapToScene(const QPoint &widgetPos) const;
+    // Область сцены, целиком покрывающая прямоугольник окна
+    QRect mapToScene(const QRect &widgetRect) const;
+    // Прямоугольник окна, целиком покрывающий область сцены (с запасом на перо)
+    QRect mapFromScene(const QRect &sceneRect) const;
+
+    // Масштабирование вокруг точки окна, которая остается на месте
+    void zoomAt(const QPoint &widgetPos, qreal factor);
+    void panBy(const QPoint &widgetDelta);
+    // Масштаб и сдвиг, при которых область сцены целиком и по центру видна в окне размера size
+    void fit(const QRect &sceneRect, const QSize &size);
+    void reset();
+
+private:
+    qreal zoom;
+    QPointF pan;
+};
+
+#endif // VIEWPORT_H